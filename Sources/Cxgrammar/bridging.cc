@@ -13,13 +13,19 @@
 #include <xgrammar/object.h>
 #include <xgrammar/tokenizer_info.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
+#include <future>
 #include <optional>
 #include <string>
+#include <type_traits>
 #include <variant>
 #include <vector>
 
+#include "compiled_grammar_impl.h"
+
 /* ------------------------------------------------------------------ */
 /*  Opaque handle definitions                                         */
 /* ------------------------------------------------------------------ */
@@ -40,6 +46,18 @@ struct xgrammar_grammar_matcher {
   xgrammar::GrammarMatcher obj;
 };
 
+struct xgrammar_batch_grammar_matcher {
+  xgrammar::BatchGrammarMatcher obj;
+};
+
+struct xgrammar_bitmask_future {
+  // The tensor and the matchers are used by the background task, so they live with the future.
+  int64_t shape[2];
+  DLTensor bitmask;
+  std::vector<xgrammar::GrammarMatcher> matchers;
+  std::variant<std::shared_future<bool>, std::shared_future<void>> result;
+};
+
 struct xgrammar_tokenizer_info {
   xgrammar::TokenizerInfo obj;
 };
@@ -92,6 +110,29 @@ std::vector<std::string> to_string_vector(const char* const* strings, int32_t co
   return result;
 }
 
+std::vector<xgrammar::GrammarMatcher> to_matcher_vector(
+    xgrammar_grammar_matcher* const* matchers, int32_t count
+) {
+  std::vector<xgrammar::GrammarMatcher> result;
+  result.reserve(static_cast<size_t>(count));
+  for (int32_t i = 0; i < count; ++i) {
+    result.push_back(matchers[i]->obj);
+  }
+  return result;
+}
+
+DLTensor make_bitmask_tensor(int32_t* bitmask_data, int64_t* shape) {
+  DLTensor bitmask;
+  bitmask.data = bitmask_data;
+  bitmask.device = DLDevice{kDLCPU, 0};
+  bitmask.ndim = 2;
+  bitmask.dtype = DLDataType{kDLInt, 32, 1};
+  bitmask.shape = shape;
+  bitmask.strides = nullptr;
+  bitmask.byte_offset = 0;
+  return bitmask;
+}
+
 xgrammar::VocabType to_vocab_type(xgrammar_vocab_type vt) {
   switch (vt) {
     case XGRAMMAR_VOCAB_BYTE_FALLBACK:
@@ -291,6 +332,21 @@ size_t xgrammar_compiled_grammar_memory_size(const xgrammar_compiled_grammar* cg
   return cg->obj.MemorySizeBytes();
 }
 
+xgrammar_token_mask_compile_stats xgrammar_compiled_grammar_token_mask_compile_stats(
+    const xgrammar_compiled_grammar* cg
+) {
+  if (!cg) return xgrammar_token_mask_compile_stats{};
+  const auto& stats = cg->obj->token_mask_compile_stats;
+  return xgrammar_token_mask_compile_stats{
+      static_cast<int32_t>(cg->obj->adaptive_token_mask_index.Size()),
+      static_cast<int32_t>(cg->obj->adaptive_token_masks.size()),
+      stats.num_reused_states,
+      stats.num_shared_rule_states,
+      stats.num_fsm_walk_states,
+      stats.num_vocab_chunks
+  };
+}
+
 char* xgrammar_compiled_grammar_serialize_json(const xgrammar_compiled_grammar* cg) {
   if (!cg) return nullptr;
   return copy_string(cg->obj.SerializeJSON());
@@ -304,12 +360,23 @@ xgrammar_grammar_compiler* xgrammar_compiler_create(
     const xgrammar_tokenizer_info* tokenizer_info,
     int32_t max_threads,
     bool cache_enabled,
-    int64_t max_memory_bytes
+    int64_t max_memory_bytes,
+    bool token_masks_as_bitsets,
+    bool lazy_token_masks,
+    int64_t token_bitmask_cache_bytes,
+    bool reuse_rule_masks
 ) {
   if (!tokenizer_info) return nullptr;
-  return new xgrammar_grammar_compiler{
-      xgrammar::GrammarCompiler(tokenizer_info->obj, max_threads, cache_enabled, max_memory_bytes)
-  };
+  return new xgrammar_grammar_compiler{xgrammar::GrammarCompiler(
+      tokenizer_info->obj,
+      max_threads,
+      cache_enabled,
+      max_memory_bytes,
+      token_masks_as_bitsets,
+      lazy_token_masks,
+      token_bitmask_cache_bytes,
+      reuse_rule_masks
+  )};
 }
 
 void xgrammar_compiler_destroy(xgrammar_grammar_compiler* compiler) { delete compiler; }
@@ -399,6 +466,11 @@ xgrammar_grammar_matcher* xgrammar_matcher_create(
 
 void xgrammar_matcher_destroy(xgrammar_grammar_matcher* matcher) { delete matcher; }
 
+xgrammar_grammar_matcher* xgrammar_matcher_fork(const xgrammar_grammar_matcher* matcher) {
+  if (!matcher) return nullptr;
+  return new xgrammar_grammar_matcher{matcher->obj.Fork()};
+}
+
 bool xgrammar_matcher_accept_token(xgrammar_grammar_matcher* matcher, int32_t token_id) {
   if (!matcher) return false;
   return matcher->obj.AcceptToken(token_id, false);
@@ -427,6 +499,63 @@ bool xgrammar_matcher_fill_next_token_bitmask(
   return matcher->obj.FillNextTokenBitmask(&bitmask, index, false);
 }
 
+int32_t xgrammar_matcher_find_longest_accepted_prefix(
+    xgrammar_grammar_matcher* matcher, const int32_t* token_ids, int32_t token_count
+) {
+  if (!matcher || !token_ids || token_count <= 0) return 0;
+  return matcher->obj.FindLongestAcceptedPrefix(
+      std::vector<int32_t>(token_ids, token_ids + token_count), false
+  );
+}
+
+void xgrammar_matcher_traverse_draft_tree(
+    xgrammar_grammar_matcher* matcher,
+    const int32_t* draft_tokens,
+    const int32_t* parent_indices,
+    int32_t num_nodes,
+    int32_t* bitmask_data,
+    int32_t bitmask_count,
+    bool* out_accepted
+) {
+  if (!matcher || !draft_tokens || !parent_indices || num_nodes <= 0 || !bitmask_data ||
+      bitmask_count <= 0 || !out_accepted)
+    return;
+
+  int64_t shape[2] = {static_cast<int64_t>(num_nodes), static_cast<int64_t>(bitmask_count)};
+  DLTensor bitmask;
+  bitmask.data = bitmask_data;
+  bitmask.device = DLDevice{kDLCPU, 0};
+  bitmask.ndim = 2;
+  bitmask.dtype = DLDataType{kDLInt, 32, 1};
+  bitmask.shape = shape;
+  bitmask.strides = nullptr;
+  bitmask.byte_offset = 0;
+
+  auto accepted = matcher->obj.TraverseDraftTree(
+      std::vector<int32_t>(draft_tokens, draft_tokens + num_nodes),
+      std::vector<int32_t>(parent_indices, parent_indices + num_nodes),
+      &bitmask
+  );
+  for (int32_t i = 0; i < num_nodes; ++i) {
+    out_accepted[i] = accepted[i] != 0;
+  }
+}
+
+xgrammar_bitmask_future* xgrammar_matcher_fill_next_token_bitmask_async(
+    xgrammar_grammar_matcher* matcher, int32_t* bitmask_data, int32_t bitmask_count
+) {
+  if (!matcher || !bitmask_data || bitmask_count <= 0) return nullptr;
+
+  auto* future = new xgrammar_bitmask_future{};
+  future->shape[0] = 1;
+  future->shape[1] = static_cast<int64_t>(bitmask_count);
+  future->bitmask = make_bitmask_tensor(bitmask_data, future->shape);
+  future->bitmask.ndim = 1;
+  future->bitmask.shape = &future->shape[1];
+  future->result = matcher->obj.FillNextTokenBitmaskAsync(&future->bitmask, 0, false);
+  return future;
+}
+
 char* xgrammar_matcher_find_jump_forward_string(xgrammar_grammar_matcher* matcher) {
   if (!matcher) return nullptr;
   return copy_string(matcher->obj.FindJumpForwardString());
@@ -437,6 +566,29 @@ void xgrammar_matcher_rollback(xgrammar_grammar_matcher* matcher, int32_t num_to
   matcher->obj.Rollback(num_tokens);
 }
 
+xgrammar_matcher_checkpoint xgrammar_matcher_snapshot(const xgrammar_grammar_matcher* matcher) {
+  if (!matcher) return xgrammar_matcher_checkpoint{};
+  auto checkpoint = matcher->obj.Snapshot();
+  return xgrammar_matcher_checkpoint{
+      checkpoint.num_history_rows,
+      checkpoint.history_epoch_id,
+      checkpoint.num_tokens,
+      checkpoint.is_terminated
+  };
+}
+
+void xgrammar_matcher_restore(
+    xgrammar_grammar_matcher* matcher, xgrammar_matcher_checkpoint checkpoint
+) {
+  if (!matcher) return;
+  matcher->obj.Restore(xgrammar::GrammarMatcher::Checkpoint{
+      checkpoint.num_history_rows,
+      checkpoint.history_epoch_id,
+      checkpoint.num_tokens,
+      checkpoint.is_terminated
+  });
+}
+
 void xgrammar_matcher_reset(xgrammar_grammar_matcher* matcher) {
   if (!matcher) return;
   matcher->obj.Reset();
@@ -464,6 +616,160 @@ char* xgrammar_matcher_debug_print(const xgrammar_grammar_matcher* matcher) {
   return copy_string(matcher->obj._DebugPrintInternalState());
 }
 
+/* ------------------------------------------------------------------ */
+/*  Batch Grammar Matcher                                             */
+/* ------------------------------------------------------------------ */
+
+xgrammar_batch_grammar_matcher* xgrammar_batch_matcher_create(int32_t max_threads) {
+  if (max_threads <= 0) {
+    return new xgrammar_batch_grammar_matcher{xgrammar::BatchGrammarMatcher("auto")};
+  }
+  return new xgrammar_batch_grammar_matcher{xgrammar::BatchGrammarMatcher(max_threads)};
+}
+
+void xgrammar_batch_matcher_destroy(xgrammar_batch_grammar_matcher* batch_matcher) {
+  delete batch_matcher;
+}
+
+void xgrammar_batch_matcher_fill_next_token_bitmask(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count
+) {
+  if (!batch_matcher || !matchers || num_matchers <= 0 || !bitmask_data || bitmask_count <= 0)
+    return;
+
+  auto matcher_vector = to_matcher_vector(matchers, num_matchers);
+  int64_t shape[2] = {static_cast<int64_t>(num_matchers), static_cast<int64_t>(bitmask_count)};
+  DLTensor bitmask = make_bitmask_tensor(bitmask_data, shape);
+  batch_matcher->obj.BatchFillNextTokenBitmask(&matcher_vector, &bitmask);
+}
+
+xgrammar_bitmask_future* xgrammar_batch_matcher_fill_next_token_bitmask_async(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count
+) {
+  if (!batch_matcher || !matchers || num_matchers <= 0 || !bitmask_data || bitmask_count <= 0)
+    return nullptr;
+
+  auto* future = new xgrammar_bitmask_future{};
+  future->shape[0] = static_cast<int64_t>(num_matchers);
+  future->shape[1] = static_cast<int64_t>(bitmask_count);
+  future->bitmask = make_bitmask_tensor(bitmask_data, future->shape);
+  future->matchers = to_matcher_vector(matchers, num_matchers);
+  future->result =
+      batch_matcher->obj.BatchFillNextTokenBitmaskAsync(&future->matchers, &future->bitmask);
+  return future;
+}
+
+void xgrammar_batch_matcher_accept_token(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    int32_t num_matchers,
+    bool* out_accepted
+) {
+  if (!batch_matcher || !matchers || !token_ids || num_matchers <= 0 || !out_accepted) return;
+
+  auto matcher_vector = to_matcher_vector(matchers, num_matchers);
+  auto accepted = batch_matcher->obj.BatchAcceptTokenParallel(
+      &matcher_vector, std::vector<int32_t>(token_ids, token_ids + num_matchers)
+  );
+  for (int32_t i = 0; i < num_matchers; ++i) {
+    out_accepted[i] = accepted[i] != 0;
+  }
+}
+
+void xgrammar_batch_matcher_accept_token_and_fill_next_token_bitmask(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count,
+    bool* out_accepted
+) {
+  if (!batch_matcher || !matchers || !token_ids || num_matchers <= 0 || !bitmask_data ||
+      bitmask_count <= 0 || !out_accepted)
+    return;
+
+  auto matcher_vector = to_matcher_vector(matchers, num_matchers);
+  int64_t shape[2] = {static_cast<int64_t>(num_matchers), static_cast<int64_t>(bitmask_count)};
+  DLTensor bitmask = make_bitmask_tensor(bitmask_data, shape);
+  auto accepted = batch_matcher->obj.BatchAcceptTokenAndFillNextTokenBitmask(
+      &matcher_vector, std::vector<int32_t>(token_ids, token_ids + num_matchers), &bitmask
+  );
+  for (int32_t i = 0; i < num_matchers; ++i) {
+    out_accepted[i] = accepted[i] != 0;
+  }
+}
+
+void xgrammar_batch_matcher_find_longest_accepted_prefix(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    const int32_t* token_counts,
+    int32_t num_matchers,
+    int32_t* out_lengths
+) {
+  if (!batch_matcher || !matchers || !token_counts || num_matchers <= 0 || !out_lengths) return;
+
+  auto matcher_vector = to_matcher_vector(matchers, num_matchers);
+  std::vector<std::vector<int32_t>> token_id_vectors(num_matchers);
+  const int32_t* begin = token_ids;
+  for (int32_t i = 0; i < num_matchers; ++i) {
+    if (token_counts[i] > 0) {
+      token_id_vectors[i].assign(begin, begin + token_counts[i]);
+      begin += token_counts[i];
+    }
+  }
+  auto lengths =
+      batch_matcher->obj.BatchFindLongestAcceptedPrefix(&matcher_vector, token_id_vectors);
+  std::copy(lengths.begin(), lengths.end(), out_lengths);
+}
+
+/* ------------------------------------------------------------------ */
+/*  Bitmask Future                                                    */
+/* ------------------------------------------------------------------ */
+
+bool xgrammar_bitmask_future_wait(
+    xgrammar_bitmask_future* future, bool* out_needs_apply, char** out_error
+) {
+  if (out_needs_apply) *out_needs_apply = false;
+  if (out_error) *out_error = nullptr;
+  if (!future) return false;
+
+  try {
+    bool needs_apply = std::visit(
+        [](const auto& result) {
+          if constexpr (std::is_same_v<std::decay_t<decltype(result)>, std::shared_future<bool>>) {
+            return result.get();
+          } else {
+            result.get();
+            return true;
+          }
+        },
+        future->result
+    );
+    if (out_needs_apply) *out_needs_apply = needs_apply;
+    return true;
+  } catch (const std::exception& e) {
+    if (out_error) *out_error = copy_string(e.what());
+    return false;
+  }
+}
+
+void xgrammar_bitmask_future_destroy(xgrammar_bitmask_future* future) {
+  if (!future) return;
+  std::visit([](const auto& result) { result.wait(); }, future->result);
+  delete future;
+}
+
 /* ------------------------------------------------------------------ */
 /*  Tokenizer Info                                                    */
 /* ------------------------------------------------------------------ */
@@ -618,6 +924,80 @@ int32_t xgrammar_get_bitmask_size(int32_t vocab_size) {
   return xgrammar::GetBitmaskSize(vocab_size);
 }
 
+void xgrammar_apply_token_bitmask_inplace_cpu(
+    float* logits,
+    int32_t logits_count,
+    const int32_t* bitmask_data,
+    int32_t bitmask_count,
+    int32_t vocab_size
+) {
+  if (!logits || !bitmask_data || logits_count <= 0 || bitmask_count <= 0) return;
+
+  int64_t logits_shape[1] = {static_cast<int64_t>(logits_count)};
+  DLTensor logits_tensor;
+  logits_tensor.data = logits;
+  logits_tensor.device = DLDevice{kDLCPU, 0};
+  logits_tensor.ndim = 1;
+  logits_tensor.dtype = DLDataType{kDLFloat, 32, 1};
+  logits_tensor.shape = logits_shape;
+  logits_tensor.strides = nullptr;
+  logits_tensor.byte_offset = 0;
+
+  int64_t bitmask_shape[1] = {static_cast<int64_t>(bitmask_count)};
+  DLTensor bitmask;
+  bitmask.data = const_cast<int32_t*>(bitmask_data);
+  bitmask.device = DLDevice{kDLCPU, 0};
+  bitmask.ndim = 1;
+  bitmask.dtype = DLDataType{kDLInt, 32, 1};
+  bitmask.shape = bitmask_shape;
+  bitmask.strides = nullptr;
+  bitmask.byte_offset = 0;
+
+  xgrammar::ApplyTokenBitmaskInplaceCPU(&logits_tensor, bitmask, vocab_size);
+}
+
+void xgrammar_apply_token_bitmask_batch_inplace_cpu(
+    float* logits,
+    int32_t batch_size,
+    int32_t logits_stride,
+    const int32_t* bitmask_data,
+    int32_t bitmask_stride,
+    int32_t vocab_size,
+    int32_t num_threads
+) {
+  if (!logits || !bitmask_data || batch_size <= 0 || logits_stride <= 0 || bitmask_stride <= 0) {
+    return;
+  }
+
+  int64_t logits_shape[2] = {
+      static_cast<int64_t>(batch_size), static_cast<int64_t>(logits_stride)
+  };
+  DLTensor logits_tensor;
+  logits_tensor.data = logits;
+  logits_tensor.device = DLDevice{kDLCPU, 0};
+  logits_tensor.ndim = 2;
+  logits_tensor.dtype = DLDataType{kDLFloat, 32, 1};
+  logits_tensor.shape = logits_shape;
+  logits_tensor.strides = nullptr;
+  logits_tensor.byte_offset = 0;
+
+  int64_t bitmask_shape[2] = {
+      static_cast<int64_t>(batch_size), static_cast<int64_t>(bitmask_stride)
+  };
+  DLTensor bitmask;
+  bitmask.data = const_cast<int32_t*>(bitmask_data);
+  bitmask.device = DLDevice{kDLCPU, 0};
+  bitmask.ndim = 2;
+  bitmask.dtype = DLDataType{kDLInt, 32, 1};
+  bitmask.shape = bitmask_shape;
+  bitmask.strides = nullptr;
+  bitmask.byte_offset = 0;
+
+  xgrammar::ApplyTokenBitmaskInplaceCPU(
+      &logits_tensor, bitmask, vocab_size, std::nullopt, std::max(1, num_threads)
+  );
+}
+
 int32_t xgrammar_get_max_recursion_depth(void) {
   return static_cast<int32_t>(xgrammar::GetMaxRecursionDepth());
 }
@@ -5,6 +5,9 @@
 
 #include <xgrammar/compiler.h>
 
+#include <algorithm>
+#include <iterator>
+
 #include "compiled_grammar_impl.h"
 #include "support/json_serializer.h"
 #include "testing.h"
@@ -15,55 +18,160 @@ namespace xgrammar {
 
 /******************* AdaptiveTokenMask *******************/
 
-AdaptiveTokenMask::AdaptiveTokenMask(
-    size_t vocab_size,
-    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+namespace {
+
+/*! \brief Get the [begin, end) runs of consecutive indices in a sorted index list. */
+std::vector<std::pair<int32_t, int32_t>> GetIndexRuns(const std::vector<int32_t>& indices) {
+  std::vector<std::pair<int32_t, int32_t>> runs;
+  for (auto idx : indices) {
+    if (!runs.empty() && runs.back().second == idx) {
+      ++runs.back().second;
+    } else {
+      runs.emplace_back(idx, idx + 1);
+    }
+  }
+  return runs;
+}
+
+/*!
+ * \brief Get the runs of [0, num_tokens) \ accepted_indices \ uncertain_indices, without
+ * materializing the indices. Both lists are sorted and disjoint.
+ */
+std::vector<std::pair<int32_t, int32_t>> GetComplementIndexRuns(
+    int32_t num_tokens,
     const std::vector<int32_t>& accepted_indices,
-    const std::vector<int32_t>& rejected_indices,
     const std::vector<int32_t>& uncertain_indices
 ) {
-  auto size_acc = accepted_indices.size();
-  auto size_rej = rejected_indices.size();
-
-  store_type = size_acc >= USE_BITSET_THRESHOLD && size_rej >= USE_BITSET_THRESHOLD
-                   ? StoreType::kAcceptedBitset
-               : size_acc < size_rej ? StoreType::kAccepted
-                                     : StoreType::kRejected;
-
-  if (store_type == StoreType::kAcceptedBitset) {
-    accepted_bitset = DynamicBitset(vocab_size);
-    for (auto idx : accepted_indices) {
-      accepted_bitset.Set(sorted_decoded_vocab[idx].first, true);
+  std::vector<std::pair<int32_t, int32_t>> runs;
+  int32_t run_begin = 0;
+  auto add_run_before = [&](int32_t covered_idx) {
+    if (run_begin < covered_idx) {
+      runs.emplace_back(run_begin, covered_idx);
+    }
+    run_begin = covered_idx + 1;
+  };
+  int acc_ptr = 0;
+  int unc_ptr = 0;
+  while (acc_ptr < static_cast<int>(accepted_indices.size()) ||
+         unc_ptr < static_cast<int>(uncertain_indices.size())) {
+    if (unc_ptr == static_cast<int>(uncertain_indices.size()) ||
+        (acc_ptr < static_cast<int>(accepted_indices.size()) &&
+         accepted_indices[acc_ptr] < uncertain_indices[unc_ptr])) {
+      add_run_before(accepted_indices[acc_ptr++]);
+    } else {
+      add_run_before(uncertain_indices[unc_ptr++]);
     }
-  } else if (store_type == StoreType::kAccepted) {
-    this->accepted_indices = accepted_indices;
-  } else {
-    this->rejected_indices = rejected_indices;
   }
+  add_run_before(num_tokens);
+  return runs;
+}
+
+}  // namespace
 
-  this->uncertain_indices = uncertain_indices;
+AdaptiveTokenMask::AdaptiveTokenMask(
+    size_t vocab_size,
+    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+    const std::vector<int32_t>& accepted_indices,
+    const std::vector<int32_t>& rejected_indices,
+    const std::vector<int32_t>& uncertain_indices,
+    bool always_use_bitset
+) {
+  Init(
+      vocab_size,
+      sorted_decoded_vocab,
+      accepted_indices,
+      &rejected_indices,
+      GetIndexRuns(rejected_indices),
+      uncertain_indices,
+      always_use_bitset
+  );
 }
 
 AdaptiveTokenMask::AdaptiveTokenMask(
     size_t vocab_size,
     const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
     const std::vector<int32_t>& accepted_indices,
-    const std::vector<int32_t>& uncertain_indices
+    const std::vector<int32_t>& uncertain_indices,
+    bool always_use_bitset
 ) {
-  auto size_acc = accepted_indices.size();
+  // The rejected indices are not collected when there are many of them. Their runs are derived
+  // instead, and the indices are only built if they are chosen to be stored.
+  Init(
+      vocab_size,
+      sorted_decoded_vocab,
+      accepted_indices,
+      nullptr,
+      GetComplementIndexRuns(sorted_decoded_vocab.size(), accepted_indices, uncertain_indices),
+      uncertain_indices,
+      always_use_bitset
+  );
+}
 
-  store_type = size_acc >= USE_BITSET_THRESHOLD ? StoreType::kAcceptedBitset : StoreType::kAccepted;
+void AdaptiveTokenMask::Init(
+    size_t vocab_size,
+    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+    const std::vector<int32_t>& accepted_indices,
+    const std::vector<int32_t>* rejected_indices,
+    std::vector<std::pair<int32_t, int32_t>>&& rejected_runs,
+    const std::vector<int32_t>& uncertain_indices,
+    bool always_use_bitset
+) {
+  auto accepted_runs = GetIndexRuns(accepted_indices);
+  std::size_t num_rejected =
+      sorted_decoded_vocab.size() - accepted_indices.size() - uncertain_indices.size();
 
-  if (store_type == StoreType::kAcceptedBitset) {
-    accepted_bitset = DynamicBitset(vocab_size);
-    for (auto idx : accepted_indices) {
-      accepted_bitset.Set(sorted_decoded_vocab[idx].first, true);
-    }
+  if (always_use_bitset) {
+    store_type = StoreType::kAcceptedBitset;
+  } else {
+    // Choose the store type with the smallest memory size. On ties, prefer the earlier one. The
+    // runs are expanded token by token when the mask is applied, so only the runs of the smaller
+    // of the accepted and rejected sets are considered, to keep that cost proportional to it.
+    bool accepted_is_smaller = accepted_indices.size() <= num_rejected;
+    std::pair<std::size_t, StoreType> candidates[] = {
+        {MemorySize(accepted_indices), StoreType::kAccepted},
+        {num_rejected * sizeof(int32_t), StoreType::kRejected},
+        {DynamicBitset::GetBufferSize(vocab_size) * sizeof(uint32_t), StoreType::kAcceptedBitset},
+        {MemorySize(accepted_is_smaller ? accepted_runs : rejected_runs),
+         accepted_is_smaller ? StoreType::kAcceptedRuns : StoreType::kRejectedRuns},
+    };
+    store_type = std::min_element(
+                     std::begin(candidates),
+                     std::end(candidates),
+                     [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; }
+    )->second;
+  }
+
+  switch (store_type) {
+    case StoreType::kAccepted:
+      this->accepted_indices = accepted_indices;
+      break;
+    case StoreType::kRejected:
+      if (rejected_indices) {
+        this->rejected_indices = *rejected_indices;
+      } else {
+        ExpandRuns(rejected_runs, &this->rejected_indices);
+      }
+      break;
+    case StoreType::kAcceptedBitset:
+      accepted_bitset = DynamicBitset(vocab_size);
+      for (auto idx : accepted_indices) {
+        accepted_bitset.Set(sorted_decoded_vocab[idx].first, true);
+      }
+      break;
+    case StoreType::kAcceptedRuns:
+      index_runs = std::move(accepted_runs);
+      break;
+    case StoreType::kRejectedRuns:
+      index_runs = std::move(rejected_runs);
+      break;
+  }
+
+  auto uncertain_runs = GetIndexRuns(uncertain_indices);
+  if (MemorySize(uncertain_runs) < MemorySize(uncertain_indices)) {
+    this->uncertain_runs = std::move(uncertain_runs);
   } else {
-    XGRAMMAR_DCHECK(store_type == StoreType::kAccepted);
-    this->accepted_indices = accepted_indices;
+    this->uncertain_indices = uncertain_indices;
   }
-  this->uncertain_indices = uncertain_indices;
 }
 
 std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const {
@@ -72,6 +180,8 @@ std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const
   const auto& sorted_decoded_vocab = tokenizer_info.GetSortedDecodedVocab();
   std::vector<int32_t> accepted_indices;
   std::vector<int32_t> rejected_indices;
+  std::vector<int32_t> uncertain_indices_buffer;
+  const auto& uncertain_indices = GetUncertainIndices(&uncertain_indices_buffer);
   std::unordered_set<int32_t> uncertain_indices_set(
       uncertain_indices.begin(), uncertain_indices.end()
   );
@@ -90,8 +200,12 @@ std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const
         rejected_indices.push_back(i);
       }
     }
-  } else if (store_type == StoreType::kAccepted) {
-    accepted_indices = this->accepted_indices;
+  } else if (store_type == StoreType::kAccepted || store_type == StoreType::kAcceptedRuns) {
+    if (store_type == StoreType::kAccepted) {
+      accepted_indices = this->accepted_indices;
+    } else {
+      ExpandRuns(index_runs, &accepted_indices);
+    }
     // Reject indices = [0, sorted_decoded_vocab.size()) \ accepted_indices \ uncertain_indices
     int acc_ptr = 0;
     for (int i = 0; i < static_cast<int>(sorted_decoded_vocab.size()); ++i) {
@@ -107,8 +221,14 @@ std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const
       rejected_indices.push_back(i);
     }
   } else {
-    XGRAMMAR_DCHECK(store_type == StoreType::kRejected);
-    rejected_indices = this->rejected_indices;
+    XGRAMMAR_DCHECK(
+        store_type == StoreType::kRejected || store_type == StoreType::kRejectedRuns
+    );
+    if (store_type == StoreType::kRejected) {
+      rejected_indices = this->rejected_indices;
+    } else {
+      ExpandRuns(index_runs, &rejected_indices);
+    }
     // Accepted indices = [0, sorted_decoded_vocab.size()) \ rejected_indices \ uncertain_indices
     int rej_ptr = 0;
     for (int i = 0; i < static_cast<int>(sorted_decoded_vocab.size()); ++i) {
@@ -127,7 +247,9 @@ std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const
 
   std::string storage_type_str = store_type == StoreType::kAcceptedBitset ? "AcceptedBitset"
                                  : store_type == StoreType::kAccepted     ? "Accepted"
-                                                                          : "Rejected";
+                                 : store_type == StoreType::kRejected     ? "Rejected"
+                                 : store_type == StoreType::kAcceptedRuns ? "AcceptedRuns"
+                                                                          : "RejectedRuns";
 
   ss << "AdaptiveTokenMask(num_tokens=" << sorted_decoded_vocab.size()
      << ", accepted_num=" << accepted_indices.size() << ", rejected_num=" << rejected_indices.size()
@@ -164,11 +286,38 @@ std::string AdaptiveTokenMask::Print(const TokenizerInfo& tokenizer_info) const
 
 /************** CompiledGrammar::Impl **************/
 
+void CompiledGrammar::Impl::AddAdaptiveTokenMask(
+    const ParserState& state, AdaptiveTokenMask&& mask
+) {
+  auto hash = std::hash<AdaptiveTokenMask>{}(mask);
+  auto [begin, end] = adaptive_token_mask_ids_by_hash.equal_range(hash);
+  for (auto it = begin; it != end; ++it) {
+    if (adaptive_token_masks[it->second] == mask) {
+      adaptive_token_mask_index.Set(state, it->second);
+      return;
+    }
+  }
+  int32_t id = adaptive_token_masks.size();
+  adaptive_token_masks.push_back(std::move(mask));
+  adaptive_token_mask_ids_by_hash.emplace(hash, id);
+  adaptive_token_mask_index.Set(state, id);
+}
+
 picojson::value SerializeJSONValue(const CompiledGrammar::Impl& impl) {
+  if (impl.lazy_adaptive_token_masks != nullptr) {
+    impl.lazy_adaptive_token_masks->Complete();
+  }
   auto result = picojson::object{};
   result["grammar"] = AutoSerializeJSONValue(impl.grammar);
   result["tokenizer_metadata"] = impl.tokenizer_info->DumpMetadataValue();
-  result["adaptive_token_mask_cache"] = AutoSerializeJSONValue(impl.adaptive_token_mask_cache);
+  result["adaptive_token_masks"] = AutoSerializeJSONValue(impl.adaptive_token_masks);
+  // The mapping from the states to the mask ids is stored as [state, id] pairs sorted by state.
+  std::vector<std::pair<ParserState, int32_t>> mask_ids;
+  impl.adaptive_token_mask_index.ForEach([&](const ParserState& state, int32_t id) {
+    mask_ids.emplace_back(state, id);
+  });
+  std::sort(mask_ids.begin(), mask_ids.end());
+  result["adaptive_token_mask_ids"] = AutoSerializeJSONValue(mask_ids);
   return picojson::value(result);
 }
 
@@ -196,17 +345,148 @@ std::optional<SerializationError> DeserializeJSONValue(
     );
   }
   impl->tokenizer_info = tokenizer_info;
-  if (object.find("adaptive_token_mask_cache") == object.end()) {
-    return ConstructDeserializeError("Expect a 'adaptive_token_mask_cache' field", type_name);
+  if (object.find("adaptive_token_masks") == object.end()) {
+    return ConstructDeserializeError("Expect a 'adaptive_token_masks' field", type_name);
+  }
+  AutoDeserializeJSONValue(&(impl->adaptive_token_masks), object["adaptive_token_masks"]);
+  if (object.find("adaptive_token_mask_ids") == object.end()) {
+    return ConstructDeserializeError("Expect a 'adaptive_token_mask_ids' field", type_name);
+  }
+  std::vector<std::pair<ParserState, int32_t>> mask_ids;
+  if (auto error = AutoDeserializeJSONValue(&mask_ids, object["adaptive_token_mask_ids"])) {
+    return error;
+  }
+  for (const auto& [state, id] : mask_ids) {
+    if (id < 0 || id >= static_cast<int32_t>(impl->adaptive_token_masks.size())) {
+      return ConstructDeserializeError("Invalid adaptive token mask id", type_name);
+    }
+    impl->adaptive_token_mask_index.Set(state, id);
+  }
+  for (int32_t id = 0; id < static_cast<int32_t>(impl->adaptive_token_masks.size()); ++id) {
+    impl->adaptive_token_mask_ids_by_hash.emplace(
+        std::hash<AdaptiveTokenMask>{}(impl->adaptive_token_masks[id]), id
+    );
   }
-  AutoDeserializeJSONValue(&(impl->adaptive_token_mask_cache), object["adaptive_token_mask_cache"]);
   return std::nullopt;
 }
 
+/************** LazyAdaptiveTokenMasks **************/
+
+LazyAdaptiveTokenMasks::LazyAdaptiveTokenMasks(
+    CompiledGrammar::Impl* impl,
+    std::function<AdaptiveTokenMask(const ParserState&)> compute,
+    const std::vector<ParserState>& states,
+    std::unordered_map<ParserState, ParserState, StateHashForCache> mask_sources,
+    int num_background_threads
+)
+    : impl_(impl),
+      compute_(std::move(compute)),
+      states_(states),
+      state_set_(states.begin(), states.end()),
+      mask_sources_(std::move(mask_sources)),
+      mask_ids_([this](const StateKey& key) { return ComputeAndAdd(key); }),
+      num_remaining_states_(state_set_.size()),
+      num_pending_masks_(state_set_.size() - mask_sources_.size()) {
+  // Every mask is added at most once, so the masks are never reallocated and the pointers to them
+  // stay valid while other masks are added. Some masks may already be added, e.g. the reused ones.
+  impl_->adaptive_token_masks.reserve(impl_->adaptive_token_masks.size() + state_set_.size());
+  if (num_background_threads > 0 && !state_set_.empty()) {
+    background_thread_pool_.emplace(num_background_threads);
+    for (const auto& state : states_) {
+      background_thread_pool_->Execute([this, state]() {
+        if (stopped_.load(std::memory_order_relaxed)) {
+          return;
+        }
+        try {
+          Get(state);
+        } catch (...) {
+          // The error is raised again when a matcher needs the mask.
+        }
+      });
+    }
+    // No more tasks are added, so the threads can exit once all the masks are computed, instead of
+    // staying idle for the lifetime of the grammar.
+    background_thread_pool_->Shutdown();
+  }
+}
+
+LazyAdaptiveTokenMasks::~LazyAdaptiveTokenMasks() { stopped_.store(true); }
+
+const AdaptiveTokenMask* LazyAdaptiveTokenMasks::Get(const ParserState& state) {
+  {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    auto id = impl_->adaptive_token_mask_index.Find(state);
+    if (id != -1) {
+      return &impl_->adaptive_token_masks[id];
+    }
+  }
+  auto source_it = mask_sources_.find(state);
+  if (source_it != mask_sources_.end()) {
+    auto mask = Get(source_it->second);
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    if (impl_->adaptive_token_mask_index.Find(state) == -1) {
+      impl_->ShareAdaptiveTokenMask(source_it->first, source_it->second);
+      num_remaining_states_.fetch_sub(1, std::memory_order_release);
+    }
+    return mask;
+  }
+  auto id = mask_ids_.Get({state.rule_id, state.sequence_id, state.element_id, state.sub_element_id}
+  );
+  if (id == -1) {
+    return nullptr;
+  }
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  return &impl_->adaptive_token_masks[id];
+}
+
+const AdaptiveTokenMask* LazyAdaptiveTokenMasks::Find(const ParserState& state, bool* is_pending) {
+  std::shared_lock<std::shared_mutex> lock(mutex_);
+  auto id = impl_->adaptive_token_mask_index.Find(state);
+  if (id != -1) {
+    return &impl_->adaptive_token_masks[id];
+  }
+  *is_pending = state_set_.count(state) != 0 || mask_sources_.count(state) != 0;
+  return nullptr;
+}
+
+void LazyAdaptiveTokenMasks::Complete() {
+  for (const auto& state : states_) {
+    Get(state);
+  }
+}
+
+std::size_t LazyAdaptiveTokenMasks::PendingMemorySize() const {
+  std::size_t bitset_size = (impl_->tokenizer_info.GetVocabSize() + 7) / 8;
+  return num_pending_masks_.load(std::memory_order_relaxed) *
+         (sizeof(AdaptiveTokenMask) + bitset_size);
+}
+
+int32_t LazyAdaptiveTokenMasks::ComputeAndAdd(const StateKey& key) {
+  auto [rule_id, sequence_id, element_id, sub_element_id] = key;
+  auto state =
+      ParserState(rule_id, sequence_id, element_id, ParserState::kNoPrevInputPos, sub_element_id);
+  if (state_set_.count(state) == 0) {
+    return -1;
+  }
+  auto mask = compute_(state);
+  std::unique_lock<std::shared_mutex> lock(mutex_);
+  XGRAMMAR_DCHECK(impl_->adaptive_token_masks.size() < impl_->adaptive_token_masks.capacity());
+  impl_->AddAdaptiveTokenMask(state, std::move(mask));
+  num_pending_masks_.fetch_sub(1, std::memory_order_relaxed);
+  num_remaining_states_.fetch_sub(1, std::memory_order_release);
+  return impl_->adaptive_token_mask_index.Find(state);
+}
+
 /************** CompiledGrammar **************/
 
 std::size_t MemorySize(const CompiledGrammar::Impl& impl) {
-  return MemorySize(impl.grammar) + MemorySize(impl.adaptive_token_mask_cache);
+  std::shared_lock<std::shared_mutex> lock;
+  if (impl.lazy_adaptive_token_masks != nullptr) {
+    lock = impl.lazy_adaptive_token_masks->LockShared();
+  }
+  return MemorySize(impl.grammar) + MemorySize(impl.adaptive_token_masks) +
+         MemorySize(impl.adaptive_token_mask_index) +
+         (impl.token_bitmask_cache != nullptr ? impl.token_bitmask_cache->MemorySize() : 0);
 }
 
 std::size_t CompiledGrammar::MemorySizeBytes() const { return MemorySize(*pimpl_); }
@@ -8,16 +8,27 @@
 
 #include <xgrammar/grammar.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <shared_mutex>
 #include <string>
+#include <tuple>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
 #include "earley_parser.h"
 #include "support/dynamic_bitset.h"
 #include "support/reflection.h"
+#include "support/thread_pool.h"
+#include "support/thread_safe_cache.h"
+#include "token_bitmask_cache.h"
 #include "xgrammar/compiler.h"
 #include "xgrammar/exception.h"
 
@@ -32,8 +43,9 @@ namespace xgrammar {
  * Rejected: tokens that can be determined by the current ParserState to be unacceptable
  * Uncertain: tokens that need the state of the parent ParserStates to determine if acceptable
  *
- * \note uncertain indices are stored directly. Accepted / rejected indices have three ways to
- * store to reduce memory and computation usage. See StoreType.
+ * \note uncertain indices are stored directly. Accepted / rejected indices have several ways to
+ * store to reduce memory and computation usage. The one with the smallest memory size is chosen.
+ * See StoreType.
  * \note These indices are the indices of sorted_decoded_vocab in the CompiledGrammar
  * object, instead of the token ids. That helps the matching process.
  */
@@ -46,43 +58,129 @@ struct AdaptiveTokenMask {
     // - uncertain_indices. This is useful when |accepted_indices| > |rejected_indices|.
     kRejected = 1,
     // Store all accepted token indices in a bitset. This is useful when both |accepted_indices| and
-    // |rejected_indices| are large.
-    kAcceptedBitset = 2
+    // |rejected_indices| are large. The bitset is indexed by token id, i.e. it is aligned to the
+    // token bitmask, so the masks of several states are combined with a word-wise OR.
+    kAcceptedBitset = 2,
+    // Store the accepted token indices as runs of consecutive indices. Since sorted_decoded_vocab
+    // is sorted, tokens sharing a prefix are adjacent and tend to be accepted or rejected
+    // together, so there are usually far fewer runs than tokens.
+    kAcceptedRuns = 3,
+    // Store the rejected token indices as runs of consecutive indices.
+    kRejectedRuns = 4
   };
   StoreType store_type;
 
+  /*!
+   * \brief The grammar compiler stops collecting the rejected indices after this many. Then the
+   * rejected indices are derived from the accepted and uncertain indices.
+   */
   static constexpr int USE_BITSET_THRESHOLD = 1000;
 
   std::vector<int32_t> accepted_indices;
   std::vector<int32_t> rejected_indices;
   DynamicBitset accepted_bitset;
+  /*! \brief The [begin, end) runs of indices for kAcceptedRuns and kRejectedRuns. */
+  std::vector<std::pair<int32_t, int32_t>> index_runs;
 
   std::vector<int32_t> uncertain_indices;
+  /*!
+   * \brief The uncertain indices as [begin, end) runs. It is used instead of uncertain_indices when
+   * it is smaller, which is common since whole subtrees of the token trie are often uncertain.
+   */
+  std::vector<std::pair<int32_t, int32_t>> uncertain_runs;
 
   /*! \brief Default constructor. Only for deserialization. */
   AdaptiveTokenMask() = default;
 
+  /*!
+   * \brief Construct the mask, choosing the store type by the sizes of the index sets.
+   * \param always_use_bitset Whether to always use kAcceptedBitset. Then the mask never needs to be
+   * translated through sorted_decoded_vocab when the next token bitmask is filled, at the cost of
+   * vocab_size / 8 bytes per mask.
+   */
   AdaptiveTokenMask(
       size_t vocab_size,
       const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
       const std::vector<int32_t>& accepted_indices,
       const std::vector<int32_t>& rejected_indices,
-      const std::vector<int32_t>& uncertain_indices
+      const std::vector<int32_t>& uncertain_indices,
+      bool always_use_bitset = false
   );
 
   AdaptiveTokenMask(
       size_t vocab_size,
       const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
       const std::vector<int32_t>& accepted_indices,
-      const std::vector<int32_t>& uncertain_indices
+      const std::vector<int32_t>& uncertain_indices,
+      bool always_use_bitset = false
   );
 
   std::string Print(const TokenizerInfo& tokenizer_info) const;
 
+  /*! \brief Get the number of uncertain tokens. */
+  int32_t NumUncertainTokens() const {
+    int32_t num_tokens = uncertain_indices.size();
+    for (const auto& [begin, end] : uncertain_runs) {
+      num_tokens += end - begin;
+    }
+    return num_tokens;
+  }
+
+  /*!
+   * \brief Get the uncertain indices. If they are stored as runs, they are expanded into buffer,
+   * which is then returned.
+   */
+  const std::vector<int32_t>& GetUncertainIndices(std::vector<int32_t>* buffer) const {
+    if (uncertain_runs.empty()) {
+      return uncertain_indices;
+    }
+    buffer->clear();
+    ExpandRuns(uncertain_runs, buffer);
+    return *buffer;
+  }
+
+  /*! \brief Append the indices covered by the [begin, end) runs to indices, in order. */
+  static void ExpandRuns(
+      const std::vector<std::pair<int32_t, int32_t>>& runs, std::vector<int32_t>* indices
+  ) {
+    for (const auto& [begin, end] : runs) {
+      for (int32_t i = begin; i < end; ++i) {
+        indices->push_back(i);
+      }
+    }
+  }
+
   friend std::size_t MemorySize(const AdaptiveTokenMask& mask) {
-    return MemorySize(mask.uncertain_indices) + MemorySize(mask.accepted_indices) +
-           MemorySize(mask.rejected_indices) + MemorySize(mask.accepted_bitset);
+    return MemorySize(mask.uncertain_indices) + MemorySize(mask.uncertain_runs) +
+           MemorySize(mask.accepted_indices) + MemorySize(mask.rejected_indices) +
+           MemorySize(mask.accepted_bitset) + MemorySize(mask.index_runs);
   }
+
+  XGRAMMAR_EQUAL_BY_MEMBERS(
+      AdaptiveTokenMask,
+      &AdaptiveTokenMask::store_type,
+      &AdaptiveTokenMask::accepted_indices,
+      &AdaptiveTokenMask::rejected_indices,
+      &AdaptiveTokenMask::accepted_bitset,
+      &AdaptiveTokenMask::index_runs,
+      &AdaptiveTokenMask::uncertain_indices,
+      &AdaptiveTokenMask::uncertain_runs
+  );
+
+ private:
+  /*!
+   * \brief Choose the store type and fill the storage. rejected_indices can be nullptr, then the
+   * rejected indices are built from rejected_runs if needed.
+   */
+  void Init(
+      size_t vocab_size,
+      const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+      const std::vector<int32_t>& accepted_indices,
+      const std::vector<int32_t>* rejected_indices,
+      std::vector<std::pair<int32_t, int32_t>>&& rejected_runs,
+      const std::vector<int32_t>& uncertain_indices,
+      bool always_use_bitset
+  );
 };
 
 XGRAMMAR_MEMBER_TABLE(
@@ -95,10 +193,151 @@ XGRAMMAR_MEMBER_TABLE(
     &AdaptiveTokenMask::rejected_indices,
     "accepted_bitset",
     &AdaptiveTokenMask::accepted_bitset,
+    "index_runs",
+    &AdaptiveTokenMask::index_runs,
     "uncertain_indices",
-    &AdaptiveTokenMask::uncertain_indices
+    &AdaptiveTokenMask::uncertain_indices,
+    "uncertain_runs",
+    &AdaptiveTokenMask::uncertain_runs
+);
+
+}  // namespace xgrammar
+
+XGRAMMAR_HASH_BY_MEMBERS(
+    xgrammar::AdaptiveTokenMask,
+    &xgrammar::AdaptiveTokenMask::store_type,
+    &xgrammar::AdaptiveTokenMask::accepted_indices,
+    &xgrammar::AdaptiveTokenMask::rejected_indices,
+    &xgrammar::AdaptiveTokenMask::accepted_bitset,
+    &xgrammar::AdaptiveTokenMask::index_runs,
+    &xgrammar::AdaptiveTokenMask::uncertain_indices,
+    &xgrammar::AdaptiveTokenMask::uncertain_runs
 );
 
+namespace xgrammar {
+
+/*!
+ * \brief A flat open-addressing hash map from parser states to the ids of their adaptive token
+ * masks. Only the fields compared for the mask cache are stored, and the slots are probed linearly
+ * in one array, so a lookup touches one or two cache lines instead of following the nodes of a
+ * std::unordered_map.
+ */
+class AdaptiveTokenMaskIndex {
+ public:
+  /*! \brief Get the mask id of the state, or -1 if the state is not in the index. */
+  int32_t Find(const ParserState& state) const {
+    if (slots_.empty()) {
+      return -1;
+    }
+    return slots_[FindSlot(state)].mask_id;
+  }
+
+  /*! \brief Get the number of states in the index. */
+  std::size_t Size() const { return num_entries_; }
+
+  /*!
+   * \brief Call fn(state, mask_id) for each state in the index, in no particular order. The
+   * rule_start_pos of the states is ParserState::kNoPrevInputPos.
+   */
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    for (const auto& slot : slots_) {
+      if (slot.mask_id != -1) {
+        fn(SlotState(slot), slot.mask_id);
+      }
+    }
+  }
+
+  /*! \brief Set the mask id of the state. */
+  void Set(const ParserState& state, int32_t mask_id) {
+    // Keep the load factor at most 1/2.
+    if ((num_entries_ + 1) * 2 > slots_.size()) {
+      Rehash(std::max(kMinCapacity, slots_.size() * 2));
+    }
+    auto& slot = slots_[FindSlot(state)];
+    if (slot.mask_id == -1) {
+      ++num_entries_;
+    }
+    slot = {state.rule_id, state.sequence_id, state.element_id, state.sub_element_id, mask_id};
+  }
+
+  friend std::size_t MemorySize(const AdaptiveTokenMaskIndex& index) {
+    return index.slots_.size() * sizeof(Slot);
+  }
+
+ private:
+  struct Slot {
+    int32_t rule_id;
+    int32_t sequence_id;
+    int32_t element_id;
+    int32_t sub_element_id;
+    /*! \brief -1 if the slot is empty. */
+    int32_t mask_id = -1;
+  };
+
+  static constexpr std::size_t kMinCapacity = 16;
+
+  static ParserState SlotState(const Slot& slot) {
+    return ParserState(
+        slot.rule_id,
+        slot.sequence_id,
+        slot.element_id,
+        ParserState::kNoPrevInputPos,
+        slot.sub_element_id
+    );
+  }
+
+  /*! \brief Find the slot of the state, or the empty slot where it would be inserted. */
+  std::size_t FindSlot(const ParserState& state) const {
+    std::size_t mask = slots_.size() - 1;
+    for (std::size_t pos = StateHashForCache{}(state) & mask;; pos = (pos + 1) & mask) {
+      const auto& slot = slots_[pos];
+      if (slot.mask_id == -1 ||
+          (slot.rule_id == state.rule_id && slot.sequence_id == state.sequence_id &&
+           slot.element_id == state.element_id && slot.sub_element_id == state.sub_element_id)) {
+        return pos;
+      }
+    }
+  }
+
+  void Rehash(std::size_t capacity) {
+    auto old_slots = std::move(slots_);
+    slots_.assign(capacity, Slot{});
+    for (const auto& slot : old_slots) {
+      if (slot.mask_id != -1) {
+        slots_[FindSlot(SlotState(slot))] = slot;
+      }
+    }
+  }
+
+  /*! \brief The slots. The capacity is a power of two. */
+  std::vector<Slot> slots_;
+  std::size_t num_entries_ = 0;
+};
+
+class LazyAdaptiveTokenMasks;
+
+/*!
+ * \brief Counters of how the grammar compiler obtained the adaptive token masks. They show whether
+ * the optimizations of the compiler took effect, e.g. in tests, and are not serialized.
+ */
+struct TokenMaskCompileStats {
+  /*! \brief The number of states whose masks are copied from the last compiled grammar. */
+  int32_t num_reused_states = 0;
+  /*! \brief The number of states whose masks are shared with an identical rule of the grammar. */
+  int32_t num_shared_rule_states = 0;
+  /*!
+   * \brief The number of computed states whose masks are computed by walking the FSM of their rule
+   * instead of with the Earley parser.
+   */
+  int32_t num_fsm_walk_states = 0;
+  /*!
+   * \brief The number of ranges the vocabulary is split into to compute the mask of a state in
+   * parallel. 1 when it is not split, and 0 when no mask is computed during the compilation.
+   */
+  int32_t num_vocab_chunks = 0;
+};
+
 /*!
  * \brief All information that we need to match tokens in the tokenizer to the specified grammar.
  * It is the result of preprocessing.
@@ -115,8 +354,62 @@ class CompiledGrammar::Impl {
   /*! \brief Default constructor. */
   Impl() = default;
 
-  /*! \brief Mapping from the parser state to the adaptive token mask. */
-  std::unordered_map<ParserState, AdaptiveTokenMask, StateHashForCache> adaptive_token_mask_cache;
+  /*!
+   * \brief The distinct adaptive token masks. Many states have equal masks, e.g. the positions
+   * inside the strings of different JSON properties, so they share one copy.
+   */
+  std::vector<AdaptiveTokenMask> adaptive_token_masks;
+
+  /*!
+   * \brief Mapping from the hash of a mask to the indices of the masks with that hash. It is only
+   * used to find equal masks when adding masks, and is not serialized.
+   */
+  std::unordered_multimap<std::size_t, int32_t> adaptive_token_mask_ids_by_hash;
+
+  /*! \brief Mapping from the parser state to the index of its mask in adaptive_token_masks. */
+  AdaptiveTokenMaskIndex adaptive_token_mask_index;
+
+  /*!
+   * \brief Get the adaptive token mask of the state, or nullptr if the state has no mask. With lazy
+   * token masks, the mask is computed here on first use. Thread-safe.
+   */
+  const AdaptiveTokenMask* GetAdaptiveTokenMask(const ParserState& state) const;
+
+  /*!
+   * \brief Get the adaptive token mask of the state without computing it. Return nullptr if the
+   * state has no mask, or if its lazy mask is not computed yet; the latter sets *is_pending.
+   * Thread-safe.
+   */
+  const AdaptiveTokenMask* FindAdaptiveTokenMask(const ParserState& state, bool* is_pending) const;
+
+  /*!
+   * \brief Set the adaptive token mask of the state. If an equal mask is already stored, the state
+   * shares it instead of storing another copy. Not thread-safe.
+   */
+  void AddAdaptiveTokenMask(const ParserState& state, AdaptiveTokenMask&& mask);
+
+  /*! \brief Let the state share the adaptive token mask of source_state, which must have one. */
+  void ShareAdaptiveTokenMask(const ParserState& state, const ParserState& source_state) {
+    auto id = adaptive_token_mask_index.Find(source_state);
+    XGRAMMAR_CHECK(id != -1) << "The source state has no adaptive token mask";
+    adaptive_token_mask_index.Set(state, id);
+  }
+
+  /*!
+   * \brief The final token bitmasks generated by the matchers, keyed by the matching context. It is
+   * filled at matching time and not serialized. nullptr if the compiler doesn't enable it.
+   */
+  std::unique_ptr<TokenBitmaskCache> token_bitmask_cache;
+
+  /*! \brief How the compiler obtained the masks. Not serialized. */
+  TokenMaskCompileStats token_mask_compile_stats;
+
+  /*!
+   * \brief The masks that are not computed yet, when the grammar is compiled with lazy token masks.
+   * It is declared last, so that its background threads stop before the other members are
+   * destroyed.
+   */
+  std::unique_ptr<LazyAdaptiveTokenMasks> lazy_adaptive_token_masks;
 
   Grammar GetGrammar() const { return grammar; }
 
@@ -138,10 +431,112 @@ XGRAMMAR_MEMBER_TABLE(
     &CompiledGrammar::Impl::grammar,
     "tokenizer_info",
     &CompiledGrammar::Impl::tokenizer_info,
-    "adaptive_token_mask_cache",
-    &CompiledGrammar::Impl::adaptive_token_mask_cache
+    "adaptive_token_masks",
+    &CompiledGrammar::Impl::adaptive_token_masks
 );
 
+/*!
+ * \brief The adaptive token masks of a grammar compiled with lazy token masks. The compiled grammar
+ * is usable before any mask is computed: the mask of a state is computed once, when a matcher first
+ * needs it, and then added to the compiled grammar. The remaining masks can be computed by
+ * background threads in the meantime.
+ */
+class LazyAdaptiveTokenMasks {
+ public:
+  /*!
+   * \brief Construct the lazy masks and start the background computation.
+   * \param impl The compiled grammar to add the masks to. It owns this object.
+   * \param compute The function that computes the mask of a state.
+   * \param states The states that have masks.
+   * \param mask_sources The states that share the mask of another state, e.g. a state of a rule
+   * that is identical to another rule, mapped to that state. Only the source masks are computed.
+   * \param num_background_threads The number of threads that compute the remaining masks in the
+   * background. 0 means the masks are only computed on demand.
+   */
+  LazyAdaptiveTokenMasks(
+      CompiledGrammar::Impl* impl,
+      std::function<AdaptiveTokenMask(const ParserState&)> compute,
+      const std::vector<ParserState>& states,
+      std::unordered_map<ParserState, ParserState, StateHashForCache> mask_sources,
+      int num_background_threads
+  );
+
+  ~LazyAdaptiveTokenMasks();
+
+  /*! \brief Whether all the masks are computed, so that they can be read without locking. */
+  bool IsComplete() const { return num_remaining_states_.load(std::memory_order_acquire) == 0; }
+
+  /*! \brief Get the mask of the state, and compute it if it is not computed yet. Thread-safe. */
+  const AdaptiveTokenMask* Get(const ParserState& state);
+
+  /*!
+   * \brief Get the mask of the state if it is computed. Otherwise return nullptr, and set
+   * *is_pending if the state has a mask that is not computed yet. Thread-safe.
+   */
+  const AdaptiveTokenMask* Find(const ParserState& state, bool* is_pending);
+
+  /*! \brief Compute all the remaining masks in the calling thread. */
+  void Complete();
+
+  /*!
+   * \brief Estimate the memory size of the masks not computed yet, counting each as a bitset over
+   * the vocabulary. Thread-safe.
+   */
+  std::size_t PendingMemorySize() const;
+
+  /*! \brief Lock the masks of the compiled grammar against concurrent additions for reading. */
+  std::shared_lock<std::shared_mutex> LockShared() {
+    return std::shared_lock<std::shared_mutex>(mutex_);
+  }
+
+ private:
+  /*! \brief The key of the mask of a state: rule_id, sequence_id, element_id and sub_element_id. */
+  using StateKey = std::tuple<int32_t, int32_t, int32_t, int32_t>;
+
+  /*! \brief Compute the mask of the state, add it to the compiled grammar and return its id. */
+  int32_t ComputeAndAdd(const StateKey& key);
+
+  CompiledGrammar::Impl* impl_;
+  std::function<AdaptiveTokenMask(const ParserState&)> compute_;
+  std::vector<ParserState> states_;
+  std::unordered_set<ParserState, StateHashForCache> state_set_;
+  std::unordered_map<ParserState, ParserState, StateHashForCache> mask_sources_;
+  /*! \brief Protects the masks of the compiled grammar, which are added concurrently. */
+  std::shared_mutex mutex_;
+  /*! \brief Makes sure the mask of each state is computed only once. */
+  ThreadSafeCache<StateKey, int32_t> mask_ids_;
+  std::atomic<int32_t> num_remaining_states_;
+  /*! \brief The number of masks to compute, excluding the states that share another mask. */
+  std::atomic<int32_t> num_pending_masks_;
+  std::atomic<bool> stopped_ = false;
+  /*!
+   * \brief It is shut down once the tasks are queued, so its threads exit when the queue is
+   * drained. Declared last, so that it is joined before the other members are destroyed.
+   */
+  std::optional<ThreadPool> background_thread_pool_;
+};
+
+inline const AdaptiveTokenMask* CompiledGrammar::Impl::GetAdaptiveTokenMask(
+    const ParserState& state
+) const {
+  if (lazy_adaptive_token_masks != nullptr && !lazy_adaptive_token_masks->IsComplete()) {
+    return lazy_adaptive_token_masks->Get(state);
+  }
+  auto id = adaptive_token_mask_index.Find(state);
+  return id == -1 ? nullptr : &adaptive_token_masks[id];
+}
+
+inline const AdaptiveTokenMask* CompiledGrammar::Impl::FindAdaptiveTokenMask(
+    const ParserState& state, bool* is_pending
+) const {
+  *is_pending = false;
+  if (lazy_adaptive_token_masks != nullptr && !lazy_adaptive_token_masks->IsComplete()) {
+    return lazy_adaptive_token_masks->Find(state, is_pending);
+  }
+  auto id = adaptive_token_mask_index.Find(state);
+  return id == -1 ? nullptr : &adaptive_token_masks[id];
+}
+
 }  // namespace xgrammar
 
 #endif  // XGRAMMAR_COMPILED_GRAMMAR_IMPL_H_
@@ -6,6 +6,7 @@
 #include "earley_parser.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
 #include <cstdint>
@@ -25,7 +26,7 @@ using GrammarExprType = Grammar::Impl::GrammarExprType;
 
 using GrammarExpr = Grammar::Impl::GrammarExpr;
 
-bool EarleyParser::IsCompleted() const { return is_completed_.back(); }
+bool EarleyParser::IsCompleted() const { return is_completed_.Back(); }
 
 void EarleyParser::PopLastStates(int32_t cnt) {
   if (stop_token_is_accepted_) {
@@ -35,8 +36,58 @@ void EarleyParser::PopLastStates(int32_t cnt) {
     XGRAMMAR_LOG(FATAL) << "The number of states to be popped is larger than the size of states.";
   }
   rule_id_to_completable_states_.PopBack(cnt);
-  is_completed_.erase(is_completed_.end() - cnt, is_completed_.end());
+  is_completed_.PopBack(cnt);
   scanable_state_history_.PopBack(cnt);
+  int32_t num_rows = scanable_state_history_.size();
+  int32_t num_epochs = history_epochs_.size();
+  while (history_epochs_[num_epochs - 1].begin_row >= num_rows) {
+    --num_epochs;
+  }
+  history_epochs_.PopBack(history_epochs_.size() - num_epochs);
+  StartHistoryEpoch();
+}
+
+int64_t EarleyParser::NewHistoryEpochIdBase() {
+  static std::atomic<int64_t> num_parsers{0};
+  return (++num_parsers) << 32;
+}
+
+void EarleyParser::StartHistoryEpoch() {
+  history_epochs_.PushBack(HistoryEpoch{next_history_epoch_id_++, scanable_state_history_.size()});
+  if ((next_history_epoch_id_ & 0xFFFFFFFF) == 0) {
+    next_history_epoch_id_ = NewHistoryEpochIdBase();
+  }
+}
+
+EarleyParser::Checkpoint EarleyParser::Snapshot() const {
+  // The checkpoint belongs to the latest epoch that pushed some of its rows. Its rows stay valid
+  // until the history is popped below them, even if the epoch ends.
+  int32_t num_rows = scanable_state_history_.size();
+  int32_t epoch = history_epochs_.size() - 1;
+  while (history_epochs_[epoch].begin_row >= num_rows) {
+    --epoch;
+  }
+  return Checkpoint{num_rows, history_epochs_[epoch].id, stop_token_is_accepted_};
+}
+
+void EarleyParser::Restore(const Checkpoint& checkpoint) {
+  int32_t num_rows = scanable_state_history_.size();
+  bool is_valid = checkpoint.num_rows > 0 && checkpoint.num_rows <= num_rows;
+  if (is_valid) {
+    // The epochs after the one of the checkpoint must not have popped any of its rows.
+    int32_t epoch = history_epochs_.size() - 1;
+    while (history_epochs_[epoch].id != checkpoint.epoch_id &&
+           history_epochs_[epoch].begin_row >= checkpoint.num_rows) {
+      --epoch;
+    }
+    is_valid = history_epochs_[epoch].id == checkpoint.epoch_id;
+  }
+  XGRAMMAR_CHECK(is_valid
+  ) << "The checkpoint is no longer valid, since the states it saved have been rolled back";
+  if (num_rows > checkpoint.num_rows) {
+    PopLastStates(num_rows - checkpoint.num_rows);
+  }
+  stop_token_is_accepted_ = checkpoint.stop_token_is_accepted;
 }
 
 void EarleyParser::Complete(const ParserState& state, bool debug_print) {
@@ -241,7 +292,7 @@ bool EarleyParser::Advance(const uint8_t ch, bool debug_print) {
   }
 
   // Check if the grammar is completed, and add the scannable states to the history.
-  is_completed_.push_back(tmp_accept_stop_token_);
+  is_completed_.PushBack(tmp_accept_stop_token_);
   scanable_state_history_.PushBack(tmp_states_to_be_added_);
   return true;
 }
@@ -267,13 +318,14 @@ EarleyParser::EarleyParser(
   } else {
     init = init_state;
   }
+  StartHistoryEpoch();
 
   // If there is no need to expand the initial state, we only need to add it to the
   // scanable states history.
   if (!need_expand) {
     rule_id_to_completable_states_.PushBack(std::vector<std::pair<int32_t, ParserState>>());
-    is_completed_.push_back(false);
-    scanable_state_history_.PushBack({init});
+    is_completed_.PushBack(false);
+    scanable_state_history_.PushBack(&init, 1);
     return;
   }
 
@@ -281,6 +333,18 @@ EarleyParser::EarleyParser(
   PushStateAndExpand(init);
 }
 
+EarleyParser::EarleyParser(const EarleyParser* parent)
+    : grammar_(parent->grammar_),
+      is_completed_(parent->is_completed_.Fork()),
+      rule_id_to_completable_states_(parent->rule_id_to_completable_states_.Fork()),
+      scanable_state_history_(parent->scanable_state_history_.Fork()),
+      stop_token_is_accepted_(parent->stop_token_is_accepted_),
+      history_epochs_(parent->history_epochs_.Fork()) {
+  // The rows pushed after the fork belong to a new epoch unknown to the parent, so the checkpoints
+  // taken after the fork are only valid in the parser that took them.
+  StartHistoryEpoch();
+}
+
 void EarleyParser::PushStateAndExpand(const ParserState& state) {
   tmp_states_visited_in_queue_.Clear();
   tmp_accept_stop_token_ = false;
@@ -301,14 +365,16 @@ void EarleyParser::PushStateAndExpand(const ParserState& state) {
       tmp_states_to_be_added_.push_back(state);
     }
   }
-  is_completed_.push_back(tmp_accept_stop_token_);
+  is_completed_.PushBack(tmp_accept_stop_token_);
   scanable_state_history_.PushBack(tmp_states_to_be_added_);
 }
 
 void EarleyParser::Reset() {
   rule_id_to_completable_states_.PopBack(rule_id_to_completable_states_.size());
   scanable_state_history_.PopBack(scanable_state_history_.size());
-  is_completed_.clear();
+  is_completed_.PopBack(is_completed_.size());
+  history_epochs_.PopBack(history_epochs_.size());
+  StartHistoryEpoch();
   stop_token_is_accepted_ = false;
   XGRAMMAR_DCHECK(tmp_process_state_queue_.empty());
   PushStateAndExpand(ParserState(
@@ -871,36 +937,78 @@ void EarleyParser::AdvanceFsm(const ParserState& state, const uint8_t ch) {
 }
 
 bool RepeatDetector::IsVisited(const ParserState& state) const {
-  // If the size is larger than the threshold, then we use the set to check.
-  if (size_ > transition_threshold_) {
-    return visited_set_.find(state) != visited_set_.end();
+  int size = static_cast<int>(visited_vector_.size());
+  // If the size is larger than the threshold, then we use the hash table to check.
+  if (size > transition_threshold_) {
+    size_t mask = table_.size() - 1;
+    for (size_t i = GetSlotIndex(state);; i = (i + 1) & mask) {
+      const auto& slot = table_[i];
+      if (slot.generation != generation_) {
+        return false;
+      }
+      if (StateEqualForParsing()(visited_vector_[slot.index], state)) {
+        return true;
+      }
+    }
   }
   return std::find_if(
              visited_vector_.begin(),
-             visited_vector_.begin() + size_,
+             visited_vector_.end(),
              [&state](const ParserState& s) { return StateEqualForParsing()(state, s); }
-         ) != visited_vector_.begin() + size_;
+         ) != visited_vector_.end();
 }
 
 void RepeatDetector::Insert(const ParserState& state) {
-  if (size_ == transition_threshold_) {
-    for (const auto& s : visited_vector_) {
-      visited_set_.insert(s);
-    }
+  visited_vector_.push_back(state);
+  int size = static_cast<int>(visited_vector_.size());
+  if (size <= transition_threshold_) {
+    return;
   }
-  size_++;
-  if (size_ > transition_threshold_) {
-    visited_set_.insert(state);
+  // Keep the load factor of the table at most 1/2.
+  if (static_cast<size_t>(size) * 2 > table_.size()) {
+    size_t table_size = std::max<size_t>(table_.size(), 64);
+    while (table_size < static_cast<size_t>(size) * 2) {
+      table_size *= 2;
+    }
+    Rehash(table_size);
+  } else if (size == transition_threshold_ + 1) {
+    for (int32_t i = 0; i < size; ++i) {
+      InsertIntoTable(i);
+    }
   } else {
-    visited_vector_[size_ - 1] = state;
+    InsertIntoTable(size - 1);
+  }
+}
+
+void RepeatDetector::InsertIntoTable(int32_t index) {
+  size_t mask = table_.size() - 1;
+  size_t i = GetSlotIndex(visited_vector_[index]);
+  while (table_[i].generation == generation_) {
+    i = (i + 1) & mask;
+  }
+  table_[i] = Slot{generation_, index};
+}
+
+void RepeatDetector::Rehash(size_t table_size) {
+  table_.assign(table_size, Slot());
+  generation_ = 1;
+  table_shift_ = 64;
+  for (size_t i = table_size; i > 1; i >>= 1) {
+    --table_shift_;
+  }
+  for (int32_t i = 0; i < static_cast<int32_t>(visited_vector_.size()); ++i) {
+    InsertIntoTable(i);
   }
 }
 
 void RepeatDetector::Clear() {
-  if (size_ > transition_threshold_) {
-    visited_set_.clear();
+  visited_vector_.clear();
+  // Start a new generation, so all slots become empty. When the counter wraps around, the slots
+  // are cleared explicitly.
+  if (++generation_ == 0) {
+    std::fill(table_.begin(), table_.end(), Slot());
+    generation_ = 1;
   }
-  size_ = 0;
 }
 
 }  // namespace xgrammar
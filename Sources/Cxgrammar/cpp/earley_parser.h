@@ -9,7 +9,6 @@
 #include <cstdint>
 #include <ostream>
 #include <queue>
-#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -183,21 +182,50 @@ class StateHashForParsing {
   }
 };
 
-/*! \brief This class is used to detect the repeated states. */
+/*!
+ * \brief This class is used to detect the repeated states. Small sets are checked by a linear scan.
+ * Once the number of states exceeds the threshold, they are also indexed by an open-addressing
+ * hash table. Each slot of the table is stamped with the generation it was written in, and Clear()
+ * starts a new generation, which empties the table in O(1). The storage is kept across Clear(), so
+ * the detector doesn't allocate once it has grown to the typical number of states.
+ */
 class RepeatDetector {
  private:
+  /*! \brief A slot of the hash table, holding the index of a state in visited_vector_. */
+  struct Slot {
+    uint32_t generation = 0;
+    int32_t index = 0;
+  };
+
   const int transition_threshold_;
 
+  /*! \brief The visited states in insertion order. */
   std::vector<ParserState> visited_vector_;
 
-  std::unordered_set<ParserState, StateHashForParsing, StateEqualForParsing> visited_set_;
+  /*! \brief The hash table. Slots whose generation isn't generation_ are empty. */
+  std::vector<Slot> table_;
+
+  /*! \brief The generation of the current set. 0 is reserved for slots never written. */
+  uint32_t generation_ = 1;
+
+  /*! \brief The slot of a hash is given by its top log2(table_.size()) bits. */
+  int table_shift_ = 64;
+
+  /*! \brief Get the first slot to probe for the state. */
+  size_t GetSlotIndex(const ParserState& state) const {
+    return (StateHashForParsing()(state) * 0x9e3779b97f4a7c15ull) >> table_shift_;
+  }
+
+  /*! \brief Add visited_vector_[index] to the hash table. */
+  void InsertIntoTable(int32_t index);
 
-  int size_ = 0;
+  /*! \brief Reallocate the hash table with the given size and index all visited states. */
+  void Rehash(size_t table_size);
 
  public:
   RepeatDetector(const int transition_threshold = 50)
-      : transition_threshold_(transition_threshold), size_(0) {
-    visited_vector_.resize(transition_threshold_);
+      : transition_threshold_(transition_threshold) {
+    visited_vector_.reserve(transition_threshold_);
   }
 
   /*!
@@ -239,19 +267,19 @@ class EarleyParser {
   bool tmp_accept_stop_token_ = false;
 
   /*! \brief store when accepting i characters, if the stop token can be accepted. */
-  std::vector<bool> is_completed_;
+  SharedPrefixVector<bool> is_completed_;
 
   /*!
    * \brief rule_id_to_completable_states[i][j] is the i pos j rule_id states. Earley
    * parser needs it to complete.
    */
-  Compact2DArray<std::pair<int32_t, ParserState>> rule_id_to_completable_states_;
+  SharedPrefixCompact2DArray<std::pair<int32_t, ParserState>> rule_id_to_completable_states_;
 
   /*!
    * \brief The states history. state_stack[i] is a vector storing the states after accepting the
    * input[i-1].
    */
-  Compact2DArray<ParserState> scanable_state_history_;
+  SharedPrefixCompact2DArray<ParserState> scanable_state_history_;
 
   /*!
    * \brief A temperate vector only used in Advance, used to add states in the
@@ -268,6 +296,36 @@ class EarleyParser {
   /*! \brief Check if the stop token is accepted. */
   bool stop_token_is_accepted_ = false;
 
+  /*!
+   * \brief A stretch of the history between two pops. The rows pushed in an epoch start at
+   * begin_row, and the rows before it are unchanged during the epoch.
+   */
+  struct HistoryEpoch {
+    int64_t id;
+    int32_t begin_row;
+  };
+
+  /*!
+   * \brief The epochs whose rows are still in the history, with increasing begin rows. Popping to
+   * row n drops the epochs beginning at or after n, and starts a new epoch at n. So a checkpoint of
+   * n rows, taken in the latest epoch beginning before n, is valid as long as that epoch is in the
+   * stack and no later epoch begins before n. The stack has one epoch per depth the history has
+   * been popped to and grown back from, which is much smaller than the history.
+   */
+  SharedPrefixVector<HistoryEpoch> history_epochs_;
+
+  /*!
+   * \brief The id of the next epoch. Ids are never reused by the parsers sharing a history: the
+   * high bits tell the parser, and the low bits count its epochs.
+   */
+  int64_t next_history_epoch_id_ = NewHistoryEpochIdBase();
+
+  /*! \brief Get the first epoch id of a new parser. */
+  static int64_t NewHistoryEpochIdBase();
+
+  /*! \brief Start a new epoch at the current end of the history. */
+  void StartHistoryEpoch();
+
   /*!
    * \brief Check if the state has been added into the queue.
    * \param state The state to check.
@@ -410,6 +468,14 @@ class EarleyParser {
       const Grammar& grammar, const ParserState& initial_state, const bool need_expand = true
   );
 
+  /*!
+   * \brief Construct a parser with the same states as another parser. The history is shared
+   * with the other parser rather than copied, so both parsers can continue independently.
+   * \param parent The parser to fork. It isn't modified, so it can be forked from several
+   * threads at once.
+   */
+  explicit EarleyParser(const EarleyParser* parent);
+
   /*!
    * \brief From the current states, advance to the next state.
    * \param ch The character to be advanced.
@@ -425,6 +491,45 @@ class EarleyParser {
    */
   void PopLastStates(int32_t count = 1);
 
+  /*!
+   * \brief A watermark of the history of the parser. The history is kept in bump-allocated
+   * arrays, so a checkpoint only records their size and the epoch it was taken in, and restoring
+   * it truncates them.
+   */
+  struct Checkpoint {
+    int32_t num_rows;
+    int64_t epoch_id;
+    bool stop_token_is_accepted;
+  };
+
+  /*! \brief Take a checkpoint of the current states in O(1). */
+  Checkpoint Snapshot() const;
+
+  /*!
+   * \brief Restore the states saved in a checkpoint by dropping the rows pushed after it. It only
+   * goes backward, and takes time linear in the number of dropped rows.
+   * \param checkpoint The checkpoint. Its rows must not have been popped since it was taken.
+   */
+  void Restore(const Checkpoint& checkpoint);
+
+  /*!
+   * \brief Takes a checkpoint of a parser when constructed and restores it when destroyed, so the
+   * parser is left unchanged even if an exception is thrown in between. The states existing at
+   * construction must not be popped before the guard is destroyed.
+   */
+  class CheckpointGuard {
+   public:
+    explicit CheckpointGuard(EarleyParser* parser)
+        : parser_(parser), checkpoint_(parser->Snapshot()) {}
+    ~CheckpointGuard() { parser_->Restore(checkpoint_); }
+    CheckpointGuard(const CheckpointGuard&) = delete;
+    CheckpointGuard& operator=(const CheckpointGuard&) = delete;
+
+   private:
+    EarleyParser* parser_;
+    Checkpoint checkpoint_;
+  };
+
   /*!
    * \brief Check whether any of the multiple states stored in the parser has already completed.
    * \note Since the parser contains multiple parallel states, some may have already completed,
@@ -464,7 +569,7 @@ class EarleyParser {
    */
   void PushOneStateToCheck(const ParserState& state) {
     rule_id_to_completable_states_.PushBack(std::vector<std::pair<int32_t, ParserState>>());
-    is_completed_.push_back(is_completed_.back());
+    is_completed_.PushBack(is_completed_.Back());
     scanable_state_history_.PushBack(&state, 1);
     return;
   }
@@ -6,12 +6,14 @@
 #include <xgrammar/compiler.h>
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <cctype>
 #include <cstddef>
 #include <cstdint>
 #include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -26,12 +28,34 @@
 #include "support/thread_pool.h"
 #include "support/thread_safe_cache.h"
 #include "support/utils.h"
+#include "tokenizer_info_impl.h"
 #include "xgrammar/grammar.h"
 
 namespace xgrammar {
 
 /************** AdaptiveTokenMaskCache Generator **************/
 
+/*!
+ * \brief The token mask of a range of the sorted vocabulary, as indices into it. The masks of
+ * consecutive ranges are computed in parallel and merged into an AdaptiveTokenMask.
+ */
+struct TokenMaskChunk {
+  std::vector<int32_t> accepted_indices;
+  std::vector<int32_t> rejected_indices;
+  std::vector<int32_t> uncertain_indices;
+  /*! \brief Whether all the rejected indices of the range are collected. */
+  bool rejected_indices_are_filled;
+  /*! \brief The range of the sorted vocabulary. */
+  int32_t range_begin;
+  int32_t range_end;
+  /*!
+   * \brief The end of the trie subtrees whose tokens are all marked uncertain from their root,
+   * which may be past the range. The later ranges take these tokens as uncertain as well, so the
+   * merged mask is the same as the mask computed over the whole vocabulary at once.
+   */
+  int32_t uncertain_subtree_end;
+};
+
 /*! \brief The concrete implementation of GrammarMatcherNode. */
 class GrammarMatcherForTokenMaskCache : public EarleyParser {
  public:
@@ -49,22 +73,45 @@ class GrammarMatcherForTokenMaskCache : public EarleyParser {
         ) {}
   /*!
    * \brief Get the adaptive token mask for the given ParserState.
+   * \param vocab_trie The byte trie of the sorted decoded vocabulary.
    * \param is_root_rule Whether to consider the parent rule. If false, there will be
    * no uncertain tokens. Useful for the root rule.
+   * \param always_use_bitset Whether to store the mask as a token-id bitset regardless of its size.
    */
   AdaptiveTokenMask GetAdaptiveTokenMask(
       size_t vocab_size,
       const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
       const std::vector<int32_t>& subtree_nodes_range,
-      bool is_root_rule
+      const VocabTrie& vocab_trie,
+      bool is_root_rule,
+      bool always_use_bitset = false
+  );
+
+  /*!
+   * \brief Get the token mask for the given ParserState over the tokens in
+   * [range_begin, range_end) of the sorted decoded vocabulary.
+   */
+  TokenMaskChunk GetTokenMaskChunk(
+      const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+      const std::vector<int32_t>& subtree_nodes_range,
+      const VocabTrie& vocab_trie,
+      bool is_root_rule,
+      int32_t range_begin,
+      int32_t range_end
   );
 
   /*!
-   * \brief Get the token mask for the given ParserState.
+   * \brief Get the token mask for the given ParserState. The sorted vocabulary is the preorder of
+   * its trie, so scanning it while rolling the parser back to the common prefix with the previous
+   * token is a depth-first walk of the trie: every trie node is matched once, and the subtree of a
+   * rejected node is skipped with vocab_trie.
    * \param sorted_decoded_vocab The sorted decoded vocabulary.
    * \param first_char_mask The first character mask.
+   * \param vocab_trie The byte trie of the sorted decoded vocabulary.
    * \param is_root_rule Whether to consider the parent rule. If false, there will be
    * no uncertain tokens. Useful for the root rule.
+   * \param range_begin The first index of the checked tokens in the sorted decoded vocabulary.
+   * \param range_end The end index of the checked tokens in the sorted decoded vocabulary.
    * \returns True if the rejected indices are filled as usual, False otherwise.
    * It's used to determine which construction function will be used.
    */
@@ -72,13 +119,41 @@ class GrammarMatcherForTokenMaskCache : public EarleyParser {
       const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
       const std::bitset<256>& first_char_mask,
       const std::vector<int>& subtree_nodes_range,
-      bool is_root_rule
+      const VocabTrie& vocab_trie,
+      bool is_root_rule,
+      int32_t range_begin,
+      int32_t range_end
   );
 
+  /*!
+   * \brief Check if the token trie can be walked directly on the FSM of the rule of the state. It
+   * requires every state reachable from the state to have only character edges that do not
+   * overlap, i.e. the reachable part is a DFA without rule references.
+   */
+  static bool CanWalkOnFSM(const Grammar& grammar, const ParserState& state);
+
  private:
-  /*! \brief Check if a token can pass the lookahead assertion. */
+  /*!
+   * \brief Fill the accepted, rejected and uncertain indices of the tokens in
+   * [range_begin, range_end) of the sorted decoded vocabulary.
+   * \returns True if the rejected indices are filled, False otherwise.
+   */
+  bool FillTokenMaskIndices(
+      const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+      const std::vector<int32_t>& subtree_nodes_range,
+      const VocabTrie& vocab_trie,
+      bool is_root_rule,
+      int32_t range_begin,
+      int32_t range_end
+  );
+
+  /*!
+   * \brief Check if a token can pass the lookahead assertion.
+   * \param checked_length Output. The length of the prefix of the token that the result depends
+   * on when the token cannot pass.
+   */
   std::pair</*acceptable*/ bool, /*can reach end*/ bool> IsTokenPassLookaheadAssertion(
-      const std::string& token, const std::vector<bool>& can_reach_end_stack
+      const std::string& token, const std::vector<bool>& can_reach_end_stack, int* checked_length
   );
 
   /*!
@@ -91,6 +166,19 @@ class GrammarMatcherForTokenMaskCache : public EarleyParser {
       const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab
   );
 
+  /*!
+   * \brief Advance the walk by one character. On the FSM, it follows the unique character edge
+   * of the current state; otherwise, it advances the Earley parser.
+   * \return Whether the character is accepted.
+   */
+  bool WalkAdvance(uint8_t ch);
+
+  /*! \brief Roll back the last cnt characters of the walk. */
+  void WalkRollback(int32_t cnt);
+
+  /*! \brief Check if the initial rule can be completed at the current position of the walk. */
+  bool WalkIsCompleted() const;
+
   // The id of the initial rule.
   int32_t init_rule_id;
 
@@ -112,15 +200,21 @@ class GrammarMatcherForTokenMaskCache : public EarleyParser {
   std::vector<int32_t> tmp_accepted_indices_;
   std::vector<int32_t> tmp_rejected_indices_;
   std::vector<int32_t> tmp_uncertain_indices_;
+  // The end of the trie subtrees whose tokens are all marked uncertain from their root.
+  int32_t tmp_uncertain_subtree_end_ = 0;
   std::vector<bool> tmp_can_reach_end_stack_;
   std::vector<bool> tmp_can_reach_end_prefix_or_stack_;
+  // The FSM of the initial rule when the walk runs on it, and the FSM states of the walk.
+  const CompactFSMWithStartEnd* walk_fsm_ = nullptr;
+  std::vector<int32_t> tmp_walk_fsm_states_;
 };
 
 std::pair<bool, bool> GrammarMatcherForTokenMaskCache::IsTokenPassLookaheadAssertion(
-    const std::string& token, const std::vector<bool>& can_reach_end_stack
+    const std::string& token, const std::vector<bool>& can_reach_end_stack, int* checked_length
 ) {
   bool accepted = true;
   bool can_reach_end = true;
+  *checked_length = token.size();
   auto lookahead_assertion_id = grammar_->GetRule(init_rule_id).lookahead_assertion_id;
   if (lookahead_assertion_id == -1) {
     return {accepted, can_reach_end};
@@ -137,6 +231,7 @@ std::pair<bool, bool> GrammarMatcherForTokenMaskCache::IsTokenPassLookaheadAsser
 
   // Find all positions that can come to and end. Then check if the suffix from that position
   // can be accepted by the lookahead assertion.
+  int rejected_length = 0;
   for (int i = static_cast<int>(can_reach_end_stack.size()) - 1; i >= 0; --i) {
     if (!can_reach_end_stack[i]) {
       continue;
@@ -163,14 +258,74 @@ std::pair<bool, bool> GrammarMatcherForTokenMaskCache::IsTokenPassLookaheadAsser
     }
     // Case 3. The token is not accepted. Check the next position.
     PopLastStates(last_accept_pos - i + 1);
+    rejected_length = std::max(rejected_length, last_accept_pos + 2);
   }
 
   PopLastStates(1);
   can_reach_end = false;
   accepted = false;
+  *checked_length = rejected_length;
   return {accepted, can_reach_end};
 }
 
+bool GrammarMatcherForTokenMaskCache::CanWalkOnFSM(
+    const Grammar& grammar, const ParserState& state
+) {
+  if (state.rule_id == -1 || !grammar->per_rule_fsms[state.rule_id].has_value()) {
+    return false;
+  }
+  const auto& fsm = grammar->per_rule_fsms[state.rule_id]->GetFsm();
+  std::unordered_set<int32_t> visited{state.element_id};
+  std::vector<int32_t> to_visit{state.element_id};
+  while (!to_visit.empty()) {
+    int32_t fsm_state = to_visit.back();
+    to_visit.pop_back();
+    int32_t prev_max = -1;
+    // The edges are sorted by their ranges.
+    for (const auto& edge : fsm.GetEdges(fsm_state)) {
+      if (!edge.IsCharRange() || edge.min <= prev_max) {
+        return false;
+      }
+      prev_max = edge.max;
+      if (visited.insert(edge.target).second) {
+        to_visit.push_back(edge.target);
+      }
+    }
+  }
+  return true;
+}
+
+bool GrammarMatcherForTokenMaskCache::WalkAdvance(uint8_t ch) {
+  if (walk_fsm_ == nullptr) {
+    return Advance(ch);
+  }
+  for (const auto& edge : walk_fsm_->GetFsm().GetEdges(tmp_walk_fsm_states_.back())) {
+    if (edge.min > ch) {
+      break;
+    }
+    if (ch <= edge.max) {
+      tmp_walk_fsm_states_.push_back(edge.target);
+      return true;
+    }
+  }
+  return false;
+}
+
+void GrammarMatcherForTokenMaskCache::WalkRollback(int32_t cnt) {
+  if (walk_fsm_ == nullptr) {
+    PopLastStates(cnt);
+    return;
+  }
+  tmp_walk_fsm_states_.erase(tmp_walk_fsm_states_.end() - cnt, tmp_walk_fsm_states_.end());
+}
+
+bool GrammarMatcherForTokenMaskCache::WalkIsCompleted() const {
+  if (walk_fsm_ == nullptr) {
+    return IsCompleted();
+  }
+  return walk_fsm_->IsEndState(tmp_walk_fsm_states_.back());
+}
+
 // Comparator for std::pair<int32_t, std::string> based on the string value.
 class IntStringPairComparator {
  public:
@@ -324,7 +479,10 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
     const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
     const std::bitset<256>& first_char_mask,
     const std::vector<int>& subtree_nodes_range,
-    bool is_root_rule
+    const VocabTrie& vocab_trie,
+    bool is_root_rule,
+    int32_t range_begin,
+    int32_t range_end
 ) {
   // the pair (a, b) means [a, b). Intialize the possible intervals.
   std::vector<std::pair<int32_t, int32_t>> possible_intervals;
@@ -338,8 +496,27 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
   XGRAMMAR_DCHECK(possible_intervals.size() > 0)
       << "There should be at least one possible interval for the first character mask.";
 
-  if (possible_intervals[0].first != 0 && fill_reject_indices) {
-    for (int i = 0; i < possible_intervals[0].first; ++i) {
+  // Only check the tokens in the range.
+  std::vector<std::pair<int32_t, int32_t>> range_intervals;
+  for (const auto& [interval_begin, interval_end] : possible_intervals) {
+    if (std::max(interval_begin, range_begin) < std::min(interval_end, range_end)) {
+      range_intervals.emplace_back(
+          std::max(interval_begin, range_begin), std::min(interval_end, range_end)
+      );
+    }
+  }
+  if (range_intervals.empty()) {
+    if (fill_reject_indices) {
+      for (int i = range_begin; i < range_end; ++i) {
+        tmp_rejected_indices_.push_back(i);
+      }
+    }
+    return fill_reject_indices;
+  }
+  possible_intervals = std::move(range_intervals);
+
+  if (possible_intervals[0].first != range_begin && fill_reject_indices) {
+    for (int i = range_begin; i < possible_intervals[0].first; ++i) {
       tmp_rejected_indices_.push_back(i);
     }
   }
@@ -369,6 +546,7 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
   }
 
   const std::string* prev_token = nullptr;
+  int prev_token_idx = -1;
   for (size_t interval_idx = 0; interval_idx < possible_intervals.size(); ++interval_idx) {
     const auto& interval = possible_intervals[interval_idx];
     for (int i = interval.first; i < interval.second; ++i) {
@@ -422,13 +600,16 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
         }
       }
       // Many tokens may contain the same prefix, so we will avoid unnecessary matching
-      // by finding the longest common prefix with the previous token.
+      // by finding the longest common prefix with the previous token. It is stored in the trie
+      // when the previous token is adjacent in the sorted vocabulary.
       bool accepted = true;
       if (prev_token != nullptr) {
         int lcp_len =
-            std::mismatch(token.begin(), token.end(), prev_token->begin(), prev_token->end())
-                .first -
-            token.begin();
+            prev_token_idx == i - 1
+                ? vocab_trie.CommonPrefixLength(i)
+                : std::mismatch(token.begin(), token.end(), prev_token->begin(), prev_token->end())
+                          .first -
+                      token.begin();
         if (lcp_len > prev_matched_size) {
           // Case 1. The common prefix is rejected by the matcher in the last token. Reject
           // directly.
@@ -436,7 +617,7 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
         } else if (lcp_len < prev_matched_size) {
           // Case 2. The common prefix is shorter than the previous matched size. Rollback
           // the non-common part.
-          PopLastStates(prev_matched_size - lcp_len);
+          WalkRollback(prev_matched_size - lcp_len);
           tmp_can_reach_end_stack_.erase(
               tmp_can_reach_end_stack_.end() - (prev_matched_size - lcp_len),
               tmp_can_reach_end_stack_.end()
@@ -450,15 +631,16 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
       }
 
       prev_token = &token;
+      prev_token_idx = i;
 
       if (accepted) {
         // Accept the rest chars one by one.
         for (int j = prev_matched_size; j < static_cast<int>(token.size()); ++j) {
-          if (!Advance(token[j])) {
+          if (!WalkAdvance(token[j])) {
             accepted = false;
             break;
           }
-          tmp_can_reach_end_stack_.push_back(IsCompleted());
+          tmp_can_reach_end_stack_.push_back(WalkIsCompleted());
           tmp_can_reach_end_prefix_or_stack_.push_back(
               tmp_can_reach_end_stack_.back() || tmp_can_reach_end_prefix_or_stack_.back()
           );
@@ -471,9 +653,16 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
       if (accepted) {
         tmp_accepted_indices_.push_back(i);
       } else {
-        auto lookahead_result_pair = IsTokenPassLookaheadAssertion(token, tmp_can_reach_end_stack_);
-        if (can_reach_end && !is_root_rule && lookahead_result_pair.first &&
-            prev_matched_size > 0) {
+        // Unless the rule can end inside the token, the token is rejected by its matched prefix
+        // alone, and the lookahead assertion does not need to be checked.
+        bool may_be_uncertain = can_reach_end && !is_root_rule && prev_matched_size > 0;
+        int lookahead_checked_length = 0;
+        auto lookahead_result_pair =
+            may_be_uncertain ? IsTokenPassLookaheadAssertion(
+                                   token, tmp_can_reach_end_stack_, &lookahead_checked_length
+                               )
+                             : std::make_pair(false, false);
+        if (may_be_uncertain && lookahead_result_pair.first) {
           // 1. If the current rule is the root rule (is_root_rule=true), there are no
           // uncertain tokens. Not accepted tokens are just rejected.
           // 2. If a token cannot pass the lookahead assertion, it is rejected.
@@ -483,15 +672,28 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
             tmp_uncertain_indices_.push_back(i);
             // On the subtree, they are all uncertain tokens.
             if (lookahead_result_pair.second) {
-              for (int j = i + 1; j < subtree_nodes_range[i]; ++j) {
+              tmp_uncertain_subtree_end_ =
+                  std::max(tmp_uncertain_subtree_end_, subtree_nodes_range[i]);
+              int subtree_end = std::min(subtree_nodes_range[i], interval.second);
+              for (int j = i + 1; j < subtree_end; ++j) {
                 tmp_uncertain_indices_.push_back(j);
               }
-              i = subtree_nodes_range[i] - 1;  // Skip the subtree nodes.
+              i = subtree_end - 1;  // Skip the subtree nodes.
             }
           }
         } else {
           tmp_rejected_indices_.push_back(i);
           last_rejected_range = subtree_nodes_range[i];
+          // The result only depends on the prefix up to the rejected character, and the part
+          // checked against the lookahead assertion. So all the tokens in the trie subtree of that
+          // prefix are rejected as well. If the prefix is shared with the previous token, the
+          // subtree is already handled there.
+          int rejected_prefix_length = std::max(prev_matched_size + 1, lookahead_checked_length);
+          if (rejected_prefix_length > vocab_trie.CommonPrefixLength(i)) {
+            last_rejected_range = std::max(
+                last_rejected_range, vocab_trie.SubtreeEnd(i, rejected_prefix_length)
+            );
+          }
           fill_reject_indices =
               tmp_rejected_indices_.size() >= AdaptiveTokenMask::USE_BITSET_THRESHOLD
                   ? false
@@ -511,14 +713,11 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
   }
 
   // Rollback the last matched part.
-  PopLastStates(prev_matched_size);
+  WalkRollback(prev_matched_size);
 
-  if (possible_intervals.back().second != static_cast<int>(sorted_decoded_vocab.size()) &&
-      fill_reject_indices) {
+  if (possible_intervals.back().second != range_end && fill_reject_indices) {
     // If the last interval is not closed, we need to reject the rest tokens.
-    for (int i = possible_intervals.back().second;
-         i < static_cast<int>(sorted_decoded_vocab.size());
-         ++i) {
+    for (int i = possible_intervals.back().second; i < range_end; ++i) {
       tmp_rejected_indices_.push_back(i);
     }
   }
@@ -526,15 +725,18 @@ bool GrammarMatcherForTokenMaskCache::GetTokenMaskWithFirstCharacterCheck(
   return fill_reject_indices;
 }
 
-AdaptiveTokenMask GrammarMatcherForTokenMaskCache::GetAdaptiveTokenMask(
-    size_t vocab_size,
+bool GrammarMatcherForTokenMaskCache::FillTokenMaskIndices(
     const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
     const std::vector<int32_t>& subtree_nodes_range,
-    bool is_root_rule
+    const VocabTrie& vocab_trie,
+    bool is_root_rule,
+    int32_t range_begin,
+    int32_t range_end
 ) {
   tmp_accepted_indices_.clear();
   tmp_rejected_indices_.clear();
   tmp_uncertain_indices_.clear();
+  tmp_uncertain_subtree_end_ = 0;
   // For every character in the current token, stores whether it is possible to reach the end of
   // the rule when matching until this character. Store it in a stack for later rollback.
   tmp_can_reach_end_stack_.push_back(false);
@@ -586,8 +788,38 @@ AdaptiveTokenMask GrammarMatcherForTokenMaskCache::GetAdaptiveTokenMask(
       }
     }
   }
-  bool rejected_indices_are_filled = GetTokenMaskWithFirstCharacterCheck(
-      sorted_decoded_vocab, first_character_mask, subtree_nodes_range, is_root_rule
+  // For regex-like rules, the token trie is walked on the FSM transitions directly, which avoids
+  // the overhead of the Earley parser for every character.
+  if (CanWalkOnFSM(grammar_, initial_state)) {
+    walk_fsm_ = &grammar_->per_rule_fsms[init_rule_id].value();
+    tmp_walk_fsm_states_.assign(1, initial_state.element_id);
+  }
+  return GetTokenMaskWithFirstCharacterCheck(
+      sorted_decoded_vocab,
+      first_character_mask,
+      subtree_nodes_range,
+      vocab_trie,
+      is_root_rule,
+      range_begin,
+      range_end
+  );
+}
+
+AdaptiveTokenMask GrammarMatcherForTokenMaskCache::GetAdaptiveTokenMask(
+    size_t vocab_size,
+    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+    const std::vector<int32_t>& subtree_nodes_range,
+    const VocabTrie& vocab_trie,
+    bool is_root_rule,
+    bool always_use_bitset
+) {
+  bool rejected_indices_are_filled = FillTokenMaskIndices(
+      sorted_decoded_vocab,
+      subtree_nodes_range,
+      vocab_trie,
+      is_root_rule,
+      0,
+      static_cast<int32_t>(sorted_decoded_vocab.size())
   );
   if (rejected_indices_are_filled) {
     return AdaptiveTokenMask(
@@ -595,15 +827,182 @@ AdaptiveTokenMask GrammarMatcherForTokenMaskCache::GetAdaptiveTokenMask(
         sorted_decoded_vocab,
         tmp_accepted_indices_,
         tmp_rejected_indices_,
-        tmp_uncertain_indices_
+        tmp_uncertain_indices_,
+        always_use_bitset
     );
   } else {
     return AdaptiveTokenMask(
-        vocab_size, sorted_decoded_vocab, tmp_accepted_indices_, tmp_uncertain_indices_
+        vocab_size,
+        sorted_decoded_vocab,
+        tmp_accepted_indices_,
+        tmp_uncertain_indices_,
+        always_use_bitset
     );
   }
 }
 
+TokenMaskChunk GrammarMatcherForTokenMaskCache::GetTokenMaskChunk(
+    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+    const std::vector<int32_t>& subtree_nodes_range,
+    const VocabTrie& vocab_trie,
+    bool is_root_rule,
+    int32_t range_begin,
+    int32_t range_end
+) {
+  bool rejected_indices_are_filled = FillTokenMaskIndices(
+      sorted_decoded_vocab, subtree_nodes_range, vocab_trie, is_root_rule, range_begin, range_end
+  );
+  return TokenMaskChunk{
+      std::move(tmp_accepted_indices_),
+      std::move(tmp_rejected_indices_),
+      std::move(tmp_uncertain_indices_),
+      rejected_indices_are_filled,
+      range_begin,
+      range_end,
+      tmp_uncertain_subtree_end_
+  };
+}
+
+/*!
+ * \brief Merge the token masks of consecutive ranges that cover the sorted decoded vocabulary.
+ * \note The tokens of a trie subtree are all marked uncertain when its root is uncertain and the
+ * rule can end inside it, without checking them one by one. When such a subtree crosses the end of
+ * a range, the rest of it is taken as uncertain from the later ranges as well, so the result does
+ * not depend on the bounds of the ranges.
+ */
+AdaptiveTokenMask MergeTokenMaskChunks(
+    size_t vocab_size,
+    const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab,
+    const std::vector<TokenMaskChunk>& chunks,
+    bool always_use_bitset
+) {
+  std::vector<int32_t> accepted_indices;
+  std::vector<int32_t> rejected_indices;
+  std::vector<int32_t> uncertain_indices;
+  bool rejected_indices_are_filled = true;
+  int32_t uncertain_subtree_end = 0;
+  // Append the indices of the chunk that are not in the subtrees marked uncertain before it.
+  auto append_after = [](std::vector<int32_t>* indices,
+                         const std::vector<int32_t>& chunk_indices,
+                         int32_t begin) {
+    indices->insert(
+        indices->end(),
+        std::lower_bound(chunk_indices.begin(), chunk_indices.end(), begin),
+        chunk_indices.end()
+    );
+  };
+  for (const auto& chunk : chunks) {
+    int32_t carried_end = std::clamp(uncertain_subtree_end, chunk.range_begin, chunk.range_end);
+    for (int32_t i = chunk.range_begin; i < carried_end; ++i) {
+      uncertain_indices.push_back(i);
+    }
+    append_after(&accepted_indices, chunk.accepted_indices, carried_end);
+    append_after(&uncertain_indices, chunk.uncertain_indices, carried_end);
+    rejected_indices_are_filled = rejected_indices_are_filled && chunk.rejected_indices_are_filled;
+    if (rejected_indices_are_filled) {
+      append_after(&rejected_indices, chunk.rejected_indices, carried_end);
+    }
+    uncertain_subtree_end = std::max(uncertain_subtree_end, chunk.uncertain_subtree_end);
+  }
+  if (rejected_indices_are_filled) {
+    return AdaptiveTokenMask(
+        vocab_size,
+        sorted_decoded_vocab,
+        accepted_indices,
+        rejected_indices,
+        uncertain_indices,
+        always_use_bitset
+    );
+  }
+  return AdaptiveTokenMask(
+      vocab_size, sorted_decoded_vocab, accepted_indices, uncertain_indices, always_use_bitset
+  );
+}
+
+/*!
+ * \brief Split the sorted decoded vocabulary into about num_chunks ranges of similar sizes to
+ * compute a token mask in parallel. Every range starts at a token that shares the shortest prefix
+ * with the previous token in a small window, i.e. at a subtree of a node near the root of the
+ * token trie, so the ranges have few prefixes in common to match twice.
+ * \returns The bounds of the ranges, starting with 0 and ending with the vocabulary size.
+ */
+std::vector<int32_t> GetTokenMaskChunkBounds(
+    const VocabTrie& vocab_trie, int32_t num_tokens, int32_t num_chunks
+) {
+  std::vector<int32_t> bounds{0};
+  int32_t chunk_size = (num_tokens + num_chunks - 1) / num_chunks;
+  for (int32_t target = chunk_size; target < num_tokens; target += chunk_size) {
+    int32_t window_end = std::min(num_tokens, target + chunk_size / 8 + 1);
+    int32_t bound = target;
+    for (int32_t i = target; i < window_end && vocab_trie.CommonPrefixLength(bound) > 0; ++i) {
+      if (vocab_trie.CommonPrefixLength(i) < vocab_trie.CommonPrefixLength(bound)) {
+        bound = i;
+      }
+    }
+    if (bound > bounds.back()) {
+      bounds.push_back(bound);
+    }
+  }
+  bounds.push_back(num_tokens);
+  return bounds;
+}
+
+/*!
+ * \brief Get the states of a rule that need a token mask, in an order that is the same for
+ * identical rules.
+ */
+std::vector<ParserState> GetRuleMaskStates(const Grammar& grammar, int32_t rule_id) {
+  using GrammarExprType = Grammar::Impl::GrammarExprType;
+  std::vector<ParserState> states;
+  auto rule = grammar->GetRule(rule_id);
+  auto rule_body = grammar->GetGrammarExpr(rule.body_expr_id);
+  const auto& rule_fsm = grammar->per_rule_fsms[rule_id];
+  if (rule_fsm.has_value()) {
+    auto cur_stack_element =
+        ParserState(rule_id, rule.body_expr_id, 0, ParserState::kNoPrevInputPos, 0);
+    for (int i : RuleEquivalenceAnalyzer::GetCanonicalStateOrder(rule_fsm.value())) {
+      cur_stack_element.element_id = i;
+      if (!rule_fsm->IsScanableState(i)) {
+        continue;
+      }
+      states.push_back(cur_stack_element);
+    }
+    return states;
+  }
+  XGRAMMAR_DCHECK(rule_body.type == GrammarExprType::kChoices);
+  for (auto sequence_id : rule_body) {
+    const auto& sequence = grammar->GetGrammarExpr(sequence_id);
+    if (sequence.type == GrammarExprType::kEmptyStr) {
+      continue;
+    }
+    XGRAMMAR_DCHECK(sequence.type == GrammarExprType::kSequence);
+    auto state = ParserState(rule_id, sequence_id, 0, ParserState::kNoPrevInputPos, 0);
+    for (int element_id = 0; element_id < sequence.size(); ++element_id) {
+      state.element_id = element_id;
+      auto element = grammar->GetGrammarExpr(sequence[element_id]);
+      if (element.type == GrammarExprType::kRuleRef || element.type == GrammarExprType::kRepeat) {
+        continue;
+      }
+      if (element.type == GrammarExprType::kByteString) {
+        for (int idx = 0; idx < element.size(); ++idx) {
+          state.sub_element_id = idx;
+          states.push_back(state);
+        }
+      } else {
+        XGRAMMAR_DCHECK(
+            element.type == GrammarExprType::kCharacterClassStar ||
+            element.type == GrammarExprType::kCharacterClass
+        );
+        for (int left_utf8_bytes = 0; left_utf8_bytes <= 3; ++left_utf8_bytes) {
+          state.sub_element_id = left_utf8_bytes;
+          states.push_back(state);
+        }
+      }
+    }
+  }
+  return states;
+}
+
 /******************* GrammarCompilerNoCache *******************/
 
 /*!
@@ -611,8 +1010,22 @@ AdaptiveTokenMask GrammarMatcherForTokenMaskCache::GetAdaptiveTokenMask(
  */
 class GrammarCompilerNoCache {
  public:
-  GrammarCompilerNoCache(const TokenizerInfo& tokenizer_info, int max_threads)
-      : tokenizer_info_(tokenizer_info), max_threads_(max_threads) {}
+  GrammarCompilerNoCache(
+      const TokenizerInfo& tokenizer_info,
+      int max_threads,
+      bool token_masks_as_bitsets,
+      bool lazy_token_masks,
+      int64_t token_bitmask_cache_bytes,
+      bool reuse_rule_masks,
+      int64_t max_memory_bytes = -1
+  )
+      : tokenizer_info_(tokenizer_info),
+        max_threads_(max_threads),
+        token_masks_as_bitsets_(token_masks_as_bitsets),
+        lazy_token_masks_(lazy_token_masks),
+        token_bitmask_cache_bytes_(token_bitmask_cache_bytes),
+        reuse_rule_masks_(reuse_rule_masks),
+        max_memory_bytes_(max_memory_bytes) {}
 
   CompiledGrammar CompileBuiltinJSONGrammar();
 
@@ -633,7 +1046,29 @@ class GrammarCompilerNoCache {
 
   CompiledGrammar CompileGrammar(const std::string& ebnf_str, std::string root_rule_name);
 
+  /*! \brief Forget the last compiled grammar, so that its masks are no longer reused. */
+  void ClearReusableRuleMasks();
+
  private:
+  /*!
+   * \brief The last compiled grammar, and its rules by their structural hashes and whether they are
+   * the root rule. The rule of a new grammar with the same key is compared with the rule to make
+   * sure it has the same masks.
+   */
+  struct ReusableRuleMasks {
+    CompiledGrammar compiled_grammar;
+    std::unordered_map<std::pair<uint64_t, bool>, int32_t> rule_ids;
+  };
+
+  /*!
+   * \brief Make the masks of the compiled grammar reusable by the next compilation. A grammar
+   * larger than max_memory_bytes_ is not kept.
+   */
+  void SetReusableRuleMasks(
+      const std::shared_ptr<CompiledGrammar::Impl>& compiled_grammar_impl,
+      const std::vector<uint64_t>& rule_hashes
+  );
+
   /*! \brief The main logic. Compile the grammar with multi-threading. */
   CompiledGrammar MultiThreadCompileGrammar(Grammar grammar);
   /*! \brief Optimization for TagDispatch.
@@ -646,19 +1081,39 @@ class GrammarCompilerNoCache {
       std::unordered_map<int32_t, DynamicBitset>* tag_dispatch_rule_id_to_second_slicing_bitset
   );
 
+  /*! \brief The minimum number of tokens in a range of the vocabulary computed by one thread. */
+  static constexpr int32_t kMinTokenMaskChunkSize = 8192;
+
   /*! \brief The vocabulary associated with this storage class. */
   const TokenizerInfo tokenizer_info_;
   /*! \brief The maximum number of threads to use. */
   const int max_threads_;
+  /*! \brief Whether to store all the adaptive token masks as token-id bitsets. */
+  const bool token_masks_as_bitsets_;
+  /*! \brief Whether to compute the adaptive token masks on first use. */
+  const bool lazy_token_masks_;
+  /*!
+   * \brief The memory budget of the token bitmask cache of each compiled grammar. 0 disables it.
+   */
+  const int64_t token_bitmask_cache_bytes_;
+  /*! \brief Whether to reuse the masks of the unchanged rules of the last compiled grammar. */
+  const bool reuse_rule_masks_;
+  /*! \brief The memory limit of the cache. -1 means unlimited. */
+  const int64_t max_memory_bytes_;
+  /*! \brief Protects reusable_rule_masks_. */
+  std::mutex reusable_rule_masks_mutex_;
+  std::shared_ptr<const ReusableRuleMasks> reusable_rule_masks_;
 };
 
 CompiledGrammar GrammarCompilerNoCache::MultiThreadCompileGrammar(Grammar grammar_unoptimized) {
-  using GrammarExprType = Grammar::Impl::GrammarExprType;
-
   auto compiled_grammar_impl = std::make_shared<CompiledGrammar::Impl>();
 
   compiled_grammar_impl->grammar = GrammarOptimizer::Apply(grammar_unoptimized);
   compiled_grammar_impl->tokenizer_info = tokenizer_info_;
+  if (token_bitmask_cache_bytes_ > 0) {
+    compiled_grammar_impl->token_bitmask_cache =
+        std::make_unique<TokenBitmaskCache>(static_cast<std::size_t>(token_bitmask_cache_bytes_));
+  }
   if (tokenizer_info_.GetVocabSize() == 0) {
     return CompiledGrammar(compiled_grammar_impl);
   }
@@ -670,106 +1125,250 @@ CompiledGrammar GrammarCompilerNoCache::MultiThreadCompileGrammar(Grammar gramma
   // 2. All byte strings (with element_in_string=0, 1, 2, ...)
   // since other positions will be expanded to the above positions
 
-  // TODO(Charlie): Figure out how to support ThreadPool and std::mutex in WebAssembly.
-  // Only declare ThreadPool and mutex if max_threads > 1, so when max_threads = 1, we do
-  // not need ThreadPool or std::mutex, which throws error in runtime in WebAssembly.
-  std::optional<ThreadPool> thread_pool;
-  std::optional<std::mutex> adaptive_token_mask_cache_mutex;
-  if (max_threads_ > 1) {
-    thread_pool.emplace(max_threads_);
-    adaptive_token_mask_cache_mutex.emplace();
-  }
+  const auto& grammar = compiled_grammar_impl->grammar;
+  auto root_rule_id = grammar->GetRootRuleId();
 
-  auto add_adaptive_token_mask = [&](const ParserState& state, bool is_root_rule) {
-    auto grammar_matcher = GrammarMatcherForTokenMaskCache(
-        compiled_grammar_impl->grammar, state, tag_dispatch_rule_id_to_second_slicing_bitset, false
-    );
-    auto cur_adaptive_token_mask_cache = grammar_matcher.GetAdaptiveTokenMask(
-        tokenizer_info_.GetVocabSize(),
-        tokenizer_info_.GetSortedDecodedVocab(),
-        tokenizer_info_.GetTrieSubtreeNodesRange(),
-        is_root_rule
+  auto tag_dispatch_bitsets = std::make_shared<const std::unordered_map<int32_t, DynamicBitset>>(
+      std::move(tag_dispatch_rule_id_to_second_slicing_bitset)
+  );
+  // It only captures values, since with lazy token masks it is called after this function returns.
+  auto compute_adaptive_token_mask = [grammar,
+                                      tokenizer_info = tokenizer_info_,
+                                      tag_dispatch_bitsets,
+                                      root_rule_id,
+                                      token_masks_as_bitsets = token_masks_as_bitsets_](
+                                         const ParserState& state
+                                     ) {
+    auto grammar_matcher =
+        GrammarMatcherForTokenMaskCache(grammar, state, *tag_dispatch_bitsets, false);
+    return grammar_matcher.GetAdaptiveTokenMask(
+        tokenizer_info.GetVocabSize(),
+        tokenizer_info.GetSortedDecodedVocab(),
+        tokenizer_info.GetTrieSubtreeNodesRange(),
+        tokenizer_info->GetVocabTrie(),
+        state.rule_id == root_rule_id,
+        token_masks_as_bitsets
     );
-    if (max_threads_ > 1) {
-      std::lock_guard<std::mutex> lock(adaptive_token_mask_cache_mutex.value());
-      compiled_grammar_impl->adaptive_token_mask_cache[state] = cur_adaptive_token_mask_cache;
-    } else {
-      compiled_grammar_impl->adaptive_token_mask_cache[state] = cur_adaptive_token_mask_cache;
-    }
   };
 
-  auto add_task_adaptive_token_mask = [&](const ParserState& state, bool is_root_rule) {
-    // Execute depending on whether we use thread_pool
-    if (max_threads_ > 1) {
-      thread_pool->Execute([add_adaptive_token_mask, state, is_root_rule]() {
-        add_adaptive_token_mask(state, is_root_rule);
-      });
-    } else {
-      add_adaptive_token_mask(state, is_root_rule);
+  // Identical rules with the same lookahead assertions, e.g. the rules generated for the same
+  // object schema under many properties, have the same masks in the corresponding states. So the
+  // masks are only computed for the first rule of each class, and the other rules share them. The
+  // root rule is always computed, since its masks have no uncertain tokens.
+  auto rule_classes = RuleEquivalenceAnalyzer::Apply(grammar, true);
+  std::unordered_map<int32_t, int32_t> class_to_computed_rule;
+  std::vector<ParserState> computed_states;
+  std::vector<std::pair<ParserState, ParserState>> states_sharing_masks;
+
+  // The rules that are unchanged from the last compiled grammar, e.g. all but one when a schema
+  // differs from the previous one in a single property, copy its masks instead.
+  std::vector<uint64_t> rule_hashes;
+  std::shared_ptr<const ReusableRuleMasks> reusable_rule_masks;
+  std::unordered_set<std::pair<int32_t, int32_t>> identical_rule_pairs;
+  if (reuse_rule_masks_) {
+    rule_hashes = RuleEquivalenceAnalyzer::GetStructuralHashes(grammar, true);
+    std::lock_guard<std::mutex> lock(reusable_rule_masks_mutex_);
+    reusable_rule_masks = reusable_rule_masks_;
+  }
+  auto reuse_rule_masks = [&](int32_t rule_id, const std::vector<ParserState>& states) {
+    if (reusable_rule_masks == nullptr) {
+      return false;
     }
+    auto it = reusable_rule_masks->rule_ids.find({rule_hashes[rule_id], rule_id == root_rule_id});
+    if (it == reusable_rule_masks->rule_ids.end()) {
+      return false;
+    }
+    // Equal hashes do not guarantee identical rules, so the rules are compared, and the masks are
+    // computed if they differ.
+    const auto* previous_impl = reusable_rule_masks->compiled_grammar.ImplPtr();
+    if (!RuleEquivalenceAnalyzer::AreRulesIdentical(
+            grammar, rule_id, previous_impl->grammar, it->second, true, &identical_rule_pairs
+        )) {
+      return false;
+    }
+    auto previous_states = GetRuleMaskStates(previous_impl->grammar, it->second);
+    if (states.size() != previous_states.size()) {
+      return false;
+    }
+    for (int i = 0; i < static_cast<int>(states.size()); ++i) {
+      auto mask = previous_impl->GetAdaptiveTokenMask(previous_states[i]);
+      if (mask == nullptr) {
+        computed_states.push_back(states[i]);
+      } else {
+        compiled_grammar_impl->AddAdaptiveTokenMask(states[i], AdaptiveTokenMask(*mask));
+        ++compiled_grammar_impl->token_mask_compile_stats.num_reused_states;
+      }
+    }
+    return true;
   };
 
-  auto root_rule_id = compiled_grammar_impl->grammar->GetRootRuleId();
-
-  for (int32_t rule_id = 0; rule_id < static_cast<int>(compiled_grammar_impl->grammar->NumRules());
-       ++rule_id) {
-    auto rule = compiled_grammar_impl->grammar->GetRule(rule_id);
-    auto rule_body = compiled_grammar_impl->grammar->GetGrammarExpr(rule.body_expr_id);
-    const auto& rule_fsm = compiled_grammar_impl->grammar->per_rule_fsms[rule_id];
-    if (rule_fsm.has_value()) {
-      auto cur_stack_element =
-          ParserState(rule_id, rule.body_expr_id, 0, ParserState::kNoPrevInputPos, 0);
-      std::unordered_set<int> reachable_states;
-      rule_fsm->GetReachableStates(&reachable_states);
-      for (int i : reachable_states) {
-        cur_stack_element.element_id = i;
-        if (!rule_fsm->IsScanableState(i)) {
-          continue;
+  for (int32_t rule_id = 0; rule_id < static_cast<int>(grammar->NumRules()); ++rule_id) {
+    auto states = GetRuleMaskStates(grammar, rule_id);
+    if (rule_id != root_rule_id) {
+      auto [it, success] = class_to_computed_rule.try_emplace(rule_classes[rule_id], rule_id);
+      if (!success) {
+        auto source_states = GetRuleMaskStates(grammar, it->second);
+        XGRAMMAR_DCHECK(states.size() == source_states.size());
+        for (int i = 0; i < static_cast<int>(states.size()); ++i) {
+          states_sharing_masks.emplace_back(states[i], source_states[i]);
         }
-        add_task_adaptive_token_mask(cur_stack_element, rule_id == root_rule_id);
+        continue;
       }
+    }
+    if (reuse_rule_masks(rule_id, states)) {
       continue;
     }
-    XGRAMMAR_DCHECK(rule_body.type == GrammarExprType::kChoices);
-    for (auto sequence_id : rule_body) {
-      const auto& sequence = compiled_grammar_impl->grammar->GetGrammarExpr(sequence_id);
-      if (sequence.type == GrammarExprType::kEmptyStr) {
-        continue;
-      }
-      XGRAMMAR_DCHECK(sequence.type == GrammarExprType::kSequence);
-      auto state = ParserState(rule_id, sequence_id, 0, ParserState::kNoPrevInputPos, 0);
-      for (int element_id = 0; element_id < sequence.size(); ++element_id) {
-        state.element_id = element_id;
-        auto element = compiled_grammar_impl->grammar->GetGrammarExpr(sequence[element_id]);
-        if (element.type == GrammarExprType::kRuleRef || element.type == GrammarExprType::kRepeat) {
-          continue;
-        }
-        if (element.type == GrammarExprType::kByteString) {
-          for (int idx = 0; idx < element.size(); ++idx) {
-            state.sub_element_id = idx;
-            add_task_adaptive_token_mask(state, rule_id == root_rule_id);
-          }
-        } else {
-          XGRAMMAR_DCHECK(
-              element.type == GrammarExprType::kCharacterClassStar ||
-              element.type == GrammarExprType::kCharacterClass
-          );
-          for (int left_utf8_bytes = 0; left_utf8_bytes <= 3; ++left_utf8_bytes) {
-            state.sub_element_id = left_utf8_bytes;
-            add_task_adaptive_token_mask(state, rule_id == root_rule_id);
-          }
-        }
-      }
+    computed_states.insert(computed_states.end(), states.begin(), states.end());
+  }
+  compiled_grammar_impl->token_mask_compile_stats.num_shared_rule_states =
+      static_cast<int32_t>(states_sharing_masks.size());
+  for (const auto& state : computed_states) {
+    if (GrammarMatcherForTokenMaskCache::CanWalkOnFSM(grammar, state)) {
+      ++compiled_grammar_impl->token_mask_compile_stats.num_fsm_walk_states;
     }
   }
 
+  if (lazy_token_masks_) {
+    // The masks are computed when they are first used, and by background threads if allowed.
+    std::vector<ParserState> states = computed_states;
+    std::unordered_map<ParserState, ParserState, StateHashForCache> mask_sources;
+    for (const auto& [state, source_state] : states_sharing_masks) {
+      states.push_back(state);
+      mask_sources.emplace(state, source_state);
+    }
+    compiled_grammar_impl->lazy_adaptive_token_masks = std::make_unique<LazyAdaptiveTokenMasks>(
+        compiled_grammar_impl.get(),
+        std::move(compute_adaptive_token_mask),
+        states,
+        std::move(mask_sources),
+        max_threads_ > 1 ? max_threads_ : 0
+    );
+    if (reuse_rule_masks_) {
+      SetReusableRuleMasks(compiled_grammar_impl, rule_hashes);
+    }
+    return CompiledGrammar(compiled_grammar_impl);
+  }
+
+  // When there are fewer states than threads, e.g. for a small grammar, the vocabulary of each
+  // state is split into ranges whose masks are computed by different threads and then merged.
+  const auto& sorted_decoded_vocab = tokenizer_info_.GetSortedDecodedVocab();
+  int32_t num_tokens = static_cast<int32_t>(sorted_decoded_vocab.size());
+  int32_t num_states = static_cast<int32_t>(computed_states.size());
+  int32_t num_chunks = 1;
+  if (max_threads_ > 1 && num_states > 0) {
+    num_chunks = std::min(
+        (max_threads_ + num_states - 1) / num_states,
+        std::max(num_tokens / kMinTokenMaskChunkSize, 1)
+    );
+  }
+  std::vector<int32_t> chunk_bounds{0, num_tokens};
+  if (num_chunks > 1) {
+    chunk_bounds = GetTokenMaskChunkBounds(tokenizer_info_->GetVocabTrie(), num_tokens, num_chunks);
+    num_chunks = static_cast<int32_t>(chunk_bounds.size()) - 1;
+  }
+  compiled_grammar_impl->token_mask_compile_stats.num_vocab_chunks = num_chunks;
+
+  // Every task writes its result to its own preallocated slot, so the threads do not lock to
+  // collect the results. The masks are added to the compiled grammar in order after the join.
+  std::vector<AdaptiveTokenMask> masks(num_states);
+  std::vector<std::vector<TokenMaskChunk>> state_chunks(
+      num_chunks > 1 ? num_states : 0, std::vector<TokenMaskChunk>(num_chunks)
+  );
+  auto run_task = [&](int32_t task_id) {
+    if (num_chunks == 1) {
+      masks[task_id] = compute_adaptive_token_mask(computed_states[task_id]);
+      return;
+    }
+    int32_t state_id = task_id / num_chunks;
+    int32_t chunk_id = task_id % num_chunks;
+    const auto& state = computed_states[state_id];
+    auto grammar_matcher =
+        GrammarMatcherForTokenMaskCache(grammar, state, *tag_dispatch_bitsets, false);
+    state_chunks[state_id][chunk_id] = grammar_matcher.GetTokenMaskChunk(
+        sorted_decoded_vocab,
+        tokenizer_info_.GetTrieSubtreeNodesRange(),
+        tokenizer_info_->GetVocabTrie(),
+        state.rule_id == root_rule_id,
+        chunk_bounds[chunk_id],
+        chunk_bounds[chunk_id + 1]
+    );
+  };
+
+  int32_t num_tasks = num_states * num_chunks;
   if (max_threads_ > 1) {
-    thread_pool->Join();
+    // TODO(Charlie): Figure out how to support ThreadPool and std::mutex in WebAssembly.
+    // Only declare ThreadPool if max_threads > 1, so when max_threads = 1, we do not need
+    // ThreadPool or std::mutex, which throws error in runtime in WebAssembly.
+    // Each thread takes the next task from a shared counter, so only one task per thread goes
+    // through the queue of the pool.
+    ThreadPool thread_pool(max_threads_);
+    std::atomic<int32_t> next_task_id{0};
+    for (int32_t i = 0; i < std::min(max_threads_, num_tasks); ++i) {
+      thread_pool.Execute([&]() {
+        for (int32_t task_id = next_task_id.fetch_add(1, std::memory_order_relaxed);
+             task_id < num_tasks;
+             task_id = next_task_id.fetch_add(1, std::memory_order_relaxed)) {
+          run_task(task_id);
+        }
+      });
+    }
+    thread_pool.Join();
+  } else {
+    for (int32_t task_id = 0; task_id < num_tasks; ++task_id) {
+      run_task(task_id);
+    }
+  }
+
+  for (int32_t state_id = 0; state_id < num_states; ++state_id) {
+    if (num_chunks > 1) {
+      masks[state_id] = MergeTokenMaskChunks(
+          tokenizer_info_.GetVocabSize(),
+          sorted_decoded_vocab,
+          state_chunks[state_id],
+          token_masks_as_bitsets_
+      );
+    }
+    compiled_grammar_impl->AddAdaptiveTokenMask(
+        computed_states[state_id], std::move(masks[state_id])
+    );
+  }
+
+  for (const auto& [state, source_state] : states_sharing_masks) {
+    compiled_grammar_impl->ShareAdaptiveTokenMask(state, source_state);
   }
 
+  if (reuse_rule_masks_) {
+    SetReusableRuleMasks(compiled_grammar_impl, rule_hashes);
+  }
   return CompiledGrammar(compiled_grammar_impl);
 }
 
+void GrammarCompilerNoCache::SetReusableRuleMasks(
+    const std::shared_ptr<CompiledGrammar::Impl>& compiled_grammar_impl,
+    const std::vector<uint64_t>& rule_hashes
+) {
+  if (max_memory_bytes_ != -1 &&
+      MemorySize(*compiled_grammar_impl) > static_cast<std::size_t>(max_memory_bytes_)) {
+    return;
+  }
+  auto root_rule_id = compiled_grammar_impl->grammar->GetRootRuleId();
+  auto reusable_rule_masks = std::make_shared<ReusableRuleMasks>(
+      ReusableRuleMasks{CompiledGrammar(compiled_grammar_impl), {}}
+  );
+  for (int32_t rule_id = 0; rule_id < static_cast<int>(rule_hashes.size()); ++rule_id) {
+    reusable_rule_masks->rule_ids.try_emplace(
+        {rule_hashes[rule_id], rule_id == root_rule_id}, rule_id
+    );
+  }
+  std::lock_guard<std::mutex> lock(reusable_rule_masks_mutex_);
+  reusable_rule_masks_ = std::move(reusable_rule_masks);
+}
+
+void GrammarCompilerNoCache::ClearReusableRuleMasks() {
+  std::lock_guard<std::mutex> lock(reusable_rule_masks_mutex_);
+  reusable_rule_masks_.reset();
+}
+
 CompiledGrammar GrammarCompilerNoCache::CompileBuiltinJSONGrammar() {
   return MultiThreadCompileGrammar(Grammar::BuiltinJSONGrammar());
 }
@@ -962,15 +1561,31 @@ class GrammarCompiler::Impl {
       const TokenizerInfo& tokenizer_info,
       int max_threads,
       bool cache_enabled,
-      int64_t max_memory_bytes
+      int64_t max_memory_bytes,
+      bool token_masks_as_bitsets,
+      bool lazy_token_masks,
+      int64_t token_bitmask_cache_bytes,
+      bool reuse_rule_masks
   )
-      : no_cache_compiler_(tokenizer_info, max_threads),
+      : no_cache_compiler_(
+            tokenizer_info,
+            max_threads,
+            token_masks_as_bitsets,
+            lazy_token_masks,
+            token_bitmask_cache_bytes,
+            reuse_rule_masks,
+            max_memory_bytes
+        ),
         cache_enabled_(cache_enabled),
         compile_cache_(static_cast<std::size_t>(max_memory_bytes), Computer(*this)) {
     if (max_memory_bytes < -1) {
       XGRAMMAR_LOG(FATAL) << "Invalid max_memory_bytes: " << max_memory_bytes << ". "
                           << "It should be -1 (unlimited) or a non-negative integer.";
     }
+    if (token_bitmask_cache_bytes < 0) {
+      XGRAMMAR_LOG(FATAL) << "Invalid token_bitmask_cache_bytes: " << token_bitmask_cache_bytes
+                          << ". It should be a non-negative integer.";
+    }
   }
 
   CompiledGrammar CompileBuiltinJSONGrammar();
@@ -1015,8 +1630,23 @@ class GrammarCompiler::Impl {
     GrammarCompiler::Impl& compiler;
   };
 
+  /*!
+   * \brief The size of a cached grammar is estimated once, when it is added. The parts that grow
+   * later are charged up front: the pending masks of a grammar with lazy token masks, and the
+   * budget of the token bitmask cache.
+   */
   struct SizeEstimator {
-    std::size_t operator()(const CompiledGrammar& value) const { return value.MemorySizeBytes(); }
+    std::size_t operator()(const CompiledGrammar& value) const {
+      const auto& impl = *value.ImplPtr();
+      std::size_t size = MemorySize(impl);
+      if (impl.lazy_adaptive_token_masks != nullptr) {
+        size += impl.lazy_adaptive_token_masks->PendingMemorySize();
+      }
+      if (impl.token_bitmask_cache != nullptr) {
+        size += impl.token_bitmask_cache->MaxMemorySize() - impl.token_bitmask_cache->MemorySize();
+      }
+      return size;
+    }
   };
 
   /*! \brief The no cache compiler. */
@@ -1114,7 +1744,10 @@ CompiledGrammar GrammarCompiler::Impl::CompileGrammar(
   return compile_cache_.Get(GrammarKey{ebnf_str, root_rule_name});
 }
 
-void GrammarCompiler::Impl::ClearCache() { compile_cache_.Clear(); }
+void GrammarCompiler::Impl::ClearCache() {
+  compile_cache_.Clear();
+  no_cache_compiler_.ClearReusableRuleMasks();
+}
 
 int64_t GrammarCompiler::Impl::GetCacheSizeBytes() const {
   return static_cast<int64_t>(compile_cache_.MemorySize());
@@ -1132,10 +1765,22 @@ GrammarCompiler::GrammarCompiler(
     const TokenizerInfo& tokenizer_info,
     int max_threads,
     bool cache_enabled,
-    int64_t max_memory_bytes
+    int64_t max_memory_bytes,
+    bool token_masks_as_bitsets,
+    bool lazy_token_masks,
+    int64_t token_bitmask_cache_bytes,
+    bool reuse_rule_masks
 )
-    : pimpl_(std::make_shared<Impl>(tokenizer_info, max_threads, cache_enabled, max_memory_bytes)) {
-}
+    : pimpl_(std::make_shared<Impl>(
+          tokenizer_info,
+          max_threads,
+          cache_enabled,
+          max_memory_bytes,
+          token_masks_as_bitsets,
+          lazy_token_masks,
+          token_bitmask_cache_bytes,
+          reuse_rule_masks
+      )) {}
 
 CompiledGrammar GrammarCompiler::CompileJSONSchema(
     const std::string& schema,
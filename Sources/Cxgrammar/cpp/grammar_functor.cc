@@ -7,10 +7,13 @@
 
 #include <xgrammar/xgrammar.h>
 
+#include <algorithm>
 #include <bitset>
 #include <cstdint>
 #include <queue>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "fsm_builder.h"
@@ -1640,6 +1643,406 @@ class GrammarOptimizerImpl {
   }
 };
 
+/*!
+ * \brief Partitions the rules into classes of identical rules. Starting from a single class, each
+ * class is split by the signatures of its rules, where a signature describes the rule with the rule
+ * references replaced by their classes, until no class is split any more.
+ */
+class RuleEquivalenceAnalyzerImpl {
+ public:
+  std::vector<int32_t> Apply(const Grammar& grammar, bool consider_lookahead) {
+    grammar_ = grammar;
+    allow_empty_rule_ids_ = std::unordered_set<int32_t>(
+        grammar->allow_empty_rule_ids.begin(), grammar->allow_empty_rule_ids.end()
+    );
+    int num_rules = grammar->NumRules();
+    rule_classes_.assign(num_rules, 0);
+    int num_classes = 1;
+    while (true) {
+      std::unordered_map<std::vector<int32_t>, int32_t> signature_to_class;
+      std::vector<int32_t> new_rule_classes(num_rules);
+      for (int32_t rule_id = 0; rule_id < num_rules; ++rule_id) {
+        GetRuleSignature(rule_id);
+        new_rule_classes[rule_id] =
+            signature_to_class.try_emplace(signature_, signature_to_class.size()).first->second;
+      }
+      rule_classes_ = std::move(new_rule_classes);
+      if (static_cast<int>(signature_to_class.size()) == num_classes) {
+        break;
+      }
+      num_classes = signature_to_class.size();
+    }
+    if (consider_lookahead) {
+      std::unordered_map<std::vector<int32_t>, int32_t> signature_to_class;
+      std::vector<int32_t> new_rule_classes(num_rules);
+      for (int32_t rule_id = 0; rule_id < num_rules; ++rule_id) {
+        GetLookaheadSignature(rule_id);
+        new_rule_classes[rule_id] =
+            signature_to_class.try_emplace(signature_, signature_to_class.size()).first->second;
+      }
+      rule_classes_ = std::move(new_rule_classes);
+    }
+    return rule_classes_;
+  }
+
+  std::vector<uint64_t> GetStructuralHashes(const Grammar& grammar, bool consider_lookahead) {
+    Apply(grammar, false);
+    int num_rules = grammar->NumRules();
+    int num_classes = 0;
+    for (auto rule_class : rule_classes_) {
+      num_classes = std::max(num_classes, rule_class + 1);
+    }
+
+    // The identical rules form a graph of classes, where the edges are the rule references of a
+    // representative rule in signature order. The hash of a class describes the part of this
+    // graph reachable from it, so it does not depend on the rule ids.
+    class_rules_.assign(num_classes, -1);
+    std::vector<std::vector<int32_t>> class_refs(num_classes);
+    for (int32_t rule_id = 0; rule_id < num_rules; ++rule_id) {
+      auto rule_class = rule_classes_[rule_id];
+      if (class_rules_[rule_class] != -1) {
+        continue;
+      }
+      class_rules_[rule_class] = rule_id;
+      GetRuleSignature(rule_id);
+      for (auto ref_rule_id : referenced_rules_) {
+        class_refs[rule_class].push_back(rule_classes_[ref_rule_id]);
+      }
+    }
+
+    // Tarjan's algorithm finds the strongly connected components in reverse topological order, so
+    // the classes referenced from outside a component are hashed before it.
+    class_ref_values_.assign(num_classes, 0);
+    std::vector<int32_t> index(num_classes, -1);
+    std::vector<int32_t> low_link(num_classes);
+    std::vector<bool> on_stack(num_classes, false);
+    std::vector<bool> in_component(num_classes, false);
+    std::vector<int32_t> component_stack;
+    std::vector<std::pair<int32_t, int32_t>> dfs_stack;
+    int32_t next_index = 0;
+    auto visit = [&](int32_t rule_class) {
+      index[rule_class] = low_link[rule_class] = next_index++;
+      component_stack.push_back(rule_class);
+      on_stack[rule_class] = true;
+      dfs_stack.emplace_back(rule_class, 0);
+    };
+    for (int32_t root_class = 0; root_class < num_classes; ++root_class) {
+      if (index[root_class] != -1) {
+        continue;
+      }
+      visit(root_class);
+      while (!dfs_stack.empty()) {
+        auto [rule_class, next_ref] = dfs_stack.back();
+        if (next_ref < static_cast<int>(class_refs[rule_class].size())) {
+          ++dfs_stack.back().second;
+          auto ref_class = class_refs[rule_class][next_ref];
+          if (index[ref_class] == -1) {
+            visit(ref_class);
+          } else if (on_stack[ref_class]) {
+            low_link[rule_class] = std::min(low_link[rule_class], index[ref_class]);
+          }
+          continue;
+        }
+        dfs_stack.pop_back();
+        if (!dfs_stack.empty()) {
+          auto parent_class = dfs_stack.back().first;
+          low_link[parent_class] = std::min(low_link[parent_class], low_link[rule_class]);
+        }
+        if (low_link[rule_class] != index[rule_class]) {
+          continue;
+        }
+        std::vector<int32_t> component;
+        while (true) {
+          auto member = component_stack.back();
+          component_stack.pop_back();
+          on_stack[member] = false;
+          component.push_back(member);
+          if (member == rule_class) {
+            break;
+          }
+        }
+        HashComponent(component, class_refs, &in_component);
+      }
+    }
+
+    std::vector<uint64_t> hashes(num_rules);
+    for (int32_t rule_id = 0; rule_id < num_rules; ++rule_id) {
+      hashes[rule_id] = class_ref_values_[rule_classes_[rule_id]];
+      if (consider_lookahead) {
+        const auto& rule = grammar_->GetRule(rule_id);
+        signature_.clear();
+        AddRuleRefSignature(rule_id);
+        signature_.push_back(rule.is_exact_lookahead);
+        if (rule.lookahead_assertion_id != -1) {
+          AddExprSignature(rule.lookahead_assertion_id);
+        }
+        hashes[rule_id] = std::hash<std::vector<int32_t>>{}(signature_);
+      }
+    }
+    class_ref_values_.clear();
+    return hashes;
+  }
+
+  static bool AreRulesIdentical(
+      const Grammar& grammar,
+      int32_t rule_id,
+      const Grammar& other_grammar,
+      int32_t other_rule_id,
+      bool consider_lookahead,
+      std::unordered_set<std::pair<int32_t, int32_t>>* identical_rule_pairs
+  ) {
+    // All the rules are in one class, so the signatures describe the rule bodies with the rule
+    // references left out, and the referenced rules are compared pair by pair.
+    RuleEquivalenceAnalyzerImpl analyzer, other_analyzer;
+    analyzer.InitSingleClass(grammar);
+    other_analyzer.InitSingleClass(other_grammar);
+    std::vector<std::pair<int32_t, int32_t>> stack;
+    std::unordered_set<std::pair<int32_t, int32_t>> visited;
+    auto compare_signatures = [&]() {
+      if (analyzer.signature_ != other_analyzer.signature_) {
+        return false;
+      }
+      for (int i = 0; i < static_cast<int>(analyzer.referenced_rules_.size()); ++i) {
+        std::pair<int32_t, int32_t> ref_pair{
+            analyzer.referenced_rules_[i], other_analyzer.referenced_rules_[i]
+        };
+        if ((identical_rule_pairs == nullptr || identical_rule_pairs->count(ref_pair) == 0) &&
+            visited.insert(ref_pair).second) {
+          stack.push_back(ref_pair);
+        }
+      }
+      return true;
+    };
+
+    if (consider_lookahead) {
+      analyzer.referenced_rules_.clear();
+      other_analyzer.referenced_rules_.clear();
+      analyzer.GetLookaheadSignature(rule_id);
+      other_analyzer.GetLookaheadSignature(other_rule_id);
+      if (!compare_signatures()) {
+        return false;
+      }
+    }
+    std::pair<int32_t, int32_t> rule_pair{rule_id, other_rule_id};
+    if ((identical_rule_pairs == nullptr || identical_rule_pairs->count(rule_pair) == 0) &&
+        visited.insert(rule_pair).second) {
+      stack.push_back(rule_pair);
+    }
+    while (!stack.empty()) {
+      auto [current_rule_id, current_other_rule_id] = stack.back();
+      stack.pop_back();
+      analyzer.GetRuleSignature(current_rule_id);
+      other_analyzer.GetRuleSignature(current_other_rule_id);
+      if (!compare_signatures()) {
+        return false;
+      }
+    }
+    if (identical_rule_pairs != nullptr) {
+      identical_rule_pairs->insert(visited.begin(), visited.end());
+    }
+    return true;
+  }
+
+  static std::vector<int32_t> GetCanonicalStateOrder(const CompactFSMWithStartEnd& fsm) {
+    // Breadth-first search, visiting the edges in their stored order.
+    std::vector<int32_t> order = {fsm.GetStart()};
+    std::unordered_set<int32_t> visited = {fsm.GetStart()};
+    for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+      for (const auto& edge : fsm.GetFsm().GetEdges(order[i])) {
+        if (visited.insert(edge.target).second) {
+          order.push_back(edge.target);
+        }
+      }
+    }
+    return order;
+  }
+
+ private:
+  /*! \brief Put all the rules of the grammar in one class. */
+  void InitSingleClass(const Grammar& grammar) {
+    grammar_ = grammar;
+    allow_empty_rule_ids_ = std::unordered_set<int32_t>(
+        grammar->allow_empty_rule_ids.begin(), grammar->allow_empty_rule_ids.end()
+    );
+    rule_classes_.assign(grammar->NumRules(), 0);
+    class_ref_values_.clear();
+  }
+
+  /*! \brief Get the signature of the rule under the current classes into signature_. */
+  void GetRuleSignature(int32_t rule_id) {
+    signature_.clear();
+    referenced_rules_.clear();
+    // Include the current class, so that the classes are only split.
+    signature_.push_back(rule_classes_[rule_id]);
+    AddRuleBodySignature(rule_id);
+  }
+
+  /*!
+   * \brief Hash the classes of a strongly connected component into class_ref_values_. The hash of
+   * a class is the hash of the signatures of the classes in the component in breadth-first order
+   * from it, where a reference to a class in the component is replaced by its position in the
+   * order, and a reference to another class by its hash.
+   */
+  void HashComponent(
+      const std::vector<int32_t>& component,
+      const std::vector<std::vector<int32_t>>& class_refs,
+      std::vector<bool>* in_component
+  ) {
+    // The hashes have the highest bit set, and the positions not, so that they are distinct.
+    constexpr uint64_t kHashFlag = uint64_t(1) << 63;
+    for (auto member : component) {
+      (*in_component)[member] = true;
+    }
+    std::vector<uint64_t> component_hashes;
+    std::vector<int32_t> order;
+    std::unordered_map<int32_t, int32_t> position;
+    for (auto start : component) {
+      order = {start};
+      position = {{start, 0}};
+      for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+        for (auto ref_class : class_refs[order[i]]) {
+          if ((*in_component)[ref_class] && position.try_emplace(ref_class, order.size()).second) {
+            order.push_back(ref_class);
+          }
+        }
+      }
+      for (auto [member, member_position] : position) {
+        class_ref_values_[member] = member_position;
+      }
+      std::vector<int32_t> component_signature;
+      for (auto member : order) {
+        signature_.clear();
+        AddRuleBodySignature(class_rules_[member]);
+        component_signature.push_back(signature_.size());
+        component_signature.insert(component_signature.end(), signature_.begin(), signature_.end());
+      }
+      component_hashes.push_back(
+          std::hash<std::vector<int32_t>>{}(component_signature) | kHashFlag
+      );
+    }
+    for (int i = 0; i < static_cast<int>(component.size()); ++i) {
+      class_ref_values_[component[i]] = component_hashes[i];
+      (*in_component)[component[i]] = false;
+    }
+  }
+
+  /*! \brief Add the signature of the rule except its class to signature_. */
+  void AddRuleBodySignature(int32_t rule_id) {
+    const auto& rule = grammar_->GetRule(rule_id);
+    signature_.push_back(allow_empty_rule_ids_.count(rule_id));
+    AddExprSignature(rule.body_expr_id);
+    const auto& fsm = grammar_->per_rule_fsms[rule_id];
+    if (!fsm.has_value()) {
+      signature_.push_back(-1);
+    } else {
+      AddFSMSignature(fsm.value());
+    }
+  }
+
+  /*!
+   * \brief Get the signature of the lookahead assertion of the rule under the final classes into
+   * signature_. It is only used to split the final classes, since the parser ignores the lookahead
+   * assertions of the referenced rules.
+   */
+  void GetLookaheadSignature(int32_t rule_id) {
+    const auto& rule = grammar_->GetRule(rule_id);
+    signature_.clear();
+    signature_.push_back(rule_classes_[rule_id]);
+    signature_.push_back(rule.is_exact_lookahead);
+    if (rule.lookahead_assertion_id != -1) {
+      AddExprSignature(rule.lookahead_assertion_id);
+    }
+  }
+
+  void AddExprSignature(int32_t grammar_expr_id) {
+    auto grammar_expr = grammar_->GetGrammarExpr(grammar_expr_id);
+    signature_.push_back(static_cast<int32_t>(grammar_expr.type));
+    signature_.push_back(grammar_expr.size());
+    switch (grammar_expr.type) {
+      case ExprType::kRuleRef:
+        AddRuleRefSignature(grammar_expr[0]);
+        break;
+      case ExprType::kRepeat:
+        AddRuleRefSignature(grammar_expr[0]);
+        signature_.push_back(grammar_expr[1]);
+        signature_.push_back(grammar_expr[2]);
+        break;
+      case ExprType::kSequence:
+      case ExprType::kChoices:
+        for (auto child_id : grammar_expr) {
+          AddExprSignature(child_id);
+        }
+        break;
+      case ExprType::kTagDispatch: {
+        int num_tag_params =
+            grammar_expr.size() - Grammar::Impl::TagDispatch::kTagDispatchExtraParameter;
+        for (int i = 0; i < num_tag_params; i += 2) {
+          AddExprSignature(grammar_expr[i]);
+          AddRuleRefSignature(grammar_expr[i + 1]);
+        }
+        // stop_eos, stop_str_expr_id, loop_after_dispatch, excluded_str_expr_id
+        signature_.push_back(grammar_expr[num_tag_params]);
+        AddExprSignature(grammar_expr[num_tag_params + 1]);
+        signature_.push_back(grammar_expr[num_tag_params + 2]);
+        AddExprSignature(grammar_expr[num_tag_params + 3]);
+        break;
+      }
+      default:
+        signature_.insert(signature_.end(), grammar_expr.begin(), grammar_expr.end());
+        break;
+    }
+  }
+
+  void AddFSMSignature(const CompactFSMWithStartEnd& fsm) {
+    auto order = GetCanonicalStateOrder(fsm);
+    std::unordered_map<int32_t, int32_t> state_to_canonical_id;
+    for (int i = 0; i < static_cast<int>(order.size()); ++i) {
+      state_to_canonical_id[order[i]] = i;
+    }
+    signature_.push_back(order.size());
+    for (auto state : order) {
+      auto edges = fsm.GetFsm().GetEdges(state);
+      signature_.push_back(fsm.IsEndState(state));
+      signature_.push_back(edges.size());
+      for (const auto& edge : edges) {
+        signature_.push_back(edge.min);
+        if (edge.IsRuleRef()) {
+          AddRuleRefSignature(edge.max);
+        } else {
+          signature_.push_back(edge.max);
+        }
+        signature_.push_back(state_to_canonical_id[edge.target]);
+      }
+    }
+  }
+
+  /*!
+   * \brief Add a reference to the rule to signature_. It is described by the class of the rule, or
+   * by class_ref_values_ when hashing.
+   */
+  void AddRuleRefSignature(int32_t rule_id) {
+    referenced_rules_.push_back(rule_id);
+    if (class_ref_values_.empty()) {
+      signature_.push_back(rule_classes_[rule_id]);
+      return;
+    }
+    auto value = class_ref_values_[rule_classes_[rule_id]];
+    signature_.push_back(static_cast<int32_t>(value));
+    signature_.push_back(static_cast<int32_t>(value >> 32));
+  }
+
+  Grammar grammar_{NullObj{}};
+  std::unordered_set<int32_t> allow_empty_rule_ids_;
+  std::vector<int32_t> rule_classes_;
+  std::vector<int32_t> signature_;
+  /*! \brief The rules referenced in signature_, in order. */
+  std::vector<int32_t> referenced_rules_;
+  /*! \brief The representative rule of each class. */
+  std::vector<int32_t> class_rules_;
+  /*! \brief The values of the references to each class when hashing. */
+  std::vector<uint64_t> class_ref_values_;
+};
+
 class ByteStringFuserImpl : public GrammarMutator {
  public:
   using GrammarMutator::Apply;
@@ -1775,6 +2178,37 @@ std::vector<int32_t> AllowEmptyRuleAnalyzer::Apply(const Grammar& grammar) {
   return AllowEmptyRuleAnalyzerImpl().Apply(grammar);
 }
 
+std::vector<int32_t> RuleEquivalenceAnalyzer::Apply(
+    const Grammar& grammar, bool consider_lookahead
+) {
+  return RuleEquivalenceAnalyzerImpl().Apply(grammar, consider_lookahead);
+}
+
+std::vector<uint64_t> RuleEquivalenceAnalyzer::GetStructuralHashes(
+    const Grammar& grammar, bool consider_lookahead
+) {
+  return RuleEquivalenceAnalyzerImpl().GetStructuralHashes(grammar, consider_lookahead);
+}
+
+bool RuleEquivalenceAnalyzer::AreRulesIdentical(
+    const Grammar& grammar,
+    int32_t rule_id,
+    const Grammar& other_grammar,
+    int32_t other_rule_id,
+    bool consider_lookahead,
+    std::unordered_set<std::pair<int32_t, int32_t>>* identical_rule_pairs
+) {
+  return RuleEquivalenceAnalyzerImpl::AreRulesIdentical(
+      grammar, rule_id, other_grammar, other_rule_id, consider_lookahead, identical_rule_pairs
+  );
+}
+
+std::vector<int32_t> RuleEquivalenceAnalyzer::GetCanonicalStateOrder(
+    const CompactFSMWithStartEnd& fsm
+) {
+  return RuleEquivalenceAnalyzerImpl::GetCanonicalStateOrder(fsm);
+}
+
 Grammar RuleInliner::Apply(const Grammar& grammar) { return RuleInlinerImpl().Apply(grammar); }
 
 Grammar DeadCodeEliminator::Apply(const Grammar& grammar) {
@@ -10,9 +10,12 @@
 #include <xgrammar/xgrammar.h>
 
 #include <string>
+#include <unordered_set>
+#include <utility>
 
 #include "grammar_builder.h"
 #include "grammar_impl.h"
+#include "support/utils.h"
 #include "xgrammar/grammar.h"
 
 namespace xgrammar {
@@ -311,6 +314,57 @@ class AllowEmptyRuleAnalyzer {
   static std::vector<int32_t> Apply(const Grammar& grammar);
 };
 
+/*!
+ * \brief Analyze the grammar to find the structurally identical rules, i.e. the rules with the same
+ * bodies and FSMs up to the renaming of rules and FSM states. The parser behaves the same way in
+ * the corresponding positions of such rules.
+ */
+class RuleEquivalenceAnalyzer {
+ public:
+  /*!
+   * \brief Get the equivalence class of each rule.
+   * \param consider_lookahead Whether to also require the same lookahead assertions. The parser
+   * ignores the lookahead assertions of referenced rules, but the token masks of a rule depend on
+   * its own.
+   * \return A vector mapping each rule id to a class id. Identical rules have the same class id.
+   */
+  static std::vector<int32_t> Apply(const Grammar& grammar, bool consider_lookahead = false);
+
+  /*!
+   * \brief Get a structural hash of each rule. Unlike the class ids, the hashes can be compared
+   * across grammars: identical rules of different grammars, including the rules they reference,
+   * have the same hash.
+   * \param consider_lookahead Whether to also hash the lookahead assertion of the rule.
+   */
+  static std::vector<uint64_t> GetStructuralHashes(
+      const Grammar& grammar, bool consider_lookahead = false
+  );
+
+  /*!
+   * \brief Whether a rule of one grammar is identical to a rule of another grammar, including the
+   * rules they reference. It compares the rule bodies, so unlike equal structural hashes it has no
+   * false positives.
+   * \param consider_lookahead Whether to also compare the lookahead assertions of the two rules.
+   * \param identical_rule_pairs If not nullptr, the pairs of rules whose bodies are known to be
+   * identical. They are not compared again, and the pairs found identical are added, so that
+   * checking many rules of the same two grammars compares each pair once.
+   */
+  static bool AreRulesIdentical(
+      const Grammar& grammar,
+      int32_t rule_id,
+      const Grammar& other_grammar,
+      int32_t other_rule_id,
+      bool consider_lookahead,
+      std::unordered_set<std::pair<int32_t, int32_t>>* identical_rule_pairs = nullptr
+  );
+
+  /*!
+   * \brief Get the states reachable from the start state of the FSM, in a canonical order. The
+   * states of the FSMs of identical rules correspond to each other in this order.
+   */
+  static std::vector<int32_t> GetCanonicalStateOrder(const CompactFSMWithStartEnd& fsm);
+};
+
 /*!
  * \brief Inline the rule references in the grammar.
  */
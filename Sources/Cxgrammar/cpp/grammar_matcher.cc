@@ -10,9 +10,16 @@
 #include <xgrammar/matcher.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <numeric>
 #include <optional>
+#include <queue>
 #include <thread>
+#include <unordered_map>
 #include <utility>
 #include <variant>
 #include <vector>
@@ -26,6 +33,7 @@
 #include "support/logging.h"
 #include "support/thread_pool.h"
 #include "testing.h"
+#include "token_bitmask_cpu.h"
 
 namespace xgrammar {
 
@@ -86,46 +94,139 @@ std::pair<bool, int> _IsSingleTokenBitmask(const DLTensor& bitmask, int vocab_si
   }
 }
 
+/*!
+ * \brief Get the distance between two consecutive rows of a 1D or 2D tensor, in elements. The
+ * strides field is optional in DLPack, and a null value means the tensor is compact.
+ */
+int64_t GetRowStride(const DLTensor& tensor) {
+  if (tensor.ndim == 1) {
+    return tensor.shape[0];
+  }
+  return tensor.strides != nullptr ? tensor.strides[0] : tensor.shape[1];
+}
+
+/*! \brief The minimal number of tokens masked by one thread, to amortize the dispatch overhead. */
+const int kMinTokensPerMaskTask = 1 << 16;
+
+/*!
+ * \brief Get the thread pool applying the bitmasks in parallel. It is shared by all calls and
+ * created on first use, so a call does not pay for starting and joining the threads. It is kept
+ * apart from the asynchronous mask pool, whose tasks may apply bitmasks themselves.
+ */
+ThreadPool& GetApplyMaskThreadPool() {
+  static ThreadPool thread_pool(std::max(1u, std::thread::hardware_concurrency()));
+  return thread_pool;
+}
+
+/*!
+ * \brief Apply the bitmask to the given rows of the logits, optionally in parallel. The rows are
+ * flattened into one range of bitmask words that is split evenly among the threads, so both a
+ * large batch and a single row with a large vocabulary are spread across the threads.
+ * \param row_kernel The kernel applying the bitmask to a range of one row. It is called with the
+ * logits and the bitmask of the range and the number of tokens in the range.
+ */
+template <typename T, typename RowKernel>
+void ApplyMaskToRows(
+    T* logits_data,
+    int64_t logits_stride0,
+    const uint32_t* bitmask_data,
+    int64_t bitmask_stride0,
+    const std::vector<int>& rows,
+    int vocab_size,
+    int num_threads,
+    RowKernel row_kernel
+) {
+  const int64_t words_per_row = (vocab_size + DynamicBitset::BITS_PER_BLOCK - 1) /
+                                DynamicBitset::BITS_PER_BLOCK;
+  const int64_t total_words = words_per_row * static_cast<int64_t>(rows.size());
+  if (total_words == 0) {
+    return;
+  }
+
+  auto apply_words = [&](int64_t begin, int64_t end) {
+    while (begin < end) {
+      int64_t row_pos = begin / words_per_row;
+      int64_t word_begin = begin % words_per_row;
+      int64_t word_end = std::min(words_per_row, word_begin + (end - begin));
+      int64_t token_begin = word_begin * DynamicBitset::BITS_PER_BLOCK;
+      int64_t token_end =
+          std::min<int64_t>(word_end * DynamicBitset::BITS_PER_BLOCK, vocab_size);
+      int row = rows[row_pos];
+      row_kernel(
+          logits_data + row * logits_stride0 + token_begin,
+          bitmask_data + row * bitmask_stride0 + word_begin,
+          static_cast<int>(token_end - token_begin)
+      );
+      begin += word_end - word_begin;
+    }
+  };
+
+  int64_t max_tasks = total_words * DynamicBitset::BITS_PER_BLOCK / kMinTokensPerMaskTask;
+  int num_tasks = static_cast<int>(std::max<int64_t>(1, std::min<int64_t>(num_threads, max_tasks)));
+  if (num_tasks == 1) {
+    apply_words(0, total_words);
+    return;
+  }
+  int64_t words_per_task = (total_words + num_tasks - 1) / num_tasks;
+  // The calling thread applies the first range, and waits only for the ranges of this call, since
+  // the pool may be running the ranges of other calls at the same time.
+  std::vector<std::shared_future<void>> futures;
+  futures.reserve(num_tasks - 1);
+  for (int task_id = 1; task_id < num_tasks; ++task_id) {
+    int64_t begin = task_id * words_per_task;
+    int64_t end = std::min(begin + words_per_task, total_words);
+    if (begin >= end) {
+      break;
+    }
+    futures.push_back(GetApplyMaskThreadPool().Submit([&apply_words, begin, end]() {
+      apply_words(begin, end);
+    }));
+  }
+  apply_words(0, std::min(words_per_task, total_words));
+  for (const auto& future : futures) {
+    future.get();
+  }
+}
+
+/*! \brief Get the rows to mask: the given indices, or all rows of the logits. */
+std::vector<int> GetRowsToMask(const DLTensor& logits, std::optional<std::vector<int>> indices) {
+  if (indices.has_value()) {
+    return std::move(indices.value());
+  }
+  std::vector<int> rows(logits.ndim == 2 ? logits.shape[0] : 1);
+  for (int i = 0; i < static_cast<int>(rows.size()); ++i) {
+    rows[i] = i;
+  }
+  return rows;
+}
+
 void ApplyMask32Bits(
     DLTensor* logits,
     const DLTensor& bitmask,
     int vocab_size,
-    std::optional<std::vector<int>> indices
+    std::optional<std::vector<int>> indices,
+    int num_threads
 ) {
   XGRAMMAR_CHECK(logits->dtype.code == kDLFloat && logits->dtype.bits == 32)
       << "The provided logits's dtype is not valid: should be float32";
-  std::pair<int, int> logits_shape =
-      logits->ndim == 2
-          ? std::make_pair(static_cast<int>(logits->shape[0]), static_cast<int>(logits->shape[1]))
-          : std::make_pair(1, static_cast<int>(logits->shape[0]));
-  int logits_stride0 = logits->strides[0];
-  int bitmask_stride0 = bitmask.strides[0];
-  if (indices.has_value()) {
-    for (auto idx : indices.value()) {
-      uint32_t* data_ptr = reinterpret_cast<uint32_t*>(bitmask.data) + idx * bitmask_stride0;
-      DynamicBitset bitset(vocab_size, data_ptr);
-      auto logits_ptr = reinterpret_cast<float*>(logits->data) + idx * logits_stride0;
-      for (int i = bitset.FindFirstZero(); i != -1; i = bitset.FindNextZero(i)) {
-        logits_ptr[i] = -std::numeric_limits<float>::infinity();
-      }
-    }
-  } else {
-    for (int idx = 0; idx < logits_shape.first; ++idx) {
-      uint32_t* data_ptr = reinterpret_cast<uint32_t*>(bitmask.data) + idx * bitmask_stride0;
-      DynamicBitset bitset(vocab_size, data_ptr);
-      auto logits_ptr = reinterpret_cast<float*>(logits->data) + idx * logits_stride0;
-      for (int i = bitset.FindFirstZero(); i != -1; i = bitset.FindNextZero(i)) {
-        logits_ptr[i] = -std::numeric_limits<float>::infinity();
-      }
-    }
-  }
+  ApplyMaskToRows(
+      reinterpret_cast<float*>(logits->data),
+      GetRowStride(*logits),
+      reinterpret_cast<const uint32_t*>(bitmask.data),
+      GetRowStride(bitmask),
+      GetRowsToMask(*logits, std::move(indices)),
+      vocab_size,
+      num_threads,
+      ApplyTokenBitmaskRowFloat32
+  );
 }
 
 void ApplyMask16Bits(
     DLTensor* logits,
     const DLTensor& bitmask,
     int vocab_size,
-    std::optional<std::vector<int>> indices
+    std::optional<std::vector<int>> indices,
+    int num_threads
 ) {
   XGRAMMAR_CHECK(logits->dtype.bits == 16)
       << "The provided logits's dtype is not valid: should be bfloat16 or float16";
@@ -143,38 +244,26 @@ void ApplyMask16Bits(
       XGRAMMAR_LOG(FATAL
       ) << "The provided logits's dtype is not valid: should be bfloat16 or float16";
   }
-  std::pair<int, int> logits_shape =
-      logits->ndim == 2
-          ? std::make_pair(static_cast<int>(logits->shape[0]), static_cast<int>(logits->shape[1]))
-          : std::make_pair(1, static_cast<int>(logits->shape[0]));
-  int logits_stride0 = logits->strides[0];
-  int bitmask_stride0 = bitmask.strides[0];
-  if (indices.has_value()) {
-    for (auto idx : indices.value()) {
-      uint32_t* data_ptr = reinterpret_cast<uint32_t*>(bitmask.data) + idx * bitmask_stride0;
-      DynamicBitset bitset(vocab_size, data_ptr);
-      auto logits_ptr = reinterpret_cast<uint16_t*>(logits->data) + idx * logits_stride0;
-      for (int i = bitset.FindFirstZero(); i != -1; i = bitset.FindNextZero(i)) {
-        logits_ptr[i] = kMinusInfinity;
+  ApplyMaskToRows(
+      reinterpret_cast<uint16_t*>(logits->data),
+      GetRowStride(*logits),
+      reinterpret_cast<const uint32_t*>(bitmask.data),
+      GetRowStride(bitmask),
+      GetRowsToMask(*logits, std::move(indices)),
+      vocab_size,
+      num_threads,
+      [kMinusInfinity](uint16_t* logits_ptr, const uint32_t* bitmask_ptr, int num_tokens) {
+        ApplyTokenBitmaskRow16Bits(logits_ptr, bitmask_ptr, num_tokens, kMinusInfinity);
       }
-    }
-  } else {
-    for (int idx = 0; idx < logits_shape.first; ++idx) {
-      uint32_t* data_ptr = reinterpret_cast<uint32_t*>(bitmask.data) + idx * bitmask_stride0;
-      DynamicBitset bitset(vocab_size, data_ptr);
-      auto logits_ptr = reinterpret_cast<uint16_t*>(logits->data) + idx * logits_stride0;
-      for (int i = bitset.FindFirstZero(); i != -1; i = bitset.FindNextZero(i)) {
-        logits_ptr[i] = kMinusInfinity;
-      }
-    }
-  }
+  );
 }
 
 void ApplyTokenBitmaskInplaceCPU(
     DLTensor* logits,
     const DLTensor& bitmask,
     int vocab_size,
-    std::optional<std::vector<int>> indices
+    std::optional<std::vector<int>> indices,
+    int num_threads
 ) {
   // Check device and dim
   XGRAMMAR_CHECK(
@@ -187,6 +276,8 @@ void ApplyTokenBitmaskInplaceCPU(
   ) << "The provided bitmask's device is not valid: should be CPU";
   XGRAMMAR_CHECK(logits->ndim == 2 || logits->ndim == 1)
       << "The provided logits's shape is not valid: should be 2D or 1D";
+  XGRAMMAR_CHECK(num_threads >= 1)
+      << "The num_threads should be at least 1, but got " << num_threads;
   XGRAMMAR_CHECK(bitmask.ndim == 2 || bitmask.ndim == 1)
       << "The provided bitmask's shape is not valid: should be 2D or 1D";
 
@@ -221,15 +312,24 @@ void ApplyTokenBitmaskInplaceCPU(
 
   // Apply mask
   if (logits->dtype.bits == 32) {
-    ApplyMask32Bits(logits, bitmask, vocab_size, indices);
+    ApplyMask32Bits(logits, bitmask, vocab_size, std::move(indices), num_threads);
   } else if (logits->dtype.bits == 16) {
-    ApplyMask16Bits(logits, bitmask, vocab_size, indices);
+    ApplyMask16Bits(logits, bitmask, vocab_size, std::move(indices), num_threads);
   } else {
     XGRAMMAR_LOG(FATAL
     ) << "The provided logits's dtype is not valid: should be float32 or float16/bfloat16";
   }
 }
 
+/*!
+ * \brief Get the thread pool running the asynchronous mask computations. It is shared by all
+ * matchers and created on first use.
+ */
+ThreadPool& GetAsyncMaskThreadPool() {
+  static ThreadPool thread_pool(std::max(1u, std::thread::hardware_concurrency()));
+  return thread_pool;
+}
+
 /******************* Grammar Matcher with Adaptive Token Mask *******************/
 
 /*
@@ -343,24 +443,65 @@ class GrammarMatcher::Impl : public EarleyParser {
         tokenizer_info_(compiled_grammar->tokenizer_info),
         stop_token_ids_(override_stop_tokens.value_or(tokenizer_info_.GetStopTokenIds())),
         terminate_without_stop_token_(terminate_without_stop_token),
-        tmp_accepted_bitset_(tokenizer_info_.GetVocabSize()) {
+        tmp_accepted_bitset_(tokenizer_info_.GetVocabSize()),
+        tmp_rejected_bitset_(tokenizer_info_.GetVocabSize()),
+        tmp_mask_rejected_bitset_(tokenizer_info_.GetVocabSize()) {
     XGRAMMAR_CHECK(!override_stop_tokens.has_value() || !override_stop_tokens->empty())
         << "The override_stop_tokens should not be empty";
   }
 
+  /*! \brief Construct a fork of a matcher. The parser history is shared with the parent. */
+  explicit Impl(const Impl* parent)
+      : EarleyParser(parent),
+        compiled_grammar_(parent->compiled_grammar_),
+        tokenizer_info_(parent->tokenizer_info_),
+        stop_token_ids_(parent->stop_token_ids_),
+        terminate_without_stop_token_(parent->terminate_without_stop_token_),
+        token_length_history(parent->token_length_history.Fork()),
+        tmp_accepted_bitset_(tokenizer_info_.GetVocabSize()),
+        tmp_rejected_bitset_(tokenizer_info_.GetVocabSize()),
+        tmp_mask_rejected_bitset_(tokenizer_info_.GetVocabSize()) {}
+
   bool AcceptToken(int32_t token_id, bool debug_print = false);
 
   bool AcceptString(const std::string& input_str, bool debug_print = false);
 
   bool FillNextTokenBitmask(DLTensor* next_token_bitmask, int index, bool debug_print = false);
 
+  /*!
+   * \brief Estimate the cost of the next FillNextTokenBitmask call, used to schedule a batch of
+   * matchers. Checking the uncertain tokens dominates the time, so the cost is the number of the
+   * latest scanable states plus the number of uncertain tokens in their adaptive token masks.
+   */
+  int64_t EstimateFillNextTokenBitmaskCost() const;
+
+  int32_t FindLongestAcceptedPrefix(
+      const std::vector<int32_t>& token_ids, bool debug_print = false
+  );
+
+  std::vector<uint8_t> TraverseDraftTree(
+      const std::vector<int32_t>& draft_tokens,
+      const std::vector<int32_t>& parent_indices,
+      DLTensor* next_token_bitmask,
+      bool debug_print = false
+  );
+
   std::string FindJumpForwardString();
 
   void Rollback(int num_tokens);
 
+  GrammarMatcher::Checkpoint Snapshot() const;
+
+  void Restore(const GrammarMatcher::Checkpoint& checkpoint);
+
   bool IsTerminated() const;
 
-  void Reset() { EarleyParser::Reset(); }
+  bool IsStopTokenAccepted() const;
+
+  void Reset() {
+    EarleyParser::Reset();
+    token_length_history.PopBack(token_length_history.size());
+  }
 
   int GetMaxRollbackTokens() const { return -1; }
 
@@ -385,6 +526,16 @@ class GrammarMatcher::Impl : public EarleyParser {
       const std::vector<bool>& uncertain_tokens_bitset
   );
 
+  /*!
+   * \brief Fill the bitmask when no latest state has uncertain tokens, given their masks in
+   * tmp_latest_masks_. The accepted sets are united in tmp_accepted_bitset_ and the rejected sets
+   * are intersected in tmp_rejected_bitset_, so no sorted index list is built or merged.
+   * \returns Whether the bitmask need to be applied (not all-true).
+   */
+  bool FillCertainTokenBitmask(
+      int32_t* bitmask_data_ptr, const std::vector<ParserState>& latest_states, bool debug_print
+  );
+
   /*! \brief Set the acceptable next token in next_token_bitmask. */
   void SetTokenBitmask(
       int32_t* bitmask_data_ptr,
@@ -400,23 +551,105 @@ class GrammarMatcher::Impl : public EarleyParser {
    */
   bool AcceptStopToken();
 
-  bool IsStopTokenAccepted() const;
-
   /*! \brief Check if the token bitmask is all-true. */
   bool IsTokenBitmaskAllTrue(int32_t* bitmask_data_ptr);
 
+  /*!
+   * \brief Build the key of the token bitmask cache of the compiled grammar for the current state.
+   * \details Besides the latest scanable states, the uncertain tokens are checked against the
+   * parent states that the latest states complete into, recursively. So the key encodes the graph
+   * of the ancestors of the latest states. A node of the graph is a (rule_start_pos, rule_id)
+   * pair, i.e. the parent states waiting for a rule predicted at a position. The positions are
+   * replaced by the order of first visit, so the same context at different positions of the input
+   * shares the key. The key also includes whether the root rule is completed and the stop tokens,
+   * which decide the stop tokens in the bitmask.
+   */
+  void BuildTokenBitmaskCacheKey(
+      const std::vector<ParserState>& latest_states, std::vector<int32_t>* key
+  );
+
   std::string PrintBitmask(int32_t* bitmask_data_ptr, const TokenizerInfo& tokenizer_info);
 
   CompiledGrammar compiled_grammar_;
   TokenizerInfo tokenizer_info_;
   std::vector<int> stop_token_ids_;
   bool terminate_without_stop_token_;
-  std::deque<int> token_length_history;
+  SharedPrefixVector<int32_t> token_length_history;
 
   // Temporary data for FillNextTokenBitmask. They are stored here to avoid repeated allocation.
   DynamicBitset tmp_accepted_bitset_;
+  DynamicBitset tmp_rejected_bitset_;
+  DynamicBitset tmp_mask_rejected_bitset_;
+  std::vector<const AdaptiveTokenMask*> tmp_latest_masks_;
   std::vector<int32_t> tmp_rejected_indices_;
   std::vector<int32_t> tmp_rejected_indices_delta_;
+  std::vector<int32_t> tmp_mask_uncertain_indices_;
+  std::vector<int32_t> tmp_token_bitmask_cache_key_;
+  std::unordered_map<std::pair<int32_t, int32_t>, int32_t> tmp_context_node_ids_;
+  std::vector<std::pair<int32_t, int32_t>> tmp_context_nodes_;
+};
+
+/*!
+ * \brief The task queue of one worker in BatchGrammarMatcher. The owner takes the tasks from the
+ * front, and the other workers steal from the back when their own queues are drained.
+ */
+class WorkStealingTaskQueue {
+ public:
+  /*! \brief Add a task. Should only be called before the workers start. */
+  void Push(int32_t task_id) {
+    task_ids_.push_back(task_id);
+    end_ = static_cast<int32_t>(task_ids_.size());
+  }
+
+  /*! \brief Take the next task of the owner. Returns -1 if the queue is empty. */
+  int32_t PopFront() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return begin_ < end_ ? task_ids_[begin_++] : -1;
+  }
+
+  /*! \brief Steal the last task. Returns -1 if the queue is empty. */
+  int32_t PopBack() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return begin_ < end_ ? task_ids_[--end_] : -1;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<int32_t> task_ids_;
+  int32_t begin_ = 0;
+  int32_t end_ = 0;
+};
+
+/*!
+ * \brief Keeps the first exception thrown by the tasks of a parallel run of BatchGrammarMatcher.
+ * The workers of the thread pool do not catch exceptions, so a task that throws on a worker would
+ * terminate the program. The exception is rethrown in the calling thread after the run instead.
+ */
+class TaskErrorCollector {
+ public:
+  /*! \brief Run the task, and keep its exception if it is the first one. */
+  template <typename Task>
+  void Run(const Task& task, int32_t task_id) {
+    try {
+      task(task_id);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (error_ == nullptr) {
+        error_ = std::current_exception();
+      }
+    }
+  }
+
+  /*! \brief Rethrow the first exception, if any. Should only be called after the run. */
+  void RethrowIfAny() {
+    if (error_ != nullptr) {
+      std::rethrow_exception(error_);
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::exception_ptr error_ = nullptr;
 };
 
 class BatchGrammarMatcher::Impl {
@@ -460,7 +693,50 @@ class BatchGrammarMatcher::Impl {
       bool debug_print
   );
 
+  std::vector<uint8_t> BatchAcceptTokenParallel(
+      std::vector<GrammarMatcher>* matchers, const std::vector<int32_t>& token_ids, bool debug_print
+  );
+
+  std::vector<uint8_t> BatchAcceptStringParallel(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<std::string>& input_strs,
+      bool debug_print
+  );
+
+  std::vector<uint8_t> BatchAcceptTokenAndFillNextTokenBitmask(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<int32_t>& token_ids,
+      DLTensor* next_token_bitmask,
+      const std::optional<std::vector<int32_t>>& indices,
+      bool debug_print
+  );
+
+  std::vector<int32_t> BatchFindLongestAcceptedPrefix(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<std::vector<int32_t>>& token_ids,
+      bool debug_print
+  );
+
  private:
+  /*!
+   * \brief Run task(i) for every i in [0, num_tasks) on the thread pool and wait for all of them.
+   * The pool is created on the first call and kept alive, so its workers stay parked between the
+   * calls instead of being spawned and joined in every decoding step. Each worker pulls the next
+   * task id from a shared counter. If tasks throw, the first exception is rethrown once all the
+   * tasks are done.
+   */
+  template <typename Task>
+  void ParallelRun(int32_t num_tasks, const Task& task);
+
+  /*!
+   * \brief Run task(i) for every i on the thread pool, where costs[i] estimates the time of task i.
+   * The tasks are assigned largest-first to the least loaded worker, and a worker that drains its
+   * own queue steals the remaining tasks of the others. So one expensive task starts early instead
+   * of serializing the tail of the batch.
+   */
+  template <typename Task>
+  void ParallelRunByCost(const std::vector<int64_t>& costs, const Task& task);
+
   std::optional<ThreadPool> thread_pool_ = std::nullopt;
   int32_t max_threads_ = 1;
 };
@@ -473,7 +749,7 @@ bool GrammarMatcher::Impl::AcceptStopToken() {
     return false;
   }
   XGRAMMAR_DCHECK(!stop_token_is_accepted_);
-  token_length_history.push_back(0);
+  token_length_history.PushBack(0);
   stop_token_is_accepted_ = true;
   return true;
 }
@@ -544,7 +820,7 @@ bool GrammarMatcher::Impl::AcceptToken(int32_t token_id, bool debug_print) {
     }
     ++pos;
   }
-  token_length_history.push_back(token.size());
+  token_length_history.PushBack(static_cast<int32_t>(token.size()));
 
   if (debug_print) {
     XGRAMMAR_LOG(INFO) << "Token #" << token_id << "<"
@@ -583,7 +859,7 @@ bool GrammarMatcher::Impl::AcceptString(const std::string& input_str, bool debug
     }
     ++accepted_cnt;
   }
-  token_length_history.push_back(input_str.size());
+  token_length_history.PushBack(static_cast<int32_t>(input_str.size()));
 
   if (debug_print) {
     XGRAMMAR_LOG(INFO) << "String \"" << EscapeString(input_str) << "\" is accepted.";
@@ -621,6 +897,80 @@ bool GrammarMatcher::Impl::IsTokenBitmaskAllTrue(int32_t* bitmask_data_ptr) {
   return next_token_bitset.All();
 }
 
+int64_t GrammarMatcher::Impl::EstimateFillNextTokenBitmaskCost() const {
+  if (IsStopTokenAccepted()) {
+    return 0;
+  }
+  int64_t cost = 0;
+  for (const auto& state : scanable_state_history_[scanable_state_history_.size() - 1]) {
+    ++cost;
+    // Only look up the masks here: a lazy mask is computed by the task that fills the bitmask, and
+    // until then it is assumed to be as costly as scanning the whole vocabulary.
+    bool is_pending;
+    if (auto adaptive_token_mask = compiled_grammar_->FindAdaptiveTokenMask(state, &is_pending)) {
+      cost += adaptive_token_mask->NumUncertainTokens();
+    } else if (is_pending) {
+      cost += tokenizer_info_.GetVocabSize();
+    }
+  }
+  return cost;
+}
+
+void GrammarMatcher::Impl::BuildTokenBitmaskCacheKey(
+    const std::vector<ParserState>& latest_states, std::vector<int32_t>* key
+) {
+  key->clear();
+  tmp_context_node_ids_.clear();
+  tmp_context_nodes_.clear();
+
+  key->push_back(IsCompleted());
+  key->push_back(static_cast<int32_t>(stop_token_ids_.size()));
+  key->insert(key->end(), stop_token_ids_.begin(), stop_token_ids_.end());
+
+  auto add_state = [&](const ParserState& state) {
+    key->insert(
+        key->end(),
+        {state.rule_id,
+         state.sequence_id,
+         state.element_id,
+         state.sub_element_id,
+         state.repeat_count,
+         state.partial_codepoint}
+    );
+    if (state.rule_start_pos == ParserState::kNoPrevInputPos) {
+      key->push_back(-1);
+      return;
+    }
+    auto node = std::make_pair(state.rule_start_pos, state.rule_id);
+    auto [it, inserted] =
+        tmp_context_node_ids_.try_emplace(node, static_cast<int32_t>(tmp_context_nodes_.size()));
+    if (inserted) {
+      tmp_context_nodes_.push_back(node);
+    }
+    key->push_back(it->second);
+  };
+
+  key->push_back(static_cast<int32_t>(latest_states.size()));
+  for (const auto& state : latest_states) {
+    add_state(state);
+  }
+  // Visit the nodes in BFS order. The nodes are appended while visiting.
+  for (int32_t i = 0; i < static_cast<int32_t>(tmp_context_nodes_.size()); ++i) {
+    auto [rule_start_pos, rule_id] = tmp_context_nodes_[i];
+    const auto& parent_states = rule_id_to_completable_states_[rule_start_pos];
+    int32_t num_parents = 0;
+    for (const auto& [ref_rule_id, parent_state] : parent_states) {
+      num_parents += ref_rule_id == rule_id;
+    }
+    key->push_back(num_parents);
+    for (const auto& [ref_rule_id, parent_state] : parent_states) {
+      if (ref_rule_id == rule_id) {
+        add_state(parent_state);
+      }
+    }
+  }
+}
+
 bool GrammarMatcher::Impl::FillNextTokenBitmask(
     DLTensor* next_token_bitmask, int index, bool debug_print
 ) {
@@ -631,7 +981,6 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
       CheckAndGetBitmaskPtr(*next_token_bitmask, tokenizer_info_.GetVocabSize(), index);
   const auto& sorted_decoded_vocab = tokenizer_info_.GetSortedDecodedVocab();
   const auto& subtree_range = tokenizer_info_.GetTrieSubtreeNodesRange();
-  const auto& adaptive_token_mask_cache = compiled_grammar_->adaptive_token_mask_cache;
   // We need to have a copy, because scanable_state_history_ will be modified during the
   // FillNextTokenBitmask process, which can lead to undefined behavior.
   auto latest_states = GetLatestScanableStates();
@@ -651,25 +1000,71 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
                        << ", num of states=" << latest_states.size();
   }
 
-  std::vector<std::pair<ParserState, decltype(adaptive_token_mask_cache.cbegin())>>
-      latest_states_with_masks;
-
+  tmp_latest_masks_.clear();
+  int64_t num_uncertain_tokens = 0;
   for (const auto& state : latest_states) {
-    auto adaptive_token_mask_it = adaptive_token_mask_cache.find(state);
-    XGRAMMAR_CHECK(adaptive_token_mask_it != adaptive_token_mask_cache.end()) << state;
-    const auto& adaptive_token_mask = adaptive_token_mask_it->second;
-    latest_states_with_masks.push_back(std::make_pair(state, adaptive_token_mask_it));
+    auto adaptive_token_mask = compiled_grammar_->GetAdaptiveTokenMask(state);
+    XGRAMMAR_CHECK(adaptive_token_mask != nullptr) << state;
+    tmp_latest_masks_.push_back(adaptive_token_mask);
+    num_uncertain_tokens += adaptive_token_mask->NumUncertainTokens();
+  }
+
+  // Fast path: no mask depends on the parent states, so no parser work is needed, and the bitmask
+  // is the union of the accepted sets minus the intersection of the rejected sets. Both are
+  // combined word-wise in bitsets indexed by token id.
+  if (num_uncertain_tokens == 0) {
+    return FillCertainTokenBitmask(bitmask_data_ptr, latest_states, debug_print);
+  }
+
+  // Checking the uncertain tokens is the expensive part, so the result is cached when there are
+  // uncertain tokens. Otherwise, the bitmask is a cheap union of the precomputed masks.
+  auto* token_bitmask_cache = compiled_grammar_->token_bitmask_cache.get();
+  bool use_token_bitmask_cache = token_bitmask_cache != nullptr && !debug_print;
+  if (use_token_bitmask_cache) {
+    BuildTokenBitmaskCacheKey(latest_states, &tmp_token_bitmask_cache_key_);
+    if (auto entry = token_bitmask_cache->Get(tmp_token_bitmask_cache_key_)) {
+      std::copy(entry->bitmask.begin(), entry->bitmask.end(), bitmask_data_ptr);
+      return entry->need_apply;
+    }
+  }
+
+  for (const auto* adaptive_token_mask_ptr : tmp_latest_masks_) {
+    const auto& adaptive_token_mask = *adaptive_token_mask_ptr;
     if (adaptive_token_mask.store_type == StoreType::kAcceptedBitset) {
       tmp_accepted_bitset_ |= adaptive_token_mask.accepted_bitset;
     } else if (adaptive_token_mask.store_type == StoreType::kAccepted) {
       for (auto idx : adaptive_token_mask.accepted_indices) {
         tmp_accepted_bitset_.Set(sorted_decoded_vocab[idx].first, true);
       }
+    } else if (adaptive_token_mask.store_type == StoreType::kAcceptedRuns) {
+      for (const auto& [begin, end] : adaptive_token_mask.index_runs) {
+        for (int32_t idx = begin; idx < end; ++idx) {
+          tmp_accepted_bitset_.Set(sorted_decoded_vocab[idx].first, true);
+        }
+      }
     }
   }
 
-  for (const auto& [state, adaptive_token_mask_it] : latest_states_with_masks) {
-    const auto& adaptive_token_mask = adaptive_token_mask_it->second;
+  for (size_t state_id = 0; state_id < latest_states.size(); ++state_id) {
+    const auto& state = latest_states[state_id];
+    const auto& adaptive_token_mask = *tmp_latest_masks_[state_id];
+    bool is_rejected_type = adaptive_token_mask.store_type == StoreType::kRejected ||
+                            adaptive_token_mask.store_type == StoreType::kRejectedRuns;
+
+    // The mask of the state does not depend on the parent states, so it is used as is without any
+    // parser work.
+    if (adaptive_token_mask.NumUncertainTokens() == 0) {
+      if (debug_print) {
+        XGRAMMAR_LOG(INFO) << "The ParserState is " << state << ", the mask is "
+                           << adaptive_token_mask.Print(tokenizer_info_);
+      }
+      if (adaptive_token_mask.store_type == StoreType::kRejected) {
+        IntsetIntersection(&tmp_rejected_indices_, adaptive_token_mask.rejected_indices);
+      } else if (adaptive_token_mask.store_type == StoreType::kRejectedRuns) {
+        IntsetIntersectionWithRuns(&tmp_rejected_indices_, adaptive_token_mask.index_runs);
+      }
+      continue;
+    }
 
     // For each ParserState, we will check every uncertain token and put them into the accepted or
     // rejected list.
@@ -692,7 +1087,9 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
                          << adaptive_token_mask.Print(tokenizer_info_);
     }
     int last_rejected_uncertain_range = 0;
-    for (const auto& cur_token_idx : adaptive_token_mask.uncertain_indices) {
+    const auto& uncertain_indices =
+        adaptive_token_mask.GetUncertainIndices(&tmp_mask_uncertain_indices_);
+    for (const auto& cur_token_idx : uncertain_indices) {
       // Check if the current token is already accepted. If it is, we can skip it.
       if (tmp_accepted_bitset_[sorted_decoded_vocab[cur_token_idx].first]) {
         continue;
@@ -701,7 +1098,7 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
       // Check if the current token is in the rejected range. i.e. check if the current token
       // is on the subtree of the rejected token.
       if (cur_token_idx < last_rejected_uncertain_range) {
-        if (adaptive_token_mask.store_type == StoreType::kRejected) {
+        if (is_rejected_type) {
           tmp_rejected_indices_delta_.push_back(cur_token_idx);
         }
         continue;
@@ -740,8 +1137,7 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
       }
 
       // Step 2.3. Push the result to the delta list.
-      if (adaptive_token_mask.store_type == StoreType::kAcceptedBitset ||
-          adaptive_token_mask.store_type == StoreType::kAccepted) {
+      if (!is_rejected_type) {
         if (accepted) {
           tmp_accepted_bitset_.Set(sorted_decoded_vocab[cur_token_idx].first, true);
         }
@@ -756,12 +1152,17 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
 
     PopLastStates(prev_matched_size + 1);
     // Step 3. Update the accepted_indices or rejected_indices
+    // rejected_indices = Intersect(
+    //     rejected_indices,
+    //     adaptive_token_mask.rejected_indices + rejected_indices_delta)
     if (adaptive_token_mask.store_type == StoreType::kRejected) {
-      // rejected_indices = Intersect(
-      //     rejected_indices,
-      //     adaptive_token_mask.rejected_indices + rejected_indices_delta)
       IntsetUnion(&tmp_rejected_indices_delta_, adaptive_token_mask.rejected_indices);
       IntsetIntersection(&tmp_rejected_indices_, tmp_rejected_indices_delta_);
+    } else if (adaptive_token_mask.store_type == StoreType::kRejectedRuns) {
+      // The runs are intersected without expanding them into indices.
+      IntsetIntersectionWithRuns(
+          &tmp_rejected_indices_, adaptive_token_mask.index_runs, tmp_rejected_indices_delta_
+      );
     }
   }
 
@@ -773,7 +1174,16 @@ bool GrammarMatcher::Impl::FillNextTokenBitmask(
   if (debug_print) {
     XGRAMMAR_LOG(INFO) << "Filled bitmask: " << PrintBitmask(bitmask_data_ptr, tokenizer_info_);
   }
-  return !IsTokenBitmaskAllTrue(bitmask_data_ptr);
+  bool need_apply = !IsTokenBitmaskAllTrue(bitmask_data_ptr);
+  if (use_token_bitmask_cache) {
+    token_bitmask_cache->Put(
+        tmp_token_bitmask_cache_key_,
+        bitmask_data_ptr,
+        GetBitmaskSize(tokenizer_info_.GetVocabSize()),
+        need_apply
+    );
+  }
+  return need_apply;
 }
 
 std::string GrammarMatcher::Impl::FindJumpForwardString() {
@@ -880,16 +1290,266 @@ std::string GrammarMatcher::Impl::FindJumpForwardString() {
   return result;
 }
 
+int32_t GrammarMatcher::Impl::FindLongestAcceptedPrefix(
+    const std::vector<int32_t>& token_ids, bool debug_print
+) {
+  // The tokens are advanced as in AcceptToken, but without pushing to token_length_history, and
+  // the parser is restored to the checkpoint afterwards.
+  EarleyParser::CheckpointGuard guard(this);
+  const auto& decoded_vocab = tokenizer_info_.GetDecodedVocab();
+  const auto& special_token_ids = tokenizer_info_.GetSpecialTokenIds();
+  int32_t num_accepted = 0;
+  for (int32_t token_id : token_ids) {
+    if (IsStopTokenAccepted() || token_id < 0 || token_id >= tokenizer_info_.GetVocabSize()) {
+      break;
+    }
+    if (std::find(stop_token_ids_.begin(), stop_token_ids_.end(), token_id) !=
+        stop_token_ids_.end()) {
+      if (terminate_without_stop_token_ || !IsCompleted()) {
+        break;
+      }
+      stop_token_is_accepted_ = true;
+      ++num_accepted;
+      continue;
+    }
+    if (std::find(special_token_ids.begin(), special_token_ids.end(), token_id) !=
+        special_token_ids.end()) {
+      break;
+    }
+    // The rows of a partially accepted token are dropped when restoring the checkpoint.
+    bool accepted = true;
+    for (auto char_value : decoded_vocab[token_id]) {
+      if (!Advance(char_value, debug_print)) {
+        accepted = false;
+        break;
+      }
+    }
+    if (!accepted) {
+      break;
+    }
+    ++num_accepted;
+  }
+  return num_accepted;
+}
+
+std::vector<uint8_t> GrammarMatcher::Impl::TraverseDraftTree(
+    const std::vector<int32_t>& draft_tokens,
+    const std::vector<int32_t>& parent_indices,
+    DLTensor* next_token_bitmask,
+    bool debug_print
+) {
+  int32_t num_nodes = static_cast<int32_t>(draft_tokens.size());
+  XGRAMMAR_CHECK(static_cast<int32_t>(parent_indices.size()) == num_nodes)
+      << "The draft_tokens and parent_indices must have the same length";
+  XGRAMMAR_CHECK(num_nodes > 0 && parent_indices[0] == -1)
+      << "The node 0 of the draft tree must be the root, whose parent index is -1";
+
+  // Store the children of each node in CSR format: children[children_begin[i]] to
+  // children[children_begin[i + 1] - 1] are the children of node i.
+  std::vector<int32_t> children_begin(num_nodes + 1, 0);
+  for (int32_t i = 1; i < num_nodes; ++i) {
+    XGRAMMAR_CHECK(parent_indices[i] >= -1 && parent_indices[i] < num_nodes)
+        << "The parent index of node " << i << " is out of bounds: " << parent_indices[i];
+    if (parent_indices[i] != -1) {
+      ++children_begin[parent_indices[i] + 1];
+    }
+  }
+  for (int32_t i = 0; i < num_nodes; ++i) {
+    children_begin[i + 1] += children_begin[i];
+  }
+  std::vector<int32_t> children(children_begin[num_nodes]);
+  std::vector<int32_t> children_end(children_begin.begin(), children_begin.end() - 1);
+  for (int32_t i = 1; i < num_nodes; ++i) {
+    if (parent_indices[i] != -1) {
+      children[children_end[parent_indices[i]]++] = i;
+    }
+  }
+  std::vector<uint8_t> accepted(num_nodes, 0);
+  accepted[0] = 1;
+  if (IsStopTokenAccepted()) {
+    return accepted;
+  }
+  // The tokens are advanced as in FindLongestAcceptedPrefix, and the characters of a node are
+  // popped when the walk leaves it. The guard restores the parser if the walk throws.
+  EarleyParser::CheckpointGuard guard(this);
+  FillNextTokenBitmask(next_token_bitmask, 0, debug_print);
+
+  int32_t vocab_size = tokenizer_info_.GetVocabSize();
+  const auto& decoded_vocab = tokenizer_info_.GetDecodedVocab();
+  const auto& special_token_ids = tokenizer_info_.GetSpecialTokenIds();
+
+  // A node on the current path of the DFS.
+  struct PathNode {
+    int32_t node;
+    // The position of the next child to visit in children.
+    int32_t next_child_pos;
+    // The number of characters advanced for the token of the node.
+    int32_t num_chars;
+  };
+  std::vector<PathNode> stack = {{0, children_begin[0], 0}};
+  while (!stack.empty()) {
+    auto [node, child_pos, num_chars] = stack.back();
+    if (child_pos == children_begin[node + 1]) {
+      stack.pop_back();
+      if (num_chars > 0) {
+        PopLastStates(num_chars);
+      }
+      continue;
+    }
+    ++stack.back().next_child_pos;
+    int32_t child = children[child_pos];
+    int32_t token_id = draft_tokens[child];
+    const int32_t* parent_bitmask = CheckAndGetBitmaskPtr(*next_token_bitmask, vocab_size, node);
+    if (token_id < 0 || token_id >= vocab_size ||
+        ((parent_bitmask[token_id / 32] >> (token_id % 32)) & 1) == 0) {
+      continue;
+    }
+
+    // A node with the stop token accepts it as in AcceptStopToken. It has no bitmask, and rejects
+    // all its children, so it isn't pushed to the stack.
+    if (std::find(stop_token_ids_.begin(), stop_token_ids_.end(), token_id) !=
+        stop_token_ids_.end()) {
+      if (!terminate_without_stop_token_ && IsCompleted()) {
+        accepted[child] = 1;
+      }
+      continue;
+    }
+    if (std::find(special_token_ids.begin(), special_token_ids.end(), token_id) !=
+        special_token_ids.end()) {
+      continue;
+    }
+
+    const auto& token = decoded_vocab[token_id];
+    int32_t pos = 0;
+    while (pos < static_cast<int32_t>(token.size()) && Advance(token[pos], debug_print)) {
+      ++pos;
+    }
+    if (pos < static_cast<int32_t>(token.size())) {
+      PopLastStates(pos);
+      continue;
+    }
+    accepted[child] = 1;
+    FillNextTokenBitmask(next_token_bitmask, child, debug_print);
+    stack.push_back({child, children_begin[child], pos});
+  }
+  return accepted;
+}
+
 void GrammarMatcher::Impl::Rollback(int num_tokens) {
   XGRAMMAR_CHECK(num_tokens <= static_cast<int>(token_length_history.size()))
       << "Intended to rollback " << num_tokens << " tokens, but only the last "
       << token_length_history.size() << " steps of history are saved";
-  while (num_tokens > 0) {
-    int steps = token_length_history.back();
-    PopLastStates(steps);
-    token_length_history.pop_back();
-    --num_tokens;
+  if (num_tokens == 0) {
+    return;
+  }
+  // The characters of all the tokens are popped at once.
+  int32_t steps = 0;
+  for (int i = 0; i < num_tokens; ++i) {
+    steps += token_length_history[token_length_history.size() - 1 - i];
   }
+  PopLastStates(steps);
+  token_length_history.PopBack(num_tokens);
+}
+
+GrammarMatcher::Checkpoint GrammarMatcher::Impl::Snapshot() const {
+  auto parser_checkpoint = EarleyParser::Snapshot();
+  return GrammarMatcher::Checkpoint{
+      parser_checkpoint.num_rows,
+      parser_checkpoint.epoch_id,
+      static_cast<int32_t>(token_length_history.size()),
+      parser_checkpoint.stop_token_is_accepted
+  };
+}
+
+void GrammarMatcher::Impl::Restore(const GrammarMatcher::Checkpoint& checkpoint) {
+  XGRAMMAR_CHECK(checkpoint.num_tokens <= static_cast<int32_t>(token_length_history.size()))
+      << "The checkpoint is no longer valid, since the tokens it saved have been rolled back";
+  EarleyParser::Restore(EarleyParser::Checkpoint{
+      checkpoint.num_history_rows, checkpoint.history_epoch_id, checkpoint.is_terminated
+  });
+  token_length_history.PopBack(token_length_history.size() - checkpoint.num_tokens);
+}
+
+bool GrammarMatcher::Impl::FillCertainTokenBitmask(
+    int32_t* bitmask_data_ptr, const std::vector<ParserState>& latest_states, bool debug_print
+) {
+  const auto& sorted_decoded_vocab = tokenizer_info_.GetSortedDecodedVocab();
+  bool has_rejected_mask = false;
+  for (size_t state_id = 0; state_id < latest_states.size(); ++state_id) {
+    const auto& adaptive_token_mask = *tmp_latest_masks_[state_id];
+    if (debug_print) {
+      XGRAMMAR_LOG(INFO) << "The ParserState is " << latest_states[state_id] << ", the mask is "
+                         << adaptive_token_mask.Print(tokenizer_info_);
+    }
+    switch (adaptive_token_mask.store_type) {
+      case StoreType::kAcceptedBitset:
+        tmp_accepted_bitset_ |= adaptive_token_mask.accepted_bitset;
+        break;
+      case StoreType::kAccepted:
+        for (auto idx : adaptive_token_mask.accepted_indices) {
+          tmp_accepted_bitset_.Set(sorted_decoded_vocab[idx].first, true);
+        }
+        break;
+      case StoreType::kAcceptedRuns:
+        for (const auto& [begin, end] : adaptive_token_mask.index_runs) {
+          for (int32_t idx = begin; idx < end; ++idx) {
+            tmp_accepted_bitset_.Set(sorted_decoded_vocab[idx].first, true);
+          }
+        }
+        break;
+      case StoreType::kRejected:
+      case StoreType::kRejectedRuns: {
+        // The first rejected set is collected in place, and the later ones are intersected in.
+        auto* rejected_bitset =
+            has_rejected_mask ? &tmp_mask_rejected_bitset_ : &tmp_rejected_bitset_;
+        rejected_bitset->Reset();
+        if (adaptive_token_mask.store_type == StoreType::kRejected) {
+          for (auto idx : adaptive_token_mask.rejected_indices) {
+            rejected_bitset->Set(sorted_decoded_vocab[idx].first, true);
+          }
+        } else {
+          for (const auto& [begin, end] : adaptive_token_mask.index_runs) {
+            for (int32_t idx = begin; idx < end; ++idx) {
+              rejected_bitset->Set(sorted_decoded_vocab[idx].first, true);
+            }
+          }
+        }
+        if (has_rejected_mask) {
+          tmp_rejected_bitset_ &= tmp_mask_rejected_bitset_;
+        }
+        has_rejected_mask = true;
+        break;
+      }
+    }
+  }
+
+  bool can_reach_end = IsCompleted();
+  if (!has_rejected_mask) {
+    SetTokenBitmask(
+        bitmask_data_ptr, tmp_accepted_bitset_, tmp_rejected_indices_, can_reach_end, false
+    );
+  } else {
+    // next_token_bitmask = ~rejected | accepted, without the special tokens, and without the stop
+    // tokens if the end can not be reached. This matches SetTokenBitmask for rejected indices.
+    DynamicBitset next_token_bitset(
+        tokenizer_info_.GetVocabSize(), reinterpret_cast<uint32_t*>(bitmask_data_ptr)
+    );
+    next_token_bitset = tmp_rejected_bitset_;
+    next_token_bitset.Flip();
+    next_token_bitset |= tmp_accepted_bitset_;
+    for (int id : tokenizer_info_.GetSpecialTokenIds()) {
+      next_token_bitset.Set(id, false);
+    }
+    if (!can_reach_end) {
+      for (int id : stop_token_ids_) {
+        next_token_bitset.Set(id, false);
+      }
+    }
+  }
+  if (debug_print) {
+    XGRAMMAR_LOG(INFO) << "Filled bitmask: " << PrintBitmask(bitmask_data_ptr, tokenizer_info_);
+  }
+  return !IsTokenBitmaskAllTrue(bitmask_data_ptr);
 }
 
 void GrammarMatcher::Impl::SetTokenBitmask(
@@ -974,6 +1634,89 @@ int GrammarMatcher::Impl::GetNextUncertainToken(
   }
 }
 
+template <typename Task>
+void BatchGrammarMatcher::Impl::ParallelRun(int32_t num_tasks, const Task& task) {
+  int32_t num_workers = std::min(max_threads_, num_tasks);
+  if (num_workers <= 1) {
+    for (int32_t i = 0; i < num_tasks; ++i) {
+      task(i);
+    }
+    return;
+  }
+  if (!thread_pool_.has_value()) {
+    thread_pool_.emplace(max_threads_);
+  }
+  std::atomic<int32_t> next_task_id{0};
+  TaskErrorCollector errors;
+  for (int32_t i = 0; i < num_workers; ++i) {
+    thread_pool_->Execute([&task, &next_task_id, &errors, num_tasks]() {
+      for (int32_t task_id = next_task_id.fetch_add(1, std::memory_order_relaxed);
+           task_id < num_tasks;
+           task_id = next_task_id.fetch_add(1, std::memory_order_relaxed)) {
+        errors.Run(task, task_id);
+      }
+    });
+  }
+  thread_pool_->Wait();
+  errors.RethrowIfAny();
+}
+
+template <typename Task>
+void BatchGrammarMatcher::Impl::ParallelRunByCost(
+    const std::vector<int64_t>& costs, const Task& task
+) {
+  int32_t num_tasks = static_cast<int32_t>(costs.size());
+  int32_t num_workers = std::min(max_threads_, num_tasks);
+  if (num_workers <= 1) {
+    ParallelRun(num_tasks, task);
+    return;
+  }
+  if (!thread_pool_.has_value()) {
+    thread_pool_.emplace(max_threads_);
+  }
+
+  std::vector<int32_t> order(num_tasks);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [&](int32_t lhs, int32_t rhs) {
+    return costs[lhs] > costs[rhs];
+  });
+
+  // Longest-processing-time-first assignment: every task goes to the least loaded worker. The
+  // estimated cost of each task is increased by one to account for the fixed overhead.
+  std::vector<WorkStealingTaskQueue> queues(num_workers);
+  std::priority_queue<
+      std::pair<int64_t, int32_t>,
+      std::vector<std::pair<int64_t, int32_t>>,
+      std::greater<>>
+      worker_loads;
+  for (int32_t i = 0; i < num_workers; ++i) {
+    worker_loads.emplace(0, i);
+  }
+  for (auto task_id : order) {
+    auto [load, worker_id] = worker_loads.top();
+    worker_loads.pop();
+    queues[worker_id].Push(task_id);
+    worker_loads.emplace(load + costs[task_id] + 1, worker_id);
+  }
+
+  TaskErrorCollector errors;
+  for (int32_t i = 0; i < num_workers; ++i) {
+    thread_pool_->Execute([&task, &queues, &errors, num_workers, i]() {
+      for (int32_t task_id = queues[i].PopFront(); task_id != -1; task_id = queues[i].PopFront()) {
+        errors.Run(task, task_id);
+      }
+      for (int32_t offset = 1; offset < num_workers; ++offset) {
+        auto& victim = queues[(i + offset) % num_workers];
+        for (int32_t task_id = victim.PopBack(); task_id != -1; task_id = victim.PopBack()) {
+          errors.Run(task, task_id);
+        }
+      }
+    });
+  }
+  thread_pool_->Wait();
+  errors.RethrowIfAny();
+}
+
 void BatchGrammarMatcher::Impl::BatchFillNextTokenBitmask(
     std::vector<GrammarMatcher>* matchers,
     DLTensor* next_token_bitmask,
@@ -983,34 +1726,23 @@ void BatchGrammarMatcher::Impl::BatchFillNextTokenBitmask(
   XGRAMMAR_CHECK(!indices.has_value() || indices->size() == matchers->size())
       << "The size of indices (" << (indices.has_value() ? indices->size() : 0)
       << ") should be the same as the size of matchers (" << matchers->size() << ").";
-  // Initialize the thread pool if needed. It should be initialized each time,
-  // because ThreadPool cannot be reused after Join().
-  if (max_threads_ > 1) {
-    thread_pool_.emplace(max_threads_);
+  auto fill_next_token_mask = [&](int32_t batch_id) {
+    auto& matcher = (*matchers)[batch_id];
+    int index = indices.has_value() ? (*indices)[batch_id] : batch_id;
+    XGRAMMAR_CHECK(index >= 0 && index < next_token_bitmask->shape[0])
+        << "The index " << index << " is out of range [0, " << next_token_bitmask->shape[0]
+        << ") for batch_id " << batch_id << ".";
+    matcher->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
+  };
+  if (std::min(max_threads_, static_cast<int32_t>(matchers->size())) <= 1) {
+    ParallelRun(static_cast<int32_t>(matchers->size()), fill_next_token_mask);
+    return;
   }
-  if (!thread_pool_.has_value()) {
-    for (int i = 0; i < static_cast<int32_t>(matchers->size()); i++) {
-      auto& matcher = (*matchers)[i];
-      int index = indices.has_value() ? (*indices)[i] : i;
-      XGRAMMAR_CHECK(index >= 0 && index < next_token_bitmask->shape[0])
-          << "The index " << index << " is out of range [0, " << next_token_bitmask->shape[0]
-          << ") for batch_id " << i << ".";
-      matcher->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
-    }
-  } else {
-    auto fill_next_token_mask = [&](int32_t batch_id) {
-      auto& matcher = (*matchers)[batch_id];
-      int index = indices.has_value() ? (*indices)[batch_id] : batch_id;
-      XGRAMMAR_CHECK(index >= 0 && index < next_token_bitmask->shape[0])
-          << "The index " << index << " is out of range [0, " << next_token_bitmask->shape[0]
-          << ") for batch_id " << batch_id << ".";
-      matcher->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
-    };
-    for (int i = 0; i < static_cast<int32_t>(matchers->size()); i++) {
-      thread_pool_->Execute([fill_next_token_mask, i]() { fill_next_token_mask(i); });
-    }
-    thread_pool_->Join();
+  std::vector<int64_t> costs(matchers->size());
+  for (int32_t i = 0; i < static_cast<int32_t>(matchers->size()); ++i) {
+    costs[i] = (*matchers)[i]->EstimateFillNextTokenBitmaskCost();
   }
+  ParallelRunByCost(costs, fill_next_token_mask);
 }
 
 std::vector<uint8_t> BatchGrammarMatcher::Impl::BatchAcceptString(
@@ -1043,6 +1775,104 @@ std::vector<uint8_t> BatchGrammarMatcher::Impl::BatchAcceptToken(
   return accepted;
 }
 
+std::vector<uint8_t> BatchGrammarMatcher::Impl::BatchAcceptStringParallel(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<std::string>& input_strs,
+    bool debug_print
+) {
+  XGRAMMAR_CHECK(matchers->size() == input_strs.size())
+      << "The size of matchers (" << matchers->size() << ") and input_strs (" << input_strs.size()
+      << ") should be the same.";
+  std::vector<uint8_t> accepted(matchers->size());
+  auto accept_string = [&](int32_t batch_id) {
+    accepted[batch_id] = (*matchers)[batch_id]->AcceptString(input_strs[batch_id], debug_print);
+  };
+  // The time to accept a string grows with its length, which can vary a lot in the batch, e.g.
+  // for jump-forward strings.
+  std::vector<int64_t> costs(input_strs.size());
+  for (int32_t i = 0; i < static_cast<int32_t>(input_strs.size()); ++i) {
+    costs[i] = static_cast<int64_t>(input_strs[i].size());
+  }
+  ParallelRunByCost(costs, accept_string);
+  return accepted;
+}
+
+std::vector<uint8_t> BatchGrammarMatcher::Impl::BatchAcceptTokenParallel(
+    std::vector<GrammarMatcher>* matchers, const std::vector<int32_t>& token_ids, bool debug_print
+) {
+  XGRAMMAR_CHECK(matchers->size() == token_ids.size())
+      << "The size of matchers (" << matchers->size() << ") and token_ids (" << token_ids.size()
+      << ") should be the same.";
+  std::vector<uint8_t> accepted(matchers->size());
+  auto accept_token = [&](int32_t batch_id) {
+    accepted[batch_id] = (*matchers)[batch_id]->AcceptToken(token_ids[batch_id], debug_print);
+  };
+  ParallelRun(static_cast<int32_t>(matchers->size()), accept_token);
+  return accepted;
+}
+
+std::vector<int32_t> BatchGrammarMatcher::Impl::BatchFindLongestAcceptedPrefix(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<std::vector<int32_t>>& token_ids,
+    bool debug_print
+) {
+  XGRAMMAR_CHECK(matchers->size() == token_ids.size())
+      << "The size of matchers (" << matchers->size() << ") and token_ids (" << token_ids.size()
+      << ") should be the same.";
+  std::vector<int32_t> num_accepted(matchers->size());
+  std::vector<int64_t> costs(matchers->size());
+  for (int32_t i = 0; i < static_cast<int32_t>(matchers->size()); ++i) {
+    costs[i] = static_cast<int64_t>(token_ids[i].size());
+  }
+  auto find_prefix = [&](int32_t batch_id) {
+    num_accepted[batch_id] =
+        (*matchers)[batch_id]->FindLongestAcceptedPrefix(token_ids[batch_id], debug_print);
+  };
+  ParallelRunByCost(costs, find_prefix);
+  return num_accepted;
+}
+
+std::vector<uint8_t> BatchGrammarMatcher::Impl::BatchAcceptTokenAndFillNextTokenBitmask(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<int32_t>& token_ids,
+    DLTensor* next_token_bitmask,
+    const std::optional<std::vector<int32_t>>& indices,
+    bool debug_print
+) {
+  XGRAMMAR_CHECK(matchers->size() == token_ids.size())
+      << "The size of matchers (" << matchers->size() << ") and token_ids (" << token_ids.size()
+      << ") should be the same.";
+  XGRAMMAR_CHECK(!indices.has_value() || indices->size() == matchers->size())
+      << "The size of indices (" << (indices.has_value() ? indices->size() : 0)
+      << ") should be the same as the size of matchers (" << matchers->size() << ").";
+  std::vector<uint8_t> accepted(matchers->size());
+  auto accept_and_fill = [&](int32_t batch_id) {
+    auto& matcher = (*matchers)[batch_id];
+    int index = indices.has_value() ? (*indices)[batch_id] : batch_id;
+    XGRAMMAR_CHECK(index >= 0 && index < next_token_bitmask->shape[0])
+        << "The index " << index << " is out of range [0, " << next_token_bitmask->shape[0]
+        << ") for batch_id " << batch_id << ".";
+    accepted[batch_id] = matcher->AcceptToken(token_ids[batch_id], debug_print);
+    // A matcher that only completed the grammar can still accept a stop token, so its bitmask is
+    // filled as BatchFillNextTokenBitmask would.
+    if (!matcher->IsStopTokenAccepted()) {
+      matcher->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
+    }
+  };
+  if (std::min(max_threads_, static_cast<int32_t>(matchers->size())) <= 1) {
+    ParallelRun(static_cast<int32_t>(matchers->size()), accept_and_fill);
+    return accepted;
+  }
+  // The cost of the current state is a good estimate of the next one, since accepting one token
+  // changes the scanable states only slightly.
+  std::vector<int64_t> costs(matchers->size());
+  for (int32_t i = 0; i < static_cast<int32_t>(matchers->size()); ++i) {
+    costs[i] = (*matchers)[i]->EstimateFillNextTokenBitmaskCost();
+  }
+  ParallelRunByCost(costs, accept_and_fill);
+  return accepted;
+}
+
 GrammarMatcher::GrammarMatcher(
     const CompiledGrammar& compiled_grammar,
     std::optional<std::vector<int>> override_stop_tokens,
@@ -1067,10 +1897,44 @@ bool GrammarMatcher::FillNextTokenBitmask(
   return pimpl_->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
 }
 
+std::shared_future<bool> GrammarMatcher::FillNextTokenBitmaskAsync(
+    DLTensor* next_token_bitmask, int index, bool debug_print
+) {
+  // Hold the pimpl so the matcher outlives the task.
+  return GetAsyncMaskThreadPool().Submit(
+      [pimpl = pimpl_, next_token_bitmask, index, debug_print]() {
+        return pimpl->FillNextTokenBitmask(next_token_bitmask, index, debug_print);
+      }
+  );
+}
+
+int32_t GrammarMatcher::FindLongestAcceptedPrefix(
+    const std::vector<int32_t>& token_ids, bool debug_print
+) {
+  return pimpl_->FindLongestAcceptedPrefix(token_ids, debug_print);
+}
+
+std::vector<uint8_t> GrammarMatcher::TraverseDraftTree(
+    const std::vector<int32_t>& draft_tokens,
+    const std::vector<int32_t>& parent_indices,
+    DLTensor* next_token_bitmask,
+    bool debug_print
+) {
+  return pimpl_->TraverseDraftTree(draft_tokens, parent_indices, next_token_bitmask, debug_print);
+}
+
 std::string GrammarMatcher::FindJumpForwardString() { return pimpl_->FindJumpForwardString(); }
 
 void GrammarMatcher::Rollback(int num_tokens) { pimpl_->Rollback(num_tokens); }
 
+GrammarMatcher GrammarMatcher::Fork() const {
+  return GrammarMatcher(std::make_shared<Impl>(pimpl_.get()));
+}
+
+GrammarMatcher::Checkpoint GrammarMatcher::Snapshot() const { return pimpl_->Snapshot(); }
+
+void GrammarMatcher::Restore(const Checkpoint& checkpoint) { pimpl_->Restore(checkpoint); }
+
 bool GrammarMatcher::IsTerminated() const { return pimpl_->IsTerminated(); }
 
 void GrammarMatcher::Reset() { pimpl_->Reset(); }
@@ -1094,6 +1958,21 @@ void BatchGrammarMatcher::BatchFillNextTokenBitmask(
   return pimpl_->BatchFillNextTokenBitmask(matchers, next_token_bitmask, indices, debug_print);
 }
 
+std::shared_future<void> BatchGrammarMatcher::BatchFillNextTokenBitmaskAsync(
+    std::vector<GrammarMatcher>* matchers,
+    DLTensor* next_token_bitmask,
+    const std::optional<std::vector<int32_t>>& indices,
+    bool debug_print
+) {
+  // The batch is dispatched from the async pool rather than the pool of the batch matcher, since
+  // the dispatching task waits for the whole pool of the batch matcher to be idle.
+  return GetAsyncMaskThreadPool().Submit(
+      [pimpl = pimpl_, matchers, next_token_bitmask, indices, debug_print]() {
+        pimpl->BatchFillNextTokenBitmask(matchers, next_token_bitmask, indices, debug_print);
+      }
+  );
+}
+
 std::vector<uint8_t> BatchGrammarMatcher::BatchAcceptString(
     std::vector<GrammarMatcher>* matchers,
     const std::vector<std::string>& input_strs,
@@ -1108,6 +1987,40 @@ std::vector<uint8_t> BatchGrammarMatcher::BatchAcceptToken(
   return Impl::BatchAcceptToken(matchers, token_ids, debug_print);
 }
 
+std::vector<uint8_t> BatchGrammarMatcher::BatchAcceptStringParallel(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<std::string>& input_strs,
+    bool debug_print
+) {
+  return pimpl_->BatchAcceptStringParallel(matchers, input_strs, debug_print);
+}
+
+std::vector<uint8_t> BatchGrammarMatcher::BatchAcceptTokenParallel(
+    std::vector<GrammarMatcher>* matchers, const std::vector<int32_t>& token_ids, bool debug_print
+) {
+  return pimpl_->BatchAcceptTokenParallel(matchers, token_ids, debug_print);
+}
+
+std::vector<uint8_t> BatchGrammarMatcher::BatchAcceptTokenAndFillNextTokenBitmask(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<int32_t>& token_ids,
+    DLTensor* next_token_bitmask,
+    const std::optional<std::vector<int32_t>>& indices,
+    bool debug_print
+) {
+  return pimpl_->BatchAcceptTokenAndFillNextTokenBitmask(
+      matchers, token_ids, next_token_bitmask, indices, debug_print
+  );
+}
+
+std::vector<int32_t> BatchGrammarMatcher::BatchFindLongestAcceptedPrefix(
+    std::vector<GrammarMatcher>* matchers,
+    const std::vector<std::vector<int32_t>>& token_ids,
+    bool debug_print
+) {
+  return pimpl_->BatchFindLongestAcceptedPrefix(matchers, token_ids, debug_print);
+}
+
 BatchGrammarMatcher::BatchGrammarMatcher(std::variant<std::string, int32_t> max_threads)
     : pimpl_(std::make_shared<BatchGrammarMatcher::Impl>(max_threads)) {}
 
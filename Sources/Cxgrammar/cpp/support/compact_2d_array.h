@@ -7,8 +7,12 @@
 
 #include <picojson.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include "logging.h"
@@ -245,6 +249,213 @@ XGRAMMAR_MEMBER_TABLE_TEMPLATE(
     &Compact2DArray<DataType>::indptr_
 );
 
+/*! \brief The type of the elements of the storage of a SharedPrefixArray. */
+template <typename Rows>
+struct SharedPrefixArrayElement;
+
+template <typename DataType>
+struct SharedPrefixArrayElement<Compact2DArray<DataType>> {
+  using type = DataType;
+};
+
+template <typename DataType>
+struct SharedPrefixArrayElement<std::vector<DataType>> {
+  using type = DataType;
+};
+
+/*!
+ * \brief An array of rows, stored in a Compact2DArray or a std::vector, whose leading rows can be
+ * shared with its forks. Rows are only appended or popped at the end, so the rows present at a
+ * fork are immutable in both copies. The rows are kept in a chain of segments, from the latest to
+ * the earliest one, and a fork shares the chain with its parent. A segment is only modified by
+ * the array owning it alone: when the latest segment is shared, the next row goes to a new
+ * segment. So Fork() is const, takes O(1) time and memory, and can be called concurrently.
+ * Popping into the shared rows only moves the boundary of the visible rows.
+ *
+ * \details Accessing a row walks the chain, so the chain is kept short: a new segment starts with
+ * a copy of the latest segments when they hold at least half as many rows as the segment below
+ * them. Each row is copied O(log n) times by the pushes after forks, and the chain has O(log n)
+ * segments, where n is the number of rows. Only the latest row can be extended by
+ * PushBackInLatestRow, and it must be pushed after the last fork.
+ *
+ * \tparam Rows The storage of the rows, Compact2DArray<DataType> or std::vector<DataType>.
+ */
+template <typename Rows>
+class SharedPrefixArray {
+ public:
+  /*! \brief The type of the elements stored in the array. */
+  using DataType = typename SharedPrefixArrayElement<Rows>::type;
+
+  /*! \brief The type of a row returned by the storage. */
+  using Row = decltype(std::declval<const Rows&>()[0]);
+
+  /*! \brief The value type is Row. */
+  using value_type = Row;
+
+  /*! \brief Get the number of rows. */
+  int32_t size() const { return num_rows_; }
+
+  /*! \brief Access the i-th row. */
+  Row operator[](int32_t i) const {
+    XGRAMMAR_DCHECK(i >= 0 && i < num_rows_)
+        << "SharedPrefixArray index " << i << " is out of bound";
+    const Segment* segment = latest_.get();
+    while (i < segment->begin_row) {
+      segment = segment->prev.get();
+    }
+    return segment->rows[i - segment->begin_row];
+  }
+
+  Row Back() const { return (*this)[num_rows_ - 1]; }
+
+  /*!
+   * \brief Insert a new row, with the arguments of Compact2DArray::PushBack or a std::vector
+   * element.
+   * \return The index of the newly inserted row.
+   */
+  template <typename... Args>
+  int32_t PushBack(Args&&... args) {
+    AppendRow(GetOwnedRows(), std::forward<Args>(args)...);
+    return num_rows_++;
+  }
+
+  /*!
+   * \brief Push back a new element in the latest row of a Compact2DArray, which must not be
+   * shared.
+   */
+  void PushBackInLatestRow(const DataType& new_data) {
+    XGRAMMAR_DCHECK(
+        latest_ != nullptr && latest_.use_count() == 1 && latest_->begin_row < num_rows_ &&
+        NumRows(latest_->rows) == num_rows_ - latest_->begin_row
+    ) << "Cannot push back in a shared row";
+    latest_->rows.PushBackInLatestRow(new_data);
+  }
+
+  /*! \brief Pop back the last cnt rows. */
+  void PopBack(int32_t cnt) {
+    num_rows_ -= cnt;
+    while (latest_ != nullptr && latest_->begin_row > num_rows_) {
+      latest_ = latest_->prev;
+    }
+  }
+
+  /*! \brief Get a copy that shares all the current rows with this array, in O(1). */
+  SharedPrefixArray Fork() const { return *this; }
+
+ private:
+  /*! \brief A segment of rows, holding rows [begin_row, begin_row + rows.size()). */
+  struct Segment {
+    /*! \brief The segment holding the rows before begin_row. */
+    std::shared_ptr<Segment> prev;
+    int32_t begin_row;
+    Rows rows;
+  };
+
+  template <typename T>
+  static int32_t NumRows(const Compact2DArray<T>& rows) {
+    return rows.size();
+  }
+
+  template <typename T>
+  static int32_t NumRows(const std::vector<T>& rows) {
+    return static_cast<int32_t>(rows.size());
+  }
+
+  template <typename T>
+  static void TruncateRows(Compact2DArray<T>* rows, int32_t num_rows) {
+    rows->PopBack(rows->size() - num_rows);
+  }
+
+  template <typename T>
+  static void TruncateRows(std::vector<T>* rows, int32_t num_rows) {
+    rows->resize(num_rows);
+  }
+
+  template <typename T, typename... Args>
+  static void AppendRow(Compact2DArray<T>* rows, Args&&... args) {
+    rows->PushBack(std::forward<Args>(args)...);
+  }
+
+  template <typename T, typename Arg>
+  static void AppendRow(std::vector<T>* rows, Arg&& value) {
+    rows->push_back(std::forward<Arg>(value));
+  }
+
+  /*!
+   * \brief Get the rows of the latest segment to append to, which this array owns alone. The rows
+   * after the visible ones, left by PopBack, are dropped.
+   */
+  Rows* GetOwnedRows() {
+    if (latest_ != nullptr && latest_.use_count() == 1) {
+      // Pairs with the release of the references dropped by other threads, so their reads of the
+      // segment happen before it is modified.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (NumRows(latest_->rows) > num_rows_ - latest_->begin_row) {
+        TruncateRows(&latest_->rows, num_rows_ - latest_->begin_row);
+      }
+      return &latest_->rows;
+    }
+    if (latest_ != nullptr && latest_->begin_row == num_rows_) {
+      latest_ = latest_->prev;
+    }
+    StartSegment();
+    return &latest_->rows;
+  }
+
+  /*! \brief Start a new latest segment, merging the latest segments into it if they are small. */
+  void StartSegment() {
+    // Find the earliest segment to merge. The latest segments are merged with the segment below
+    // them when they hold at least half as many rows, so the sizes of the segments in the chain
+    // halve from the earliest to the latest one.
+    const Segment* first = nullptr;
+    for (const Segment* segment = latest_.get(); segment != nullptr && segment->prev != nullptr;
+         segment = segment->prev.get()) {
+      int32_t num_rows_below = segment->begin_row - segment->prev->begin_row;
+      if ((num_rows_ - segment->begin_row) * 2 < num_rows_below) {
+        break;
+      }
+      first = segment->prev.get();
+    }
+    auto segment = std::make_shared<Segment>();
+    if (first == nullptr) {
+      segment->prev = latest_;
+      segment->begin_row = num_rows_;
+    } else {
+      segment->prev = first->prev;
+      segment->begin_row = first->begin_row;
+      std::vector<const Segment*> merged;
+      for (const Segment* s = latest_.get(); s != first->prev.get(); s = s->prev.get()) {
+        merged.push_back(s);
+      }
+      int32_t end_row = num_rows_;
+      std::vector<int32_t> end_rows;
+      for (const Segment* s : merged) {
+        end_rows.push_back(end_row);
+        end_row = s->begin_row;
+      }
+      for (int32_t i = static_cast<int32_t>(merged.size()) - 1; i >= 0; --i) {
+        for (int32_t row = merged[i]->begin_row; row < end_rows[i]; ++row) {
+          AppendRow(&segment->rows, merged[i]->rows[row - merged[i]->begin_row]);
+        }
+      }
+    }
+    latest_ = std::move(segment);
+  }
+
+  /*! \brief The latest segment. Only its rows before num_rows_ are visible. */
+  std::shared_ptr<Segment> latest_;
+  /*! \brief The number of visible rows. */
+  int32_t num_rows_ = 0;
+};
+
+/*! \brief A Compact2DArray whose leading rows can be shared with its forks. */
+template <typename DataType = int32_t>
+using SharedPrefixCompact2DArray = SharedPrefixArray<Compact2DArray<DataType>>;
+
+/*! \brief A std::vector whose leading elements can be shared with its forks. */
+template <typename DataType>
+using SharedPrefixVector = SharedPrefixArray<std::vector<DataType>>;
+
 }  // namespace xgrammar
 
 #endif  // XGRAMMAR_SUPPORT_COMPACT_2D_ARRAY_H_
@@ -21,6 +21,7 @@
 
 #include "json_serializer.h"
 #include "logging.h"
+#include "utils.h"
 
 namespace xgrammar {
 
@@ -163,6 +164,23 @@ class DynamicBitset {
     return *this;
   }
 
+  /*! \brief Perform a bitwise AND operation between the current bitset and another bitset. */
+  DynamicBitset& operator&=(const DynamicBitset& other) {
+    XGRAMMAR_DCHECK(buffer_size_ <= other.buffer_size_);
+    for (int i = 0; i < buffer_size_; ++i) {
+      data_[i] &= other.data_[i];
+    }
+    return *this;
+  }
+
+  /*! \brief Flip every bit of the bitset. */
+  void Flip() {
+    XGRAMMAR_DCHECK(data_);
+    for (int i = 0; i < buffer_size_; ++i) {
+      data_[i] = ~data_[i];
+    }
+  }
+
   int FindFirstOne() const { return DoFindOneFrom(0); }
 
   int FindNextOne(int pos) const {
@@ -279,6 +297,8 @@ class DynamicBitset {
     return true;
   }
 
+  friend struct std::hash<DynamicBitset>;
+
  private:
   static int LowestBit(uint32_t value) {
 #ifdef __GNUC__
@@ -340,4 +360,22 @@ class DynamicBitset {
 
 }  // namespace xgrammar
 
+namespace std {
+
+/*!
+ * \brief Define the hash function for DynamicBitset by its size and content.
+ */
+template <>
+struct hash<xgrammar::DynamicBitset> {
+  size_t operator()(const xgrammar::DynamicBitset& bitset) const noexcept {
+    size_t seed = std::hash<int>{}(bitset.size_);
+    for (int i = 0; i < bitset.buffer_size_; ++i) {
+      xgrammar::HashCombineBinary(seed, std::hash<uint32_t>{}(bitset.data_[i]));
+    }
+    return seed;
+  }
+};
+
+}  // namespace std
+
 #endif  // XGRAMMAR_SUPPORT_DYNAMIC_BITSET_H_
@@ -9,6 +9,7 @@
 #include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <utility>
 #include <vector>
 
 namespace xgrammar {
@@ -83,6 +84,55 @@ inline void IntsetIntersection(std::vector<int32_t>* lhs, const std::vector<int3
   lhs->erase(it_result, lhs->end());
 }
 
+/*!
+ * \brief Let lhs be the intersection of lhs and the union of the [begin, end) runs and extra.
+ * Suppose that all of them are sorted, and that the runs do not overlap.
+ * \note The runs are not expanded, and the time complexity is O(n + number of runs), unless lhs is
+ * the universal set {-1}. Then the result is the union itself, which is written to lhs directly.
+ */
+inline void IntsetIntersectionWithRuns(
+    std::vector<int32_t>* lhs,
+    const std::vector<std::pair<int32_t, int32_t>>& runs,
+    const std::vector<int32_t>& extra = {}
+) {
+  auto it_run = runs.begin();
+  auto it_extra = extra.begin();
+
+  if (lhs->size() == 1 && (*lhs)[0] == -1) {
+    lhs->clear();
+    for (; it_run != runs.end(); ++it_run) {
+      for (; it_extra != extra.end() && *it_extra < it_run->first; ++it_extra) {
+        lhs->push_back(*it_extra);
+      }
+      for (int32_t i = it_run->first; i < it_run->second; ++i) {
+        lhs->push_back(i);
+      }
+      while (it_extra != extra.end() && *it_extra < it_run->second) {
+        ++it_extra;
+      }
+    }
+    lhs->insert(lhs->end(), it_extra, extra.end());
+    return;
+  }
+
+  auto it_result = lhs->begin();
+  for (auto it_lhs = lhs->begin(); it_lhs != lhs->end(); ++it_lhs) {
+    auto value = *it_lhs;
+    while (it_run != runs.end() && it_run->second <= value) {
+      ++it_run;
+    }
+    while (it_extra != extra.end() && *it_extra < value) {
+      ++it_extra;
+    }
+    if ((it_run != runs.end() && it_run->first <= value) ||
+        (it_extra != extra.end() && *it_extra == value)) {
+      *it_result = value;
+      ++it_result;
+    }
+  }
+  lhs->erase(it_result, lhs->end());
+}
+
 }  // namespace xgrammar
 
 #endif  // XGRAMMAR_SUPPORT_INT_SET_H_
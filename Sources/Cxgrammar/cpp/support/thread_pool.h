@@ -124,6 +124,17 @@ class ThreadPool {
    * before shutdown completes.
    */
   void Join() {
+    Shutdown();
+    for (std::thread& worker : workers_) {
+      if (worker.joinable()) worker.join();  // Wait for thread to finish
+    }
+  }
+
+  /*!
+   * \brief Stop accepting new tasks without waiting. The threads exit once the remaining tasks in
+   * the queue are executed, and are joined by Join() or the destructor.
+   */
+  void Shutdown() {
     {
       std::unique_lock<std::mutex> lock(queue_mutex_);
       if (shutdown_) return;  // Already shut down
@@ -131,9 +142,6 @@ class ThreadPool {
     }
 
     queue_condition_.notify_all();  // Wake up all threads so they can exit
-    for (std::thread& worker : workers_) {
-      if (worker.joinable()) worker.join();  // Wait for thread to finish
-    }
   }
 
   /*!
@@ -57,68 +57,6 @@ std::string _PrintGrammarFSMs(const Grammar& grammar) {
   return result;
 }
 
-namespace details {
-
-void DFS(
-    int32_t curr,
-    int32_t parent_pos,
-    const int64_t* retrieve_next_token,
-    const int64_t* retrieve_next_sibling,
-    const int64_t* draft_tokens,
-    GrammarMatcher& matcher,
-    DLTensor* bitmask
-) {
-  int32_t* bitmask_data = reinterpret_cast<int32_t*>(bitmask->data);
-  int32_t bitmask_size = static_cast<int32_t>(bitmask->shape[1]);
-
-  bool accepted;
-  if (curr == 0) {
-    // The first token generated by the target model, always accepted
-    accepted = true;
-  } else {
-    int32_t curr_token_id = draft_tokens[curr];
-    int32_t* parent_bitmask = bitmask_data + parent_pos * bitmask_size;
-    // 32 boolean bitmask values are packed into 32-bit integers
-    accepted = (parent_bitmask[curr_token_id / 32] & (1 << (curr_token_id % 32))) != 0;
-  }
-
-  if (accepted) {
-    if (curr != 0) {
-      matcher.AcceptToken(draft_tokens[curr]);
-    }
-
-    if (!matcher.IsTerminated()) {
-      matcher.FillNextTokenBitmask(bitmask, curr);
-
-      if (retrieve_next_token[curr] != -1) {
-        DFS(retrieve_next_token[curr],
-            curr,
-            retrieve_next_token,
-            retrieve_next_sibling,
-            draft_tokens,
-            matcher,
-            bitmask);
-      }
-    }
-
-    if (curr != 0) {
-      matcher.Rollback(1);
-    }
-  }
-
-  if (retrieve_next_sibling[curr] != -1) {
-    DFS(retrieve_next_sibling[curr],
-        parent_pos,
-        retrieve_next_token,
-        retrieve_next_sibling,
-        draft_tokens,
-        matcher,
-        bitmask);
-  }
-}
-
-}  // namespace details
-
 void TraverseDraftTree(
     const DLTensor* retrieve_next_token,
     const DLTensor* retrieve_next_sibling,
@@ -142,15 +80,20 @@ void TraverseDraftTree(
   XGRAMMAR_CHECK(retrieve_next_token->shape[0] == draft_tokens->shape[0])
       << "The retrieve_next_token and draft_tokens tensors must have the same length";
 
-  details::DFS(
-      0,
-      -1,
-      reinterpret_cast<const int64_t*>(retrieve_next_token->data),
-      reinterpret_cast<const int64_t*>(retrieve_next_sibling->data),
-      reinterpret_cast<const int64_t*>(draft_tokens->data),
-      matcher,
-      bitmask
-  );
+  const int64_t* next_token_data = reinterpret_cast<const int64_t*>(retrieve_next_token->data);
+  const int64_t* next_sibling_data =
+      reinterpret_cast<const int64_t*>(retrieve_next_sibling->data);
+  const int64_t* draft_tokens_data = reinterpret_cast<const int64_t*>(draft_tokens->data);
+  int32_t num_nodes = static_cast<int32_t>(draft_tokens->shape[0]);
+  std::vector<int32_t> token_ids(draft_tokens_data, draft_tokens_data + num_nodes);
+  std::vector<int32_t> parent_indices(num_nodes, -1);
+  for (int32_t i = 0; i < num_nodes; ++i) {
+    // The children of a node are its first child and the siblings of the first child.
+    for (int64_t child = next_token_data[i]; child != -1; child = next_sibling_data[child]) {
+      parent_indices[child] = i;
+    }
+  }
+  matcher.TraverseDraftTree(token_ids, parent_indices, bitmask);
 }
 
 }  // namespace xgrammar
@@ -0,0 +1,102 @@
+/*!
+ *  Copyright (c) 2025 by Contributors
+ * \file xgrammar/token_bitmask_cache.h
+ * \brief The cache of the token bitmasks generated by the matchers of a compiled grammar.
+ */
+#ifndef XGRAMMAR_TOKEN_BITMASK_CACHE_H_
+#define XGRAMMAR_TOKEN_BITMASK_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "support/thread_safe_cache.h"
+#include "support/utils.h"
+
+namespace xgrammar {
+
+/*!
+ * \brief A thread-safe, size-bounded LRU cache from the matching context of a GrammarMatcher to
+ * the token bitmask it produces. It is owned by the compiled grammar and shared by all its
+ * matchers, so that a context that recurs, e.g. the beginning of every element of a JSON array,
+ * only computes the bitmask once.
+ * \details The key is an opaque integer sequence built by the matcher. It must determine the
+ * bitmask uniquely; see GrammarMatcher::Impl::BuildTokenBitmaskCacheKey.
+ */
+class TokenBitmaskCache {
+ public:
+  using Key = std::vector<int32_t>;
+
+  struct Entry {
+    /*! \brief The bitmask of one row. */
+    std::vector<int32_t> bitmask;
+    /*! \brief Whether the bitmask is not all-true, i.e. the result of FillNextTokenBitmask. */
+    bool need_apply;
+    /*! \brief The memory size of the entry and its key. */
+    std::size_t memory_size;
+  };
+
+  /*! \param max_memory_size The memory budget of the cache in bytes. */
+  explicit TokenBitmaskCache(std::size_t max_memory_size) : max_memory_size_(max_memory_size) {}
+
+  /*! \brief Get the cached entry, or nullptr if the key is not cached. */
+  std::shared_ptr<const Entry> Get(const Key& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& map = cache_.GetMap();
+    auto it = map.find(key);
+    if (it == map.end()) {
+      return nullptr;
+    }
+    return cache_.LRUVisit(*it);
+  }
+
+  /*!
+   * \brief Add an entry, and evict the least recently used entries if the memory budget is
+   * exceeded. Does nothing if the key is already cached, e.g. by another matcher.
+   */
+  void Put(const Key& key, const int32_t* bitmask, int32_t bitmask_size, bool need_apply) {
+    std::size_t memory_size = (key.size() + bitmask_size) * sizeof(int32_t) + sizeof(Entry);
+    if (memory_size > max_memory_size_) {
+      return;
+    }
+    auto entry = std::make_shared<const Entry>(
+        Entry{std::vector<int32_t>(bitmask, bitmask + bitmask_size), need_apply, memory_size}
+    );
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto [it, success] = cache_.GetMap().try_emplace(key);
+    if (!success) {
+      return;
+    }
+    cache_.LRUInit(*it, entry);
+    memory_size_ += memory_size;
+    cache_.LRUEvict(
+        [&] { return memory_size_ > max_memory_size_; },
+        [&](const std::shared_ptr<const Entry>& value) {
+          memory_size_ -= value->memory_size;
+          return true;
+        }
+    );
+  }
+
+  /*! \brief The memory size of all cached entries. */
+  std::size_t MemorySize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_size_;
+  }
+
+  std::size_t MaxMemorySize() const { return max_memory_size_; }
+
+ private:
+  mutable std::mutex mutex_;
+  details::LRUCacheImpl<Key, std::shared_ptr<const Entry>> cache_;
+  std::size_t memory_size_ = 0;
+  const std::size_t max_memory_size_;
+};
+
+}  // namespace xgrammar
+
+#endif  // XGRAMMAR_TOKEN_BITMASK_CACHE_H_
@@ -0,0 +1,344 @@
+/*!
+ *  Copyright (c) 2025 by Contributors
+ * \file xgrammar/token_bitmask_cpu.cc
+ * \brief The CPU kernels that apply a token bitmask to logits. Every 32-bit word of the bitmask is
+ * expanded into a lane mask over 32 logits, and the rejected lanes are overwritten with -inf.
+ */
+
+#include "token_bitmask_cpu.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+// Runtime dispatch between the x86 kernels relies on the target attribute and
+// __builtin_cpu_supports, which are available in GCC and Clang.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define XGRAMMAR_TOKEN_BITMASK_X86 1
+#include <immintrin.h>
+#else
+#define XGRAMMAR_TOKEN_BITMASK_X86 0
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define XGRAMMAR_TOKEN_BITMASK_NEON 1
+#include <arm_neon.h>
+#else
+#define XGRAMMAR_TOKEN_BITMASK_NEON 0
+#endif
+
+namespace xgrammar {
+
+namespace {
+
+constexpr int kBitsPerWord = 32;
+
+constexpr uint32_t kAllOnesWord = ~static_cast<uint32_t>(0);
+
+/*! \brief Get the mask of the valid bits in the last, partial word of a row. */
+inline uint32_t GetTailWordMask(int vocab_size) {
+  return (static_cast<uint32_t>(1) << (vocab_size % kBitsPerWord)) - 1;
+}
+
+inline int LowestBit(uint32_t value) {
+#ifdef __GNUC__
+  return __builtin_ctz(value);
+#else   // __GNUC__
+  int position = 0;
+  while (!(value & 1)) {
+    value >>= 1;
+    ++position;
+  }
+  return position;
+#endif  // __GNUC__
+}
+
+/*!
+ * \brief Write -inf to the logits of the rejected tokens of one word.
+ * \param rejected The bits of the rejected tokens, i.e. the inverted bitmask word.
+ */
+template <typename T>
+inline void ApplyRejectedBitsScalar(T* logits, uint32_t rejected, T minus_infinity) {
+  if (rejected == kAllOnesWord) {
+    std::fill_n(logits, kBitsPerWord, minus_infinity);
+    return;
+  }
+  while (rejected != 0) {
+    logits[LowestBit(rejected)] = minus_infinity;
+    rejected &= rejected - 1;
+  }
+}
+
+/*! \brief Handle the last, partial word of a row. Shared by all kernels. */
+template <typename T>
+inline void ApplyTailScalar(T* logits, const uint32_t* bitmask, int vocab_size, T minus_infinity) {
+  if (vocab_size % kBitsPerWord == 0) {
+    return;
+  }
+  int word_id = vocab_size / kBitsPerWord;
+  uint32_t rejected = ~bitmask[word_id] & GetTailWordMask(vocab_size);
+  ApplyRejectedBitsScalar(logits + word_id * kBitsPerWord, rejected, minus_infinity);
+}
+
+template <typename T>
+void ApplyRowScalar(T* logits, const uint32_t* bitmask, int vocab_size, T minus_infinity) {
+  int num_full_words = vocab_size / kBitsPerWord;
+  for (int i = 0; i < num_full_words; ++i) {
+    if (bitmask[i] == kAllOnesWord) {
+      continue;
+    }
+    ApplyRejectedBitsScalar(logits + i * kBitsPerWord, ~bitmask[i], minus_infinity);
+  }
+  ApplyTailScalar(logits, bitmask, vocab_size, minus_infinity);
+}
+
+void ApplyRowFloat32Scalar(float* logits, const uint32_t* bitmask, int vocab_size) {
+  ApplyRowScalar(logits, bitmask, vocab_size, -std::numeric_limits<float>::infinity());
+}
+
+void ApplyRow16BitsScalar(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+) {
+  ApplyRowScalar(logits, bitmask, vocab_size, minus_infinity);
+}
+
+#if XGRAMMAR_TOKEN_BITMASK_X86
+
+/******************* AVX-512 *******************/
+
+// AVX-512 supports masked stores, so a bitmask word is directly used as the store mask, and the
+// partial word at the end of the row does not need a scalar fallback.
+
+__attribute__((target("avx512f,avx512bw"))) void ApplyRowFloat32AVX512(
+    float* logits, const uint32_t* bitmask, int vocab_size
+) {
+  const __m512 minus_infinity = _mm512_set1_ps(-std::numeric_limits<float>::infinity());
+  int num_words = (vocab_size + kBitsPerWord - 1) / kBitsPerWord;
+  for (int i = 0; i < num_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (i == num_words - 1 && vocab_size % kBitsPerWord != 0) {
+      rejected &= GetTailWordMask(vocab_size);
+    }
+    if (rejected == 0) {
+      continue;
+    }
+    float* ptr = logits + i * kBitsPerWord;
+    if (rejected == kAllOnesWord) {
+      _mm512_storeu_ps(ptr, minus_infinity);
+      _mm512_storeu_ps(ptr + 16, minus_infinity);
+      continue;
+    }
+    _mm512_mask_storeu_ps(ptr, static_cast<__mmask16>(rejected & 0xFFFF), minus_infinity);
+    _mm512_mask_storeu_ps(ptr + 16, static_cast<__mmask16>(rejected >> 16), minus_infinity);
+  }
+}
+
+__attribute__((target("avx512f,avx512bw"))) void ApplyRow16BitsAVX512(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+) {
+  const __m512i minus_infinity_vec = _mm512_set1_epi16(static_cast<int16_t>(minus_infinity));
+  int num_words = (vocab_size + kBitsPerWord - 1) / kBitsPerWord;
+  for (int i = 0; i < num_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (i == num_words - 1 && vocab_size % kBitsPerWord != 0) {
+      rejected &= GetTailWordMask(vocab_size);
+    }
+    if (rejected == 0) {
+      continue;
+    }
+    if (rejected == kAllOnesWord) {
+      _mm512_storeu_si512(logits + i * kBitsPerWord, minus_infinity_vec);
+      continue;
+    }
+    _mm512_mask_storeu_epi16(
+        logits + i * kBitsPerWord, static_cast<__mmask32>(rejected), minus_infinity_vec
+    );
+  }
+}
+
+/******************* AVX2 *******************/
+
+// AVX2 has no masked store for 16-bit lanes, so the bits of a word are broadcast, compared with
+// the per-lane bit to get a lane mask, and blended with -inf.
+
+__attribute__((target("avx2"))) void ApplyRowFloat32AVX2(
+    float* logits, const uint32_t* bitmask, int vocab_size
+) {
+  const __m256 minus_infinity = _mm256_set1_ps(-std::numeric_limits<float>::infinity());
+  const __m256i lane_bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+  int num_full_words = vocab_size / kBitsPerWord;
+  for (int i = 0; i < num_full_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (rejected == 0) {
+      continue;
+    }
+    float* ptr = logits + i * kBitsPerWord;
+    for (int j = 0; j < 4; ++j) {
+      uint32_t bits = (rejected >> (j * 8)) & 0xFF;
+      if (bits == 0) {
+        continue;
+      }
+      if (bits == 0xFF) {
+        _mm256_storeu_ps(ptr + j * 8, minus_infinity);
+        continue;
+      }
+      __m256i lanes = _mm256_and_si256(_mm256_set1_epi32(static_cast<int32_t>(bits)), lane_bits);
+      __m256i lane_mask = _mm256_cmpeq_epi32(lanes, lane_bits);
+      _mm256_maskstore_ps(ptr + j * 8, lane_mask, minus_infinity);
+    }
+  }
+  ApplyTailScalar(logits, bitmask, vocab_size, -std::numeric_limits<float>::infinity());
+}
+
+__attribute__((target("avx2"))) void ApplyRow16BitsAVX2(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+) {
+  const __m256i minus_infinity_vec = _mm256_set1_epi16(static_cast<int16_t>(minus_infinity));
+  const __m256i lane_bits = _mm256_setr_epi16(
+      0x0001,
+      0x0002,
+      0x0004,
+      0x0008,
+      0x0010,
+      0x0020,
+      0x0040,
+      0x0080,
+      0x0100,
+      0x0200,
+      0x0400,
+      0x0800,
+      0x1000,
+      0x2000,
+      0x4000,
+      static_cast<int16_t>(0x8000)
+  );
+  int num_full_words = vocab_size / kBitsPerWord;
+  for (int i = 0; i < num_full_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (rejected == 0) {
+      continue;
+    }
+    uint16_t* ptr = logits + i * kBitsPerWord;
+    for (int j = 0; j < 2; ++j) {
+      uint32_t bits = (rejected >> (j * 16)) & 0xFFFF;
+      if (bits == 0) {
+        continue;
+      }
+      __m256i* lane_ptr = reinterpret_cast<__m256i*>(ptr + j * 16);
+      if (bits == 0xFFFF) {
+        _mm256_storeu_si256(lane_ptr, minus_infinity_vec);
+        continue;
+      }
+      __m256i lanes = _mm256_and_si256(_mm256_set1_epi16(static_cast<int16_t>(bits)), lane_bits);
+      __m256i lane_mask = _mm256_cmpeq_epi16(lanes, lane_bits);
+      __m256i values = _mm256_loadu_si256(lane_ptr);
+      _mm256_storeu_si256(lane_ptr, _mm256_blendv_epi8(values, minus_infinity_vec, lane_mask));
+    }
+  }
+  ApplyTailScalar(logits, bitmask, vocab_size, minus_infinity);
+}
+
+#endif  // XGRAMMAR_TOKEN_BITMASK_X86
+
+#if XGRAMMAR_TOKEN_BITMASK_NEON
+
+/******************* NEON *******************/
+
+void ApplyRowFloat32NEON(float* logits, const uint32_t* bitmask, int vocab_size) {
+  const float32x4_t minus_infinity = vdupq_n_f32(-std::numeric_limits<float>::infinity());
+  const uint32_t lane_bits_data[4] = {1, 2, 4, 8};
+  const uint32x4_t lane_bits = vld1q_u32(lane_bits_data);
+  int num_full_words = vocab_size / kBitsPerWord;
+  for (int i = 0; i < num_full_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (rejected == 0) {
+      continue;
+    }
+    float* ptr = logits + i * kBitsPerWord;
+    for (int j = 0; j < 8; ++j) {
+      uint32_t bits = (rejected >> (j * 4)) & 0xF;
+      if (bits == 0) {
+        continue;
+      }
+      if (bits == 0xF) {
+        vst1q_f32(ptr + j * 4, minus_infinity);
+        continue;
+      }
+      uint32x4_t lane_mask = vtstq_u32(vdupq_n_u32(bits), lane_bits);
+      vst1q_f32(ptr + j * 4, vbslq_f32(lane_mask, minus_infinity, vld1q_f32(ptr + j * 4)));
+    }
+  }
+  ApplyTailScalar(logits, bitmask, vocab_size, -std::numeric_limits<float>::infinity());
+}
+
+void ApplyRow16BitsNEON(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+) {
+  const uint16x8_t minus_infinity_vec = vdupq_n_u16(minus_infinity);
+  const uint16_t lane_bits_data[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+  const uint16x8_t lane_bits = vld1q_u16(lane_bits_data);
+  int num_full_words = vocab_size / kBitsPerWord;
+  for (int i = 0; i < num_full_words; ++i) {
+    uint32_t rejected = ~bitmask[i];
+    if (rejected == 0) {
+      continue;
+    }
+    uint16_t* ptr = logits + i * kBitsPerWord;
+    for (int j = 0; j < 4; ++j) {
+      uint16_t bits = static_cast<uint16_t>((rejected >> (j * 8)) & 0xFF);
+      if (bits == 0) {
+        continue;
+      }
+      if (bits == 0xFF) {
+        vst1q_u16(ptr + j * 8, minus_infinity_vec);
+        continue;
+      }
+      uint16x8_t lane_mask = vtstq_u16(vdupq_n_u16(bits), lane_bits);
+      vst1q_u16(ptr + j * 8, vbslq_u16(lane_mask, minus_infinity_vec, vld1q_u16(ptr + j * 8)));
+    }
+  }
+  ApplyTailScalar(logits, bitmask, vocab_size, minus_infinity);
+}
+
+#endif  // XGRAMMAR_TOKEN_BITMASK_NEON
+
+/******************* Runtime dispatch *******************/
+
+struct TokenBitmaskKernels {
+  void (*apply_row_float32)(float*, const uint32_t*, int);
+  void (*apply_row_16bits)(uint16_t*, const uint32_t*, int, uint16_t);
+};
+
+TokenBitmaskKernels SelectTokenBitmaskKernels() {
+#if XGRAMMAR_TOKEN_BITMASK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return {ApplyRowFloat32AVX512, ApplyRow16BitsAVX512};
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return {ApplyRowFloat32AVX2, ApplyRow16BitsAVX2};
+  }
+#elif XGRAMMAR_TOKEN_BITMASK_NEON
+  return {ApplyRowFloat32NEON, ApplyRow16BitsNEON};
+#endif
+  return {ApplyRowFloat32Scalar, ApplyRow16BitsScalar};
+}
+
+const TokenBitmaskKernels& GetTokenBitmaskKernels() {
+  static const TokenBitmaskKernels kernels = SelectTokenBitmaskKernels();
+  return kernels;
+}
+
+}  // namespace
+
+void ApplyTokenBitmaskRowFloat32(float* logits, const uint32_t* bitmask, int vocab_size) {
+  GetTokenBitmaskKernels().apply_row_float32(logits, bitmask, vocab_size);
+}
+
+void ApplyTokenBitmaskRow16Bits(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+) {
+  GetTokenBitmaskKernels().apply_row_16bits(logits, bitmask, vocab_size, minus_infinity);
+}
+
+}  // namespace xgrammar
@@ -0,0 +1,35 @@
+/*!
+ *  Copyright (c) 2025 by Contributors
+ * \file xgrammar/token_bitmask_cpu.h
+ * \brief The header for the CPU kernels that apply a token bitmask to logits.
+ */
+#ifndef XGRAMMAR_TOKEN_BITMASK_CPU_H_
+#define XGRAMMAR_TOKEN_BITMASK_CPU_H_
+
+#include <cstdint>
+
+namespace xgrammar {
+
+/*!
+ * \brief Set the logits of the tokens rejected by the bitmask to -inf.
+ * \param logits The logits of one row. It should have at least vocab_size elements.
+ * \param bitmask The bitmask of one row. It should have at least ceil(vocab_size / 32) elements.
+ * The i-th bit of the j-th element corresponds to the token 32 * j + i, and 0 means rejected.
+ * \param vocab_size The number of tokens to mask.
+ * \note The kernel is selected at runtime according to the instruction sets supported by the
+ * CPU: AVX-512 or AVX2 on x86, NEON on ARM, and a scalar fallback otherwise.
+ */
+void ApplyTokenBitmaskRowFloat32(float* logits, const uint32_t* bitmask, int vocab_size);
+
+/*!
+ * \brief The 16-bit version of ApplyTokenBitmaskRowFloat32. It works for both float16 and
+ * bfloat16 logits, since only the bit pattern of -inf differs.
+ * \param minus_infinity The bit pattern of -inf in the 16-bit floating point type.
+ */
+void ApplyTokenBitmaskRow16Bits(
+    uint16_t* logits, const uint32_t* bitmask, int vocab_size, uint16_t minus_infinity
+);
+
+}  // namespace xgrammar
+
+#endif  // XGRAMMAR_TOKEN_BITMASK_CPU_H_
@@ -7,6 +7,7 @@
 
 #include <picojson.h>
 
+#include <algorithm>
 #include <array>
 #include <memory>
 #include <optional>
@@ -259,6 +260,20 @@ class HFTokenizerAnalyzer {
   }
 };
 
+/************* VocabTrie *************/
+
+VocabTrie::VocabTrie(const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab) {
+  int num_tokens = sorted_decoded_vocab.size();
+  common_prefix_lengths_.resize(num_tokens, 0);
+  for (int i = 1; i < num_tokens; ++i) {
+    const auto& token = sorted_decoded_vocab[i].second;
+    const auto& prev_token = sorted_decoded_vocab[i - 1].second;
+    common_prefix_lengths_[i] =
+        std::mismatch(token.begin(), token.end(), prev_token.begin(), prev_token.end()).first -
+        token.begin();
+  }
+}
+
 /************* TokenizerInfo::Impl *************/
 
 bool TokenizerInfo::Impl::IsSpecialToken(const std::string& token) { return token == ""; }
@@ -315,6 +330,8 @@ TokenizerInfo::Impl::Impl(
     trie_subtree_nodes_range_[top_pair.second] = sorted_decoded_vocab_.size();
     prefix_stack.pop();
   }
+
+  BuildVocabTrie();
 }
 
 std::string TokenizerInfo::Impl::DumpMetadata() const {
@@ -494,6 +511,7 @@ std::variant<TokenizerInfo, SerializationError> TokenizerInfo::DeserializeJSON(
   if (auto err = AutoDeserializeJSON(&tokenizer_info, json_string, true, "TokenizerInfo")) {
     return err.value();
   }
+  tokenizer_info->BuildVocabTrie();
   return tokenizer_info;
 }
 
@@ -9,11 +9,45 @@
 #include <utility>
 #include <vector>
 
+#include "support/logging.h"
 #include "support/reflection.h"
 #include "xgrammar/tokenizer_info.h"
 
 namespace xgrammar {
 
+/*!
+ * \brief The byte trie of the sorted decoded vocabulary, stored as the length of the common prefix
+ * of each token and the previous token. Since the vocabulary is sorted, the tokens starting with a
+ * prefix are contiguous, and the common prefix lengths inside that range are at least the length
+ * of the prefix.
+ */
+class VocabTrie {
+ public:
+  VocabTrie() = default;
+
+  explicit VocabTrie(const std::vector<std::pair<int32_t, std::string>>& sorted_decoded_vocab);
+
+  /*! \brief The length of the common prefix of the token and the previous token. */
+  int32_t CommonPrefixLength(int32_t index) const { return common_prefix_lengths_[index]; }
+
+  /*!
+   * \brief The end of the range of the tokens that start with the first prefix_length bytes of the
+   * token. It takes time linear in the size of the range.
+   */
+  int32_t SubtreeEnd(int32_t index, int32_t prefix_length) const {
+    int32_t end = index + 1;
+    while (end < static_cast<int32_t>(common_prefix_lengths_.size()) &&
+           common_prefix_lengths_[end] >= prefix_length) {
+      ++end;
+    }
+    return end;
+  }
+
+ private:
+  /*! \brief The length of the common prefix of each token and the previous token. */
+  std::vector<int32_t> common_prefix_lengths_;
+};
+
 class TokenizerInfo::Impl {
  public:
   explicit Impl() = default;
@@ -36,6 +70,10 @@ class TokenizerInfo::Impl {
     return sorted_decoded_vocab_;
   }
   const std::vector<int32_t>& GetTrieSubtreeNodesRange() const { return trie_subtree_nodes_range_; }
+  const VocabTrie& GetVocabTrie() const { return vocab_trie_; }
+
+  /*! \brief Build the vocabulary trie, which is not serialized, from the sorted vocabulary. */
+  void BuildVocabTrie() { vocab_trie_ = VocabTrie(sorted_decoded_vocab_); }
 
   std::string DumpMetadata() const;
   picojson::value DumpMetadataValue() const;
@@ -68,6 +106,8 @@ class TokenizerInfo::Impl {
   /*! \brief A pesudo-trie. trie_subtree_nodes_range[i] stores how many nodes there are in the
    * subtree. */
   std::vector<int32_t> trie_subtree_nodes_range_;
+  /*! \brief The byte trie of sorted_decoded_vocab_. */
+  VocabTrie vocab_trie_;
   /*! \brief The stop tokens. When the GrammarMatcher can reach the end of the grammar,
    * stop tokens can be accepted. */
   std::vector<int32_t> stop_token_ids_;
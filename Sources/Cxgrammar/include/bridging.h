@@ -24,8 +24,29 @@ typedef struct xgrammar_grammar xgrammar_grammar;
 typedef struct xgrammar_compiled_grammar xgrammar_compiled_grammar;
 typedef struct xgrammar_grammar_compiler xgrammar_grammar_compiler;
 typedef struct xgrammar_grammar_matcher xgrammar_grammar_matcher;
+typedef struct xgrammar_batch_grammar_matcher xgrammar_batch_grammar_matcher;
+typedef struct xgrammar_bitmask_future xgrammar_bitmask_future;
 typedef struct xgrammar_tokenizer_info xgrammar_tokenizer_info;
 
+/// A saved state of a matcher. The fields are only meaningful to the matcher that created it
+/// and to its later forks.
+typedef struct {
+  int32_t num_history_rows;
+  int64_t history_epoch_id;
+  int32_t num_tokens;
+  bool is_terminated;
+} xgrammar_matcher_checkpoint;
+
+/// Counters of how the compiler obtained the token masks of a compiled grammar, for testing.
+typedef struct {
+  int32_t num_mask_states;
+  int32_t num_masks;
+  int32_t num_reused_states;
+  int32_t num_shared_rule_states;
+  int32_t num_fsm_walk_states;
+  int32_t num_vocab_chunks;
+} xgrammar_token_mask_compile_stats;
+
 /* ------------------------------------------------------------------ */
 /*  Enumerations                                                      */
 /* ------------------------------------------------------------------ */
@@ -127,6 +148,10 @@ xgrammar_tokenizer_info* xgrammar_compiled_grammar_get_tokenizer_info(
 
 size_t xgrammar_compiled_grammar_memory_size(const xgrammar_compiled_grammar* cg);
 
+xgrammar_token_mask_compile_stats xgrammar_compiled_grammar_token_mask_compile_stats(
+    const xgrammar_compiled_grammar* cg
+);
+
 /// Caller must free the returned string with xgrammar_free_string.
 char* xgrammar_compiled_grammar_serialize_json(const xgrammar_compiled_grammar* cg);
 
@@ -138,7 +163,11 @@ xgrammar_grammar_compiler* xgrammar_compiler_create(
     const xgrammar_tokenizer_info* tokenizer_info,
     int32_t max_threads,
     bool cache_enabled,
-    int64_t max_memory_bytes
+    int64_t max_memory_bytes,
+    bool token_masks_as_bitsets,
+    bool lazy_token_masks,
+    int64_t token_bitmask_cache_bytes,
+    bool reuse_rule_masks
 );
 
 void xgrammar_compiler_destroy(xgrammar_grammar_compiler* compiler);
@@ -189,6 +218,9 @@ xgrammar_grammar_matcher* xgrammar_matcher_create(
 
 void xgrammar_matcher_destroy(xgrammar_grammar_matcher* matcher);
 
+/// Returns a new matcher with the same state. The caller must destroy it.
+xgrammar_grammar_matcher* xgrammar_matcher_fork(const xgrammar_grammar_matcher* matcher);
+
 bool xgrammar_matcher_accept_token(xgrammar_grammar_matcher* matcher, int32_t token_id);
 
 bool xgrammar_matcher_accept_string(xgrammar_grammar_matcher* matcher, const char* str);
@@ -197,11 +229,40 @@ bool xgrammar_matcher_fill_next_token_bitmask(
     xgrammar_grammar_matcher* matcher, int32_t* bitmask_data, int32_t bitmask_count, int32_t index
 );
 
+int32_t xgrammar_matcher_find_longest_accepted_prefix(
+    xgrammar_grammar_matcher* matcher, const int32_t* token_ids, int32_t token_count
+);
+
+/// Verifies a tree of draft tokens. bitmask_data holds num_nodes rows of bitmask_count words, and
+/// out_accepted receives num_nodes values.
+void xgrammar_matcher_traverse_draft_tree(
+    xgrammar_grammar_matcher* matcher,
+    const int32_t* draft_tokens,
+    const int32_t* parent_indices,
+    int32_t num_nodes,
+    int32_t* bitmask_data,
+    int32_t bitmask_count,
+    bool* out_accepted
+);
+
+/// Starts filling one bitmask row of bitmask_count words on a background thread. The bitmask data
+/// must stay valid and the matcher must not be used until the returned future is waited for. The
+/// caller must destroy the future.
+xgrammar_bitmask_future* xgrammar_matcher_fill_next_token_bitmask_async(
+    xgrammar_grammar_matcher* matcher, int32_t* bitmask_data, int32_t bitmask_count
+);
+
 /// Caller must free the returned string with xgrammar_free_string.
 char* xgrammar_matcher_find_jump_forward_string(xgrammar_grammar_matcher* matcher);
 
 void xgrammar_matcher_rollback(xgrammar_grammar_matcher* matcher, int32_t num_tokens);
 
+xgrammar_matcher_checkpoint xgrammar_matcher_snapshot(const xgrammar_grammar_matcher* matcher);
+
+void xgrammar_matcher_restore(
+    xgrammar_grammar_matcher* matcher, xgrammar_matcher_checkpoint checkpoint
+);
+
 void xgrammar_matcher_reset(xgrammar_grammar_matcher* matcher);
 
 bool xgrammar_matcher_is_terminated(const xgrammar_grammar_matcher* matcher);
@@ -213,6 +274,84 @@ int32_t xgrammar_matcher_stop_token_id_at(const xgrammar_grammar_matcher* matche
 /// Caller must free the returned string with xgrammar_free_string.
 char* xgrammar_matcher_debug_print(const xgrammar_grammar_matcher* matcher);
 
+/* ------------------------------------------------------------------ */
+/*  Batch Grammar Matcher                                             */
+/* ------------------------------------------------------------------ */
+
+/// Creates a batch matcher running on up to max_threads threads. A non-positive max_threads
+/// selects the number of threads automatically.
+xgrammar_batch_grammar_matcher* xgrammar_batch_matcher_create(int32_t max_threads);
+
+void xgrammar_batch_matcher_destroy(xgrammar_batch_grammar_matcher* batch_matcher);
+
+/// Fills row i of the bitmask for matchers[i]. bitmask_data holds num_matchers rows of
+/// bitmask_count words.
+void xgrammar_batch_matcher_fill_next_token_bitmask(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count
+);
+
+/// Starts filling row i of the bitmask for matchers[i] on a background thread. The bitmask data
+/// must stay valid and the matchers must not be used until the returned future is waited for. The
+/// caller must destroy the future.
+xgrammar_bitmask_future* xgrammar_batch_matcher_fill_next_token_bitmask_async(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count
+);
+
+/// Accepts token_ids[i] in matchers[i] in parallel. out_accepted receives num_matchers values.
+void xgrammar_batch_matcher_accept_token(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    int32_t num_matchers,
+    bool* out_accepted
+);
+
+/// Accepts token_ids[i] in matchers[i] and then fills row i of the bitmask, in one pass over the
+/// batch. out_accepted receives num_matchers values.
+void xgrammar_batch_matcher_accept_token_and_fill_next_token_bitmask(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    int32_t num_matchers,
+    int32_t* bitmask_data,
+    int32_t bitmask_count,
+    bool* out_accepted
+);
+
+/// Finds the length of the longest prefix of a token sequence accepted by matchers[i], in
+/// parallel. The sequence of matcher i is token_counts[i] values of token_ids, after the sequences
+/// of the previous matchers. out_lengths receives num_matchers values. The matchers are unchanged.
+void xgrammar_batch_matcher_find_longest_accepted_prefix(
+    xgrammar_batch_grammar_matcher* batch_matcher,
+    xgrammar_grammar_matcher* const* matchers,
+    const int32_t* token_ids,
+    const int32_t* token_counts,
+    int32_t num_matchers,
+    int32_t* out_lengths
+);
+
+/* ------------------------------------------------------------------ */
+/*  Bitmask Future                                                    */
+/* ------------------------------------------------------------------ */
+
+/// Waits for an asynchronous fill. Returns false on failure; sets *out_error, which the caller
+/// must free with xgrammar_free_string. On success, sets *out_needs_apply to whether the bitmask
+/// rejects any token; a batch fill always sets it to true.
+bool xgrammar_bitmask_future_wait(
+    xgrammar_bitmask_future* future, bool* out_needs_apply, char** out_error
+);
+
+/// Waits for the fill if it is still running, and destroys the future.
+void xgrammar_bitmask_future_destroy(xgrammar_bitmask_future* future);
+
 /* ------------------------------------------------------------------ */
 /*  Tokenizer Info                                                    */
 /* ------------------------------------------------------------------ */
@@ -278,6 +417,30 @@ int32_t xgrammar_tokenizer_info_special_token_id_at(
 
 int32_t xgrammar_get_bitmask_size(int32_t vocab_size);
 
+/// Sets the logits of the tokens rejected by one row of a bitmask to -inf.
+/// Uses the SIMD kernels of the CPU when available.
+void xgrammar_apply_token_bitmask_inplace_cpu(
+    float* logits,
+    int32_t logits_count,
+    const int32_t* bitmask_data,
+    int32_t bitmask_count,
+    int32_t vocab_size
+);
+
+/// Sets the logits of the tokens rejected by a batch of bitmask rows to -inf.
+/// Row i of the bitmask masks the `vocab_size` logits starting at `i * logits_stride`.
+/// The rows, and the vocabulary of each row when it is large, are split among `num_threads`
+/// threads.
+void xgrammar_apply_token_bitmask_batch_inplace_cpu(
+    float* logits,
+    int32_t batch_size,
+    int32_t logits_stride,
+    const int32_t* bitmask_data,
+    int32_t bitmask_stride,
+    int32_t vocab_size,
+    int32_t num_threads
+);
+
 int32_t xgrammar_get_max_recursion_depth(void);
 void xgrammar_set_max_recursion_depth(int32_t depth);
 
@@ -63,12 +63,37 @@ class GrammarCompiler {
    * \param max_threads The maximum number of threads to use for compiling grammars.
    * \param cache_enabled Whether to enable the cache.
    * \param max_memory_bytes The maximum memory usage in bytes.
+   * \param token_masks_as_bitsets Whether to store every precomputed token mask as a bitset over
+   * the token ids, aligned to the token bitmask. Filling the next token bitmask then combines the
+   * masks with word-wise ORs instead of translating each token index, at the cost of
+   * ceil(vocab_size / 8) bytes per mask.
+   * \param lazy_token_masks Whether to compute the precomputed token masks lazily. Compiling then
+   * returns right after the grammar is analyzed, and the mask of each grammar position is computed
+   * once, when a matcher first reaches it. If max_threads > 1, the remaining masks are also
+   * computed by max_threads background threads, which exit once all the masks are computed. This
+   * shortens the time to the first token for grammars that are only used a few times. The cache
+   * charges such a grammar for its pending masks when adding it, counting each mask as a bitset
+   * over the vocabulary, which is usually an overestimate.
+   * \param token_bitmask_cache_bytes The memory budget in bytes of the cache of final token
+   * bitmasks in each compiled grammar, which is shared by its matchers. A matching context that
+   * recurs, e.g. the start of every element of a JSON array, then copies the cached bitmask instead
+   * of checking the uncertain tokens again. 0 disables the cache. The compiler cache charges each
+   * grammar for the full budget when adding it.
+   * \param reuse_rule_masks Whether a grammar that differs from the last compiled one in a few
+   * rules reuses the token masks of the unchanged rules instead of computing them again. The last
+   * compiled grammar is then kept until the next compilation or ClearCache(), unless it alone
+   * exceeds max_memory_bytes. It is kept outside the cache, so the memory usage can exceed
+   * max_memory_bytes by the size of that grammar.
    */
   GrammarCompiler(
       const TokenizerInfo& tokenizer_info,
       int max_threads = 8,
       bool cache_enabled = true,
-      int64_t max_memory_bytes = -1  // unlimited
+      int64_t max_memory_bytes = -1,  // unlimited
+      bool token_masks_as_bitsets = false,
+      bool lazy_token_masks = false,
+      int64_t token_bitmask_cache_bytes = 0,
+      bool reuse_rule_masks = false
   );
 
   /*! \brief Get the compiled grammar for a JSON schema string. */
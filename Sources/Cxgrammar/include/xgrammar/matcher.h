@@ -12,6 +12,7 @@
 #include <xgrammar/object.h>
 
 #include <cstdint>
+#include <future>
 #include <optional>
 #include <string>
 #include <variant>
@@ -29,11 +30,21 @@ void _DebugGetMaskedTokensFromBitmask(
 
 std::pair<bool, int> _IsSingleTokenBitmask(const DLTensor& bitmask, int vocab_size, int index);
 
+/*!
+ * \brief Set the logits of the tokens rejected by the bitmask to -inf, in place.
+ * \param logits The 1D or 2D logits tensor on CPU. Can be float32, float16 or bfloat16.
+ * \param bitmask The 1D or 2D int32 bitmask tensor on CPU.
+ * \param vocab_size The number of tokens to mask in each row.
+ * \param indices The rows to mask. If not provided, all rows are masked.
+ * \param num_threads The number of threads to use. The rows, and the vocabulary of each row when
+ * it is large, are split among the threads. Default is 1, i.e. mask in the calling thread.
+ */
 void ApplyTokenBitmaskInplaceCPU(
     DLTensor* logits,
     const DLTensor& bitmask,
     int vocab_size = -1,
-    std::optional<std::vector<int>> indices = std::nullopt
+    std::optional<std::vector<int>> indices = std::nullopt,
+    int num_threads = 1
 );
 
 /*!
@@ -110,6 +121,54 @@ class GrammarMatcher {
    */
   bool FillNextTokenBitmask(DLTensor* next_token_bitmask, int index = 0, bool debug_print = false);
 
+  /*!
+   * \brief The asynchronous version of FillNextTokenBitmask. The mask is computed on a background
+   * thread pool, so the caller can do other work, e.g. launch the model forward pass, and only
+   * wait on the result right before sampling.
+   * \return A future of the return value of FillNextTokenBitmask. Errors are rethrown by get().
+   * \note The tensor, including its shape and strides, must stay valid and the matcher must not
+   * be used until the future is ready.
+   */
+  std::shared_future<bool> FillNextTokenBitmaskAsync(
+      DLTensor* next_token_bitmask, int index = 0, bool debug_print = false
+  );
+
+  /*!
+   * \brief Find the longest prefix of a token sequence that the matcher accepts from its current
+   * state, i.e. the number of tokens that AcceptToken would accept in a row. The tokens are
+   * advanced through the parser without recording them for rollback.
+   * \param token_ids The token sequence to check.
+   * \param debug_print Whether to print information about the internal state of the matcher.
+   * \return The length of the longest accepted prefix.
+   * \note The state of the matcher is unchanged after the call.
+   */
+  int32_t FindLongestAcceptedPrefix(
+      const std::vector<int32_t>& token_ids, bool debug_print = false
+  );
+
+  /*!
+   * \brief Verify a tree of draft tokens for speculative decoding in one call. The tree is walked
+   * depth-first from the current state, accepting the token of each node on the way down and
+   * rolling it back on the way up. A node is accepted if its parent is accepted and isn't a stop
+   * token, and its token is allowed by the bitmask of its parent.
+   * \param draft_tokens The token of each node. Node 0 is the root, which stands for the current
+   * state, so its token is ignored.
+   * \param parent_indices The index of the parent of each node, or -1 for the root node 0. Other
+   * nodes without a parent, or not reachable from the root, are rejected.
+   * \param next_token_bitmask The bitmask to store the result, with shape (num_nodes,
+   * GetBitmaskSize()) and dtype int32. Row i is filled with the bitmask after accepting the tokens
+   * on the path to node i. The rows of rejected nodes and of stop tokens are left untouched.
+   * \param debug_print Whether to print information about the internal state of the matcher.
+   * \return A vector of bytes indicating whether each node is accepted.
+   * \note The state of the matcher is unchanged after the call.
+   */
+  std::vector<uint8_t> TraverseDraftTree(
+      const std::vector<int32_t>& draft_tokens,
+      const std::vector<int32_t>& parent_indices,
+      DLTensor* next_token_bitmask,
+      bool debug_print = false
+  );
+
   /*!
    * \brief Find the jump-forward string for jump-forward decoding. This is the longest string that
    will be valid according to the current syntax.
@@ -124,6 +183,47 @@ class GrammarMatcher {
    */
   void Rollback(int num_tokens = 1);
 
+  /*!
+   * \brief A saved state of the matcher. Its fields are internal and only meaningful to the
+   * matcher that created it, and to its forks created after the checkpoint.
+   * \sa Snapshot
+   */
+  struct Checkpoint {
+    int32_t num_history_rows;
+    int64_t history_epoch_id;
+    int32_t num_tokens;
+    bool is_terminated;
+  };
+
+  /*!
+   * \brief Save the current state of the matcher in O(1), without copying its history. This is
+   * useful for speculative decoding, which tries several continuations from the same state.
+   */
+  Checkpoint Snapshot() const;
+
+  /*!
+   * \brief Restore the state saved by Snapshot(), dropping the tokens accepted after it. Restoring
+   * only goes backward: a checkpoint is invalid once the matcher has been rolled back, restored or
+   * reset past it, so it can't redo tokens after returning to an earlier checkpoint. It takes time
+   * linear in the number of characters of the dropped tokens.
+   * \param checkpoint The checkpoint. It can be restored several times, and a checkpoint taken
+   * after it can be restored before it.
+   */
+  void Restore(const Checkpoint& checkpoint);
+
+  /*!
+   * \brief Fork the matcher. The fork starts from the current state, and then both matchers
+   * accept tokens independently, e.g. for beam search or parallel sampling. The parser history and
+   * the token history are shared by the two matchers instead of being copied or replayed, so
+   * forking takes O(1) time and memory. The matcher isn't modified, so several threads can fork
+   * it at once.
+   * \note The first characters accepted after a fork may copy the latest shared rows of the
+   * history, so that looking up a row stays O(log n) for a history of n characters. Each row is
+   * copied O(log n) times over the forks.
+   * \note Copying a GrammarMatcher object doesn't fork it: the copies refer to the same matcher.
+   */
+  GrammarMatcher Fork() const;
+
   /*!
    * \brief Check if the matcher has accepted the stop token and terminated.
    * \sa AcceptToken
@@ -175,6 +275,20 @@ class BatchGrammarMatcher {
       bool debug_print = false
   );
 
+  /*!
+   * \brief The asynchronous version of BatchFillNextTokenBitmask. The batch is dispatched from a
+   * background thread, so the caller can overlap the mask computation with other work.
+   * \return A future that is ready when all the bitmasks are filled. Errors are rethrown by get().
+   * \note The tensor must stay valid, and the matchers and this object must not be used until the
+   * future is ready.
+   */
+  std::shared_future<void> BatchFillNextTokenBitmaskAsync(
+      std::vector<GrammarMatcher>* matchers,
+      DLTensor* next_token_bitmask,
+      const std::optional<std::vector<int32_t>>& indices = std::nullopt,
+      bool debug_print = false
+  );
+
   /*!
    * \brief A batched version of AcceptString for better efficiency.
    * \param matchers The array of GrammarMatcher objects.
@@ -201,6 +315,71 @@ class BatchGrammarMatcher {
       bool debug_print = false
   );
 
+  /*!
+   * \brief The parallel version of BatchAcceptString. The matchers are processed on the thread
+   * pool of the batch matcher, and the strings are scheduled by length.
+   * \param matchers The array of GrammarMatcher objects.
+   * \param input_strs The array of input strings to be accepted.
+   * \param debug_print Whether to print debug information. Default is false.
+   * \return A vector of bytes indicating whether each string is accepted.
+   */
+  std::vector<uint8_t> BatchAcceptStringParallel(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<std::string>& input_strs,
+      bool debug_print = false
+  );
+
+  /*!
+   * \brief The parallel version of BatchAcceptToken. The matchers are processed on the thread pool
+   * of the batch matcher.
+   * \param matchers The array of GrammarMatcher objects.
+   * \param token_ids The array of token ids to be accepted.
+   * \param debug_print Whether to print debug information. Default is false.
+   * \return A vector of bytes indicating whether each token is accepted.
+   */
+  std::vector<uint8_t> BatchAcceptTokenParallel(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<int32_t>& token_ids,
+      bool debug_print = false
+  );
+
+  /*!
+   * \brief Accept a token for each matcher and then fill its next token bitmask, in one task per
+   * matcher. It is equivalent to BatchAcceptToken followed by BatchFillNextTokenBitmask, but only
+   * dispatches the batch to the thread pool once per step.
+   * \param matchers The array of GrammarMatcher objects.
+   * \param token_ids The array of token ids to be accepted.
+   * \param next_token_bitmask The pre-allocated DLTensor to store the result bitmasks.
+   * \param indices The optional array of indices to specify which matcher corresponds to which
+   * slice of the bitmask tensor, as in BatchFillNextTokenBitmask.
+   * \param debug_print Whether to print debug information. Default is false.
+   * \return A vector of bytes indicating whether each token is accepted.
+   * \note The bitmask is filled even if the token is rejected, in which case it describes the
+   * unchanged state. The bitmask row of a matcher that has accepted a stop token is left
+   * untouched, where BatchFillNextTokenBitmask would raise an error.
+   */
+  std::vector<uint8_t> BatchAcceptTokenAndFillNextTokenBitmask(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<int32_t>& token_ids,
+      DLTensor* next_token_bitmask,
+      const std::optional<std::vector<int32_t>>& indices = std::nullopt,
+      bool debug_print = false
+  );
+
+  /*!
+   * \brief A batched version of GrammarMatcher::FindLongestAcceptedPrefix. The matchers are
+   * processed in parallel on the thread pool of the batch matcher, and are unchanged afterwards.
+   * \param matchers The array of GrammarMatcher objects.
+   * \param token_ids The token sequence to check for each matcher.
+   * \param debug_print Whether to print debug information. Default is false.
+   * \return The length of the longest accepted prefix for each matcher.
+   */
+  std::vector<int32_t> BatchFindLongestAcceptedPrefix(
+      std::vector<GrammarMatcher>* matchers,
+      const std::vector<std::vector<int32_t>>& token_ids,
+      bool debug_print = false
+  );
+
   XGRAMMAR_DEFINE_PIMPL_METHODS(BatchGrammarMatcher);
 };
 
@@ -0,0 +1,184 @@
+import Cxgrammar
+
+extension Grammar {
+    /// A thread pool that advances a batch of matchers in parallel.
+    ///
+    /// Use a batch matcher to compute the bitmasks of all the sequences
+    /// in a decoding step at once.
+    /// The matchers of a batch can use different grammars.
+    public final class BatchMatcher: @unchecked Sendable {
+        let handle: OpaquePointer
+
+        deinit { xgrammar_batch_matcher_destroy(handle) }
+
+        /// Creates a batch matcher.
+        ///
+        /// - Parameter maximumThreadCount: The maximum number of threads to use,
+        ///   or `nil` to choose one automatically.
+        public init(maximumThreadCount: Int? = nil) {
+            precondition(
+                maximumThreadCount.map { $0 > 0 } ?? true,
+                "Thread count must be positive."
+            )
+            self.handle = xgrammar_batch_matcher_create(Int32(maximumThreadCount ?? 0))
+        }
+
+        /// Fills one bitmask row for each matcher.
+        ///
+        /// - Parameters:
+        ///   - matchers: The matchers of the batch.
+        ///   - bitmask: The bitmask to fill.
+        ///     Row `i` receives the tokens allowed by `matchers[i]`.
+        public func fillNextTokenBitmasks(
+            _ matchers: [Matcher],
+            bitmask: inout Matcher.TokenBitmask
+        ) {
+            precondition(!matchers.isEmpty, "The batch must not be empty.")
+            precondition(bitmask.batchSize == matchers.count, "The bitmask needs a row per matcher.")
+            let rowCount = bitmask.wordsPerBatch
+            let handles: [OpaquePointer?] = matchers.map { $0.handle }
+            withExtendedLifetime(matchers) {
+                bitmask.storage.withUnsafeMutableBufferPointer { buffer in
+                    xgrammar_batch_matcher_fill_next_token_bitmask(
+                        handle,
+                        handles,
+                        Int32(handles.count),
+                        buffer.baseAddress,
+                        Int32(rowCount)
+                    )
+                }
+            }
+        }
+
+        /// Starts filling one bitmask row for each matcher in the background.
+        ///
+        /// - Parameters:
+        ///   - matchers: The matchers of the batch.
+        ///   - bitmask: The bitmask to start from.
+        ///     Row `i` of the returned bitmask receives
+        ///     the tokens allowed by `matchers[i]`.
+        /// - Returns: The pending bitmask to wait for.
+        public func fillNextTokenBitmasksAsync(
+            _ matchers: [Matcher],
+            bitmask: Matcher.TokenBitmask
+        ) -> Matcher.PendingTokenBitmask {
+            precondition(!matchers.isEmpty, "The batch must not be empty.")
+            precondition(bitmask.batchSize == matchers.count, "The bitmask needs a row per matcher.")
+            let rowCount = bitmask.wordsPerBatch
+            let handles: [OpaquePointer?] = matchers.map { $0.handle }
+            return Matcher.PendingTokenBitmask(bitmask, matchers: matchers) { base in
+                xgrammar_batch_matcher_fill_next_token_bitmask_async(
+                    handle,
+                    handles,
+                    Int32(handles.count),
+                    base,
+                    Int32(rowCount)
+                )
+            }
+        }
+
+        /// Accepts one token in each matcher.
+        ///
+        /// - Parameters:
+        ///   - tokenIDs: The token to accept in each matcher.
+        ///   - matchers: The matchers of the batch.
+        /// - Returns: A Boolean value for each matcher
+        ///   that indicates whether it accepted its token.
+        @discardableResult
+        public func accept(_ tokenIDs: [Int32], in matchers: [Matcher]) -> [Bool] {
+            precondition(!matchers.isEmpty, "The batch must not be empty.")
+            precondition(tokenIDs.count == matchers.count, "Each matcher needs a token.")
+            let handles: [OpaquePointer?] = matchers.map { $0.handle }
+            var accepted = [Bool](repeating: false, count: matchers.count)
+            withExtendedLifetime(matchers) {
+                accepted.withUnsafeMutableBufferPointer { acceptedBuffer in
+                    xgrammar_batch_matcher_accept_token(
+                        handle,
+                        handles,
+                        tokenIDs,
+                        Int32(handles.count),
+                        acceptedBuffer.baseAddress
+                    )
+                }
+            }
+            return accepted
+        }
+
+        /// Accepts one token in each matcher
+        /// and then fills one bitmask row for each matcher.
+        ///
+        /// This is equivalent to calling ``accept(_:in:)``
+        /// and then ``fillNextTokenBitmasks(_:bitmask:)``,
+        /// but goes over the batch once.
+        /// The row of a matcher that accepted a stop token is left unchanged.
+        ///
+        /// - Parameters:
+        ///   - tokenIDs: The token to accept in each matcher.
+        ///   - matchers: The matchers of the batch.
+        ///   - bitmask: The bitmask to fill.
+        ///     Row `i` receives the tokens allowed by `matchers[i]`.
+        /// - Returns: A Boolean value for each matcher
+        ///   that indicates whether it accepted its token.
+        @discardableResult
+        public func acceptAndFillNextTokenBitmasks(
+            _ tokenIDs: [Int32],
+            in matchers: [Matcher],
+            bitmask: inout Matcher.TokenBitmask
+        ) -> [Bool] {
+            precondition(!matchers.isEmpty, "The batch must not be empty.")
+            precondition(tokenIDs.count == matchers.count, "Each matcher needs a token.")
+            precondition(bitmask.batchSize == matchers.count, "The bitmask needs a row per matcher.")
+            let rowCount = bitmask.wordsPerBatch
+            let handles: [OpaquePointer?] = matchers.map { $0.handle }
+            var accepted = [Bool](repeating: false, count: matchers.count)
+            withExtendedLifetime(matchers) {
+                bitmask.storage.withUnsafeMutableBufferPointer { buffer in
+                    accepted.withUnsafeMutableBufferPointer { acceptedBuffer in
+                        xgrammar_batch_matcher_accept_token_and_fill_next_token_bitmask(
+                            handle,
+                            handles,
+                            tokenIDs,
+                            Int32(handles.count),
+                            buffer.baseAddress,
+                            Int32(rowCount),
+                            acceptedBuffer.baseAddress
+                        )
+                    }
+                }
+            }
+            return accepted
+        }
+
+        /// Finds the longest prefix of a token sequence
+        /// that each matcher would accept.
+        ///
+        /// This is the batched version of ``Matcher/longestAcceptedPrefixLength(_:)``.
+        /// The matchers are checked in parallel, and their states are unchanged after the call.
+        ///
+        /// - Parameters:
+        ///   - tokenIDs: The token sequence to check for each matcher.
+        ///   - matchers: The matchers of the batch.
+        /// - Returns: The length of the longest accepted prefix for each matcher.
+        public func longestAcceptedPrefixLengths(_ tokenIDs: [[Int32]], in matchers: [Matcher]) -> [Int] {
+            precondition(!matchers.isEmpty, "The batch must not be empty.")
+            precondition(tokenIDs.count == matchers.count, "Each matcher needs a token sequence.")
+            let handles: [OpaquePointer?] = matchers.map { $0.handle }
+            let flattenedTokenIDs = tokenIDs.flatMap { $0 }
+            let tokenCounts = tokenIDs.map { Int32($0.count) }
+            var lengths = [Int32](repeating: 0, count: matchers.count)
+            withExtendedLifetime(matchers) {
+                lengths.withUnsafeMutableBufferPointer { lengthsBuffer in
+                    xgrammar_batch_matcher_find_longest_accepted_prefix(
+                        handle,
+                        handles,
+                        flattenedTokenIDs,
+                        tokenCounts,
+                        Int32(handles.count),
+                        lengthsBuffer.baseAddress
+                    )
+                }
+            }
+            return lengths.map { Int($0) }
+        }
+    }
+}
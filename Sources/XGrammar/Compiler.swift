@@ -46,6 +46,38 @@ extension Grammar {
             Int(xgrammar_compiled_grammar_memory_size(handle.pointer))
         }
 
+        /// Counters of how the compiler obtained the token masks, for testing.
+        struct TokenMaskCompileStats: Equatable {
+            /// The number of grammar positions that have token masks.
+            var maskStateCount: Int
+            /// The number of distinct token masks, which positions with equal masks share.
+            var maskCount: Int
+            /// The number of grammar positions whose masks were copied from the last compiled grammar.
+            var reusedStateCount: Int
+            /// The number of grammar positions whose masks are shared with an identical rule of the grammar.
+            var sharedRuleStateCount: Int
+            /// The number of grammar positions whose masks are computed by walking the automaton of their rule.
+            var fsmWalkStateCount: Int
+            /// The number of ranges the vocabulary is split into to compute the mask of a position in parallel,
+            /// or `0` if no mask is computed during the compilation.
+            var vocabChunkCount: Int
+        }
+
+        /// How the compiler obtained the token masks.
+        /// A compiled grammar restored from JSON only has ``TokenMaskCompileStats/maskStateCount``
+        /// and ``TokenMaskCompileStats/maskCount``.
+        var tokenMaskCompileStats: TokenMaskCompileStats {
+            let stats = xgrammar_compiled_grammar_token_mask_compile_stats(handle.pointer)
+            return TokenMaskCompileStats(
+                maskStateCount: Int(stats.num_mask_states),
+                maskCount: Int(stats.num_masks),
+                reusedStateCount: Int(stats.num_reused_states),
+                sharedRuleStateCount: Int(stats.num_shared_rule_states),
+                fsmWalkStateCount: Int(stats.num_fsm_walk_states),
+                vocabChunkCount: Int(stats.num_vocab_chunks)
+            )
+        }
+
         /// Creates a compiled grammar from serialized JSON data
         /// and tokenizer information.
         ///
@@ -153,18 +185,47 @@ extension Grammar {
         ///     whether to cache compilation results. Defaults to `true`.
         ///   - cacheSizeLimit: The maximum cache size in bytes,
         ///     or `nil` for unlimited. Defaults to `nil`.
+        ///   - storesTokenMasksAsBitsets: A Boolean value that indicates
+        ///     whether to store every precomputed token mask as a bitset
+        ///     over the vocabulary. This makes filling token bitmasks faster
+        ///     at the cost of memory. Defaults to `false`.
+        ///   - compilesTokenMasksLazily: A Boolean value that indicates
+        ///     whether to defer computing token masks until a matcher needs them.
+        ///     Compilation returns as soon as the grammar is analyzed,
+        ///     and the remaining masks are computed in the background.
+        ///     Defaults to `false`.
+        ///   - tokenBitmaskCacheSize: The memory budget in bytes
+        ///     of a cache of token bitmasks in each compiled grammar,
+        ///     shared by all its matchers.
+        ///     A matching context that recurs, such as the start of each element of a JSON array,
+        ///     then reuses its cached bitmask.
+        ///     Defaults to `0`, which disables the cache.
+        ///   - reusesRuleMasks: A Boolean value that indicates
+        ///     whether a grammar that differs from the last compiled one in a few rules
+        ///     reuses the token masks of the unchanged rules.
+        ///     The last compiled grammar is then kept outside the cache until the next compilation,
+        ///     unless it alone exceeds `cacheSizeLimit`.
+        ///     Defaults to `false`.
         public init(
             tokenizerInfo: TokenizerInfo,
             maximumThreadCount: Int = 8,
             cachingEnabled: Bool = true,
-            cacheSizeLimit: Int? = nil
+            cacheSizeLimit: Int? = nil,
+            storesTokenMasksAsBitsets: Bool = false,
+            compilesTokenMasksLazily: Bool = false,
+            tokenBitmaskCacheSize: Int = 0,
+            reusesRuleMasks: Bool = false
         ) {
             let handle = Handle(
                 xgrammar_compiler_create(
                     tokenizerInfo.handle.pointer,
                     Int32(maximumThreadCount),
                     cachingEnabled,
-                    Int64(cacheSizeLimit ?? -1)
+                    Int64(cacheSizeLimit ?? -1),
+                    storesTokenMasksAsBitsets,
+                    compilesTokenMasksLazily,
+                    Int64(tokenBitmaskCacheSize),
+                    reusesRuleMasks
                 )
             )
             self.handle = handle
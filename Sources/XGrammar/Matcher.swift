@@ -89,9 +89,64 @@ extension Grammar {
                 guard !storage.isEmpty else { return }
 
                 let limit = min(targetVocabSize, self.vocabSize)
-                for tokenId in 0 ..< limit {
-                    if !isTokenAllowed(tokenId, batchIndex: 0) {
-                        logits[tokenId] = -Float.infinity
+                let rowCount = TokenBitmask.wordsPerBatch(vocabSize: self.vocabSize)
+                storage.withUnsafeBufferPointer { bitmask in
+                    logits.withUnsafeMutableBufferPointer { buffer in
+                        guard let logitsBase = buffer.baseAddress,
+                            let bitmaskBase = bitmask.baseAddress
+                        else { return }
+                        xgrammar_apply_token_bitmask_inplace_cpu(
+                            logitsBase,
+                            Int32(buffer.count),
+                            bitmaskBase,
+                            Int32(rowCount),
+                            Int32(limit)
+                        )
+                    }
+                }
+            }
+
+            /// Sets disallowed token logits to negative infinity
+            /// for every batch row.
+            ///
+            /// The logits hold `batchSize` rows of `vocabSize` elements.
+            /// Row `i` of the logits is masked by row `i` of this bitmask.
+            ///
+            /// - Parameters:
+            ///   - logits: The logits of all batch rows to mask in place.
+            ///   - vocabSize: The number of logits in each row,
+            ///     or `nil` to use the bitmask's vocabulary size.
+            ///   - threadCount: The number of threads to split the rows among.
+            ///     Defaults to `1`.
+            public func maskBatchLogits(
+                _ logits: inout [Float],
+                vocabSize: Int? = nil,
+                threadCount: Int = 1
+            ) {
+                let targetVocabSize = vocabSize ?? self.vocabSize
+                precondition(targetVocabSize > 0, "Vocab size must be positive.")
+                precondition(threadCount > 0, "Thread count must be positive.")
+                precondition(
+                    logits.count == targetVocabSize * batchSize,
+                    "Logits length must be vocab size times batch size."
+                )
+                guard !storage.isEmpty else { return }
+
+                let limit = min(targetVocabSize, self.vocabSize)
+                storage.withUnsafeBufferPointer { bitmask in
+                    logits.withUnsafeMutableBufferPointer { buffer in
+                        guard let logitsBase = buffer.baseAddress,
+                            let bitmaskBase = bitmask.baseAddress
+                        else { return }
+                        xgrammar_apply_token_bitmask_batch_inplace_cpu(
+                            logitsBase,
+                            Int32(batchSize),
+                            Int32(targetVocabSize),
+                            bitmaskBase,
+                            Int32(wordsPerBatch),
+                            Int32(limit),
+                            Int32(threadCount)
+                        )
                     }
                 }
             }
@@ -115,6 +170,60 @@ extension Grammar {
             }
         }
 
+        /// A token bitmask that is being filled in the background.
+        ///
+        /// Start a fill with ``Grammar/Matcher/fillNextTokenBitmaskAsync(_:index:)``
+        /// or ``Grammar/BatchMatcher/fillNextTokenBitmasksAsync(_:bitmask:)``,
+        /// do other work, such as running the model,
+        /// and then call ``wait()`` to get the filled bitmask.
+        /// Don't use the matchers until ``wait()`` returns.
+        public final class PendingTokenBitmask: @unchecked Sendable {
+            private let handle: OpaquePointer?
+            private let storage: UnsafeMutableBufferPointer<Int32>
+            private let batchSize: Int
+            private let vocabSize: Int
+            private let matchers: [Matcher]
+
+            deinit {
+                xgrammar_bitmask_future_destroy(handle)
+                storage.deallocate()
+            }
+
+            init(
+                _ bitmask: TokenBitmask,
+                matchers: [Matcher],
+                start: (UnsafeMutablePointer<Int32>?) -> OpaquePointer?
+            ) {
+                let storage = UnsafeMutableBufferPointer<Int32>.allocate(
+                    capacity: bitmask.storage.count
+                )
+                _ = storage.initialize(from: bitmask.storage)
+                self.storage = storage
+                self.batchSize = bitmask.batchSize
+                self.vocabSize = bitmask.vocabSize
+                self.matchers = matchers
+                self.handle = start(storage.baseAddress)
+            }
+
+            /// Waits for the fill to finish.
+            ///
+            /// - Returns: The filled bitmask.
+            /// - Throws: The error raised while filling the bitmask,
+            ///   for example if a matcher has already accepted a stop token.
+            public func wait() throws -> TokenBitmask {
+                guard let handle else {
+                    throw XGrammarError(runtime: "token bitmask fill")
+                }
+                var error: UnsafeMutablePointer<CChar>?
+                guard xgrammar_bitmask_future_wait(handle, nil, &error) else {
+                    throw XGrammarError.runtimeError(consumeCString(error))
+                }
+                var bitmask = TokenBitmask(batchSize: batchSize, vocabSize: vocabSize)
+                bitmask.storage = Array(storage)
+                return bitmask
+            }
+        }
+
         /// A Boolean value that indicates whether the matcher
         /// has terminated after accepting a stop token.
         public var isTerminated: Bool {
@@ -169,6 +278,22 @@ extension Grammar {
             self.handle = ptr
         }
 
+        private init(handle: OpaquePointer) {
+            self.handle = handle
+        }
+
+        /// Creates a copy of the matcher in its current state.
+        ///
+        /// The copy and the original accept tokens independently,
+        /// for example to explore several beams or samples.
+        /// Forking shares the accepted history instead of copying it,
+        /// so it's cheap even after many tokens.
+        ///
+        /// - Returns: A new matcher in the same state as this one.
+        public func fork() -> Matcher {
+            Matcher(handle: xgrammar_matcher_fork(handle))
+        }
+
         /// Accepts a token and advances the matcher state.
         ///
         /// After the root rule is fully matched,
@@ -224,6 +349,100 @@ extension Grammar {
             }
         }
 
+        /// Starts filling a token bitmask in the background.
+        ///
+        /// - Parameters:
+        ///   - bitmask: The bitmask to start from.
+        ///     The returned bitmask is a copy of it
+        ///     with the row at `index` filled.
+        ///   - index: The batch row index to fill. Defaults to `0`.
+        /// - Returns: The pending bitmask to wait for.
+        public func fillNextTokenBitmaskAsync(
+            _ bitmask: TokenBitmask,
+            index: Int = 0
+        ) -> PendingTokenBitmask {
+            precondition(index >= 0 && index < bitmask.batchSize, "Bitmask index out of range.")
+            let rowCount = bitmask.wordsPerBatch
+            return PendingTokenBitmask(bitmask, matchers: [self]) { base in
+                xgrammar_matcher_fill_next_token_bitmask_async(
+                    handle,
+                    base?.advanced(by: rowCount * index),
+                    Int32(rowCount)
+                )
+            }
+        }
+
+        /// Returns the number of leading tokens in a sequence
+        /// that the matcher accepts from its current state.
+        ///
+        /// Use this method to validate a sequence of tokens,
+        /// such as a cached completion,
+        /// without accepting and rolling back each token.
+        /// The matcher state is unchanged after the call.
+        ///
+        /// - Parameter tokenIDs: The token sequence to check.
+        /// - Returns: The length of the longest accepted prefix.
+        public func longestAcceptedPrefixLength(_ tokenIDs: [Int32]) -> Int {
+            Int(
+                xgrammar_matcher_find_longest_accepted_prefix(
+                    handle,
+                    tokenIDs,
+                    Int32(tokenIDs.count)
+                )
+            )
+        }
+
+        /// Checks a tree of draft tokens against the grammar
+        /// for speculative decoding.
+        ///
+        /// The tree is walked depth-first from the current state.
+        /// A node is accepted if its parent is accepted and isn't a stop token,
+        /// and the grammar allows its token after the parent.
+        /// The matcher state is unchanged after the call.
+        ///
+        /// - Parameters:
+        ///   - tokens: The token of each node.
+        ///     Node `0` is the root, which stands for the current state,
+        ///     so its token is ignored.
+        ///   - parentIndices: The parent of each node,
+        ///     or `-1` for the root.
+        ///   - bitmask: A bitmask with one row per node.
+        ///     Each row of an accepted node is filled with the tokens allowed
+        ///     after the path to that node,
+        ///     unless the node is a stop token.
+        /// - Returns: A Boolean value for each node
+        ///   that indicates whether the node is accepted.
+        public func verifyDraftTree(
+            tokens: [Int32],
+            parentIndices: [Int32],
+            bitmask: inout TokenBitmask
+        ) -> [Bool] {
+            precondition(!tokens.isEmpty, "The draft tree must have a root.")
+            precondition(tokens.count == parentIndices.count, "Each node needs a parent index.")
+            precondition(parentIndices[0] == -1, "The parent index of the root must be -1.")
+            precondition(
+                parentIndices.allSatisfy { $0 >= -1 && Int($0) < tokens.count },
+                "Parent index out of range."
+            )
+            precondition(bitmask.batchSize == tokens.count, "The bitmask needs a row per node.")
+            let rowCount = bitmask.wordsPerBatch
+            var accepted = [Bool](repeating: false, count: tokens.count)
+            bitmask.storage.withUnsafeMutableBufferPointer { buffer in
+                accepted.withUnsafeMutableBufferPointer { acceptedBuffer in
+                    xgrammar_matcher_traverse_draft_tree(
+                        handle,
+                        tokens,
+                        parentIndices,
+                        Int32(tokens.count),
+                        buffer.baseAddress,
+                        Int32(rowCount),
+                        acceptedBuffer.baseAddress
+                    )
+                }
+            }
+            return accepted
+        }
+
         /// Returns the deterministic jump-forward string
         /// from the current matcher state, if any.
         ///
@@ -246,6 +465,40 @@ extension Grammar {
             xgrammar_matcher_rollback(handle, Int32(count))
         }
 
+        /// A saved state of a matcher.
+        ///
+        /// Create a checkpoint with ``checkpoint()``
+        /// and return to it with ``restore(_:)``.
+        public struct Checkpoint: Sendable {
+            let value: xgrammar_matcher_checkpoint
+        }
+
+        /// Saves the current matcher state.
+        ///
+        /// Taking a checkpoint doesn't copy the accepted history,
+        /// so it's cheap to take one before each speculative branch.
+        ///
+        /// - Returns: A checkpoint to pass to ``restore(_:)``.
+        public func checkpoint() -> Checkpoint {
+            Checkpoint(value: xgrammar_matcher_snapshot(handle))
+        }
+
+        /// Restores the matcher to a previously saved state,
+        /// discarding the tokens accepted after it.
+        ///
+        /// Restoring only goes backward:
+        /// once the matcher returns to an earlier state,
+        /// the checkpoints taken after that state are invalid.
+        /// It takes time proportional to the length of the discarded tokens.
+        ///
+        /// - Parameter checkpoint: A checkpoint taken from this matcher,
+        ///   or from the matcher it was forked from before the fork.
+        ///   The matcher must not have been rolled back
+        ///   or reset past the checkpoint since it was taken.
+        public func restore(_ checkpoint: Checkpoint) {
+            xgrammar_matcher_restore(handle, checkpoint.value)
+        }
+
         /// Resets the matcher to its initial state,
         /// discarding all previously accepted tokens.
         public func reset() {
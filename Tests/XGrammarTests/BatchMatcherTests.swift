@@ -0,0 +1,112 @@
+import Testing
+
+@testable import XGrammar
+
+@Suite("BatchMatcher Tests")
+struct BatchMatcherTests {
+    @Test func acceptAndFillMatchesSeparateCalls() async throws {
+        let vocab = ["a", "b", "c", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(Grammar(ebnf: #"root ::= "a" | "a" "b""#))
+        // The matchers terminate once "a" is accepted, but can still accept "b".
+        func makeMatchers() throws -> [Grammar.Matcher] {
+            try (0 ..< 3).map { _ in
+                try Grammar.Matcher(compiled, stopTokens: [3], terminatesWithoutStopToken: true)
+            }
+        }
+        let fused = try makeMatchers()
+        let separate = try makeMatchers()
+        let batchMatcher = Grammar.BatchMatcher(maximumThreadCount: 2)
+        var fusedBitmask = Grammar.Matcher.TokenBitmask(batchSize: 3, vocabSize: vocab.count)
+        var separateBitmask = Grammar.Matcher.TokenBitmask(batchSize: 3, vocabSize: vocab.count)
+
+        for step: [Int32] in [[0, 0, 2], [1, 2, 0]] {
+            let fusedAccepted = batchMatcher.acceptAndFillNextTokenBitmasks(
+                step,
+                in: fused,
+                bitmask: &fusedBitmask
+            )
+            let separateAccepted = batchMatcher.accept(step, in: separate)
+            batchMatcher.fillNextTokenBitmasks(separate, bitmask: &separateBitmask)
+            #expect(fusedAccepted == separateAccepted)
+            #expect(fusedBitmask.storage == separateBitmask.storage)
+        }
+        #expect(fused.allSatisfy { $0.isTerminated })
+
+        // The row of a matcher that accepted the stop token is left unchanged.
+        let stopped = try Grammar.Matcher(compiled, stopTokens: [3])
+        stopped.accept(0)
+        var stoppedBitmask = Grammar.Matcher.TokenBitmask(batchSize: 1, vocabSize: vocab.count)
+        let accepted = batchMatcher.acceptAndFillNextTokenBitmasks(
+            [3],
+            in: [stopped],
+            bitmask: &stoppedBitmask
+        )
+        #expect(accepted == [true])
+        #expect(stoppedBitmask.storage.allSatisfy { $0 == -1 })
+    }
+
+    @Test func fillNextTokenBitmasksAsyncMatchesSync() async throws {
+        let vocab = ["a", "b", "c", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(Grammar(ebnf: #"root ::= "a" ("b" | "c") "c""#))
+        let matchers = try (0 ..< 4).map { _ in try Grammar.Matcher(compiled, stopTokens: [3]) }
+        matchers[1].accept(0)
+        matchers[2].accept(0)
+        matchers[2].accept(1)
+        let batchMatcher = Grammar.BatchMatcher(maximumThreadCount: 2)
+
+        var expected = Grammar.Matcher.TokenBitmask(batchSize: 4, vocabSize: vocab.count)
+        batchMatcher.fillNextTokenBitmasks(matchers, bitmask: &expected)
+        let pending = batchMatcher.fillNextTokenBitmasksAsync(
+            matchers,
+            bitmask: Grammar.Matcher.TokenBitmask(batchSize: 4, vocabSize: vocab.count)
+        )
+        let bitmask = try pending.wait()
+        #expect(bitmask.storage == expected.storage)
+        #expect(allowedTokenIndices(bitmask, vocabSize: vocab.count, batchIndex: 1) == [1, 2])
+    }
+
+    @Test func fillNextTokenBitmasksAsyncRethrowsErrors() async throws {
+        let vocab = ["a", "b", "c", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(Grammar(ebnf: #"root ::= "a""#))
+        let matchers = try (0 ..< 4).map { _ in try Grammar.Matcher(compiled, stopTokens: [3]) }
+        matchers[2].accept(0)
+        matchers[2].accept(3)
+        let batchMatcher = Grammar.BatchMatcher(maximumThreadCount: 2)
+
+        // The fill of the matcher that accepted the stop token fails on a worker thread, and the
+        // error is forwarded to the caller.
+        let pending = batchMatcher.fillNextTokenBitmasksAsync(
+            matchers,
+            bitmask: Grammar.Matcher.TokenBitmask(batchSize: 4, vocabSize: vocab.count)
+        )
+        #expect(throws: XGrammarError.self) {
+            try pending.wait()
+        }
+    }
+
+    @Test func longestAcceptedPrefixLengthsMatchSingleMatchers() async throws {
+        let vocab = ["a", "b", "c", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(Grammar(ebnf: #"root ::= "a" "b"* "c""#))
+        let matchers = try (0 ..< 4).map { _ in try Grammar.Matcher(compiled, stopTokens: [3]) }
+        matchers[1].accept(0)
+        matchers[2].accept(0)
+        matchers[2].accept(2)
+        let tokenIDs: [[Int32]] = [[0, 1, 1, 0], [1, 2, 3, 0], [3, 0], []]
+        let batchMatcher = Grammar.BatchMatcher(maximumThreadCount: 2)
+
+        let lengths = batchMatcher.longestAcceptedPrefixLengths(tokenIDs, in: matchers)
+        #expect(lengths == [3, 3, 1, 0])
+        #expect(lengths == zip(matchers, tokenIDs).map { $0.longestAcceptedPrefixLength($1) })
+        // The matchers are unchanged.
+        #expect(matchers[0].accept(0))
+        #expect(matchers[2].accept(3))
+    }
+}
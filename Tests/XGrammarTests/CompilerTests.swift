@@ -85,4 +85,405 @@ struct CompilerTests {
         let restored = try Grammar.Compiled(jsonData: serialized, tokenizerInfo: tokenizer)
         #expect(restored.memorySize > 0)
     }
+
+    @Test(arguments: [false, true], [false, true])
+    func tokenMaskOptionsProduceSameBitmasks(
+        storesTokenMasksAsBitsets: Bool,
+        compilesTokenMasksLazily: Bool
+    ) async throws {
+        let vocab = makeJSONVocab()
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let optionCompiler = Grammar.Compiler(
+            tokenizerInfo: tokenizer,
+            storesTokenMasksAsBitsets: storesTokenMasksAsBitsets,
+            compilesTokenMasksLazily: compilesTokenMasksLazily
+        )
+        let compiled = await compiler.compiledJSON
+        let optionCompiled = await optionCompiler.compiledJSON
+        let matcher = try Grammar.Matcher(compiled, terminatesWithoutStopToken: true)
+        let optionMatcher = try Grammar.Matcher(optionCompiled, terminatesWithoutStopToken: true)
+        var bitmask = Grammar.Matcher.TokenBitmask(batchSize: 1, vocabSize: vocab.count)
+        var optionBitmask = Grammar.Matcher.TokenBitmask(batchSize: 1, vocabSize: vocab.count)
+
+        let tokenIds = ["{", "\"", "a", "\"", ":", " ", "\"", "b", "\"", "}"]
+            .compactMap { vocab.firstIndex(of: $0) }
+
+        for tokenId in tokenIds {
+            _ = matcher.fillNextTokenBitmask(&bitmask)
+            _ = optionMatcher.fillNextTokenBitmask(&optionBitmask)
+            #expect(
+                allowedTokenIndices(bitmask, vocabSize: vocab.count)
+                    == allowedTokenIndices(optionBitmask, vocabSize: vocab.count)
+            )
+            #expect(matcher.accept(Int32(tokenId)))
+            #expect(optionMatcher.accept(Int32(tokenId)))
+        }
+    }
+
+    @Test func runLengthTokenMasksMatchBitsetMasks() async throws {
+        // The tokens starting with the same letter are adjacent in the sorted vocabulary, so the
+        // accepted or rejected tokens form a few runs, which take less memory than the indices or a
+        // bitset over the vocabulary.
+        let letters = "abcdefghijklmnopqrst".map { String($0) }
+        let digits = (0 ... 9).map { String($0) }
+        let vocab =
+            letters + letters.flatMap { letter in digits.map { letter + $0 } } + digits
+            + ["b)", "b)a", "b)b", "b)c", "b)d", "(", ")", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let cases: [(ebnf: String, path: [String], storeType: Int, uncertainRunsStoreType: Int?)] = [
+            // Only "a" and "a0" to "a9" are accepted at the start, in one run.
+            (#"root ::= "a" [0-9]*"#, ["a5", "7"], 3, nil),
+            // Inside item, "(", ")", "</s>" and the tokens starting with "a" are rejected, in three
+            // runs. The tokens starting with "b)" may close item, so they are uncertain, in one run.
+            (
+                #"""
+                root ::= "(" item ")"
+                item ::= [b-t0-9]+ | "(" item ")"
+                """#,
+                ["(", "(", "b5", "b)", ")"], 4, 4
+            ),
+        ]
+
+        for (ebnf, path, storeType, uncertainRunsStoreType) in cases {
+            let grammar = Grammar(ebnf: ebnf)
+            let tokenIDs = path.map { Int32(vocab.firstIndex(of: $0)!) }
+            let compiled = await Grammar.Compiler(tokenizerInfo: tokenizer).compile(grammar)
+            let storeTypes = try tokenMaskStoreTypes(compiled)
+            #expect(storeTypes.all.contains(storeType))
+            if let uncertainRunsStoreType {
+                #expect(storeTypes.withUncertainRuns.contains(uncertainRunsStoreType))
+            }
+
+            // The runs survive serialization.
+            let restored = try Grammar.Compiled(jsonData: compiled.jsonData, tokenizerInfo: tokenizer)
+            #expect(try tokenMaskStoreTypes(restored) == storeTypes)
+
+            let bitsetCompiled = await Grammar.Compiler(
+                tokenizerInfo: tokenizer,
+                storesTokenMasksAsBitsets: true
+            ).compile(grammar)
+            #expect(try tokenMaskStoreTypes(bitsetCompiled).all.allSatisfy { $0 == 2 })
+
+            var allowedTokens: [[[Int]]] = []
+            for grammar in [compiled, restored, bitsetCompiled] {
+                let matcher = try Grammar.Matcher(grammar, stopTokens: [Int32(vocab.count - 1)])
+                var bitmask = Grammar.Matcher.TokenBitmask(vocabSize: vocab.count)
+                var steps: [[Int]] = []
+                for tokenID in tokenIDs + [Int32(vocab.count - 1)] {
+                    matcher.fillNextTokenBitmask(&bitmask)
+                    steps.append(allowedTokenIndices(bitmask, vocabSize: vocab.count))
+                    #expect(matcher.accept(tokenID))
+                }
+                allowedTokens.append(steps)
+            }
+            #expect(allowedTokens[0] == allowedTokens[1])
+            #expect(allowedTokens[0] == allowedTokens[2])
+            fillNextTokenBitmasks(
+                try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)]),
+                vocabSize: vocab.count,
+                along: tokenIDs
+            )
+        }
+    }
+
+    @Test func tokenBitmaskCacheIsOptInAndCounted() async throws {
+        // The tokens ending with ")" may close the enclosing rule, so their masks have uncertain
+        // tokens, and the final bitmasks are cached when the cache is enabled.
+        let vocab = ["(", ")", "a", "a)", "))", "((", "b", "ab"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let grammar = Grammar(ebnf: #"root ::= "(" root* ")" | [ab]+"#)
+        let path = ["((", "a)", "(", "a", "))"].map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var bitmasks: [[[Int32]]] = []
+        var growths: [Int] = []
+        for tokenBitmaskCacheSize in [0, 1 << 20] {
+            let compiler = Grammar.Compiler(
+                tokenizerInfo: tokenizer,
+                cachingEnabled: false,
+                tokenBitmaskCacheSize: tokenBitmaskCacheSize
+            )
+            let compiled = await compiler.compile(grammar)
+            let sizeBefore = compiled.memorySize
+            let matcher = try Grammar.Matcher(compiled, terminatesWithoutStopToken: true)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+            growths.append(compiled.memorySize - sizeBefore)
+        }
+        #expect(bitmasks[0] == bitmasks[1])
+        #expect(growths[0] == 0)
+        #expect(growths[1] > 0)
+    }
+
+    @Test func reusedRuleMasksProduceSameBitmasks() async throws {
+        let vocab = [
+            "{", "}", ",", ":", "\"", "a", "b", "ab", "\"a", "1", "12", "tr", "ue", "true", "</s>",
+        ]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let first = Grammar(
+            ebnf: #"""
+                root ::= "{" item ("," item)* "}"
+                item ::= key ":" value
+                key ::= "\"" [a-b]+ "\""
+                value ::= [0-9]+
+                """#
+        )
+        // Only the value rule differs, so the masks of the other rules are copied from the first grammar.
+        let second = Grammar(
+            ebnf: #"""
+                root ::= "{" item ("," item)* "}"
+                item ::= key ":" value
+                key ::= "\"" [a-b]+ "\""
+                value ::= [0-9]+ | "true"
+                """#
+        )
+        let path = ["{", "\"a", "b", "\"", ":", "tr", "ue", ",", "\"", "a", "\"", ":", "12", "}"]
+            .map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var bitmasks: [[[Int32]]] = []
+        var reusedStateCounts: [Int] = []
+        for reusesRuleMasks in [false, true] {
+            let compiler = Grammar.Compiler(
+                tokenizerInfo: tokenizer,
+                cachingEnabled: false,
+                reusesRuleMasks: reusesRuleMasks
+            )
+            let compiledFirst = await compiler.compile(first)
+            #expect(compiledFirst.tokenMaskCompileStats.reusedStateCount == 0)
+            let compiled = await compiler.compile(second)
+            reusedStateCounts.append(compiled.tokenMaskCompileStats.reusedStateCount)
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+
+            // Clearing the cache also forgets the grammar whose masks are reused.
+            await compiler.cache.clear()
+            #expect(await compiler.compile(second).tokenMaskCompileStats.reusedStateCount == 0)
+        }
+        #expect(bitmasks[0] == bitmasks[1])
+        #expect(reusedStateCounts[0] == 0)
+        #expect(reusedStateCounts[1] > 0)
+    }
+
+    @Test func skippedVocabularySubtreesAreRejected() async throws {
+        // The tokens after the first rejected character, such as "a;b" and "a;c", or the tokens
+        // sharing a prefix the lookahead assertion rejects, such as "ab;;", "ab;x" and "ab;y", are
+        // rejected together without matching each of them.
+        let vocab = [
+            "a", "ab", "abc", "ab,", "ab,a", "ab,;", "ab;x", "ab;y", "ab;;", "b", "c,", "c,,",
+            "c,;a", "c,;b", ",", ",a", ";a", "a;b", "a;c", "</s>",
+        ]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(
+            Grammar(
+                ebnf: #"""
+                    root ::= item ("," item)*
+                    item ::= [a-c] rest (= ",")
+                    rest ::= "" | [a-c] rest
+                    """#
+            )
+        )
+        let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+        let path = ["a", "ab,", "c,", "a", "b"].map { Int32(vocab.firstIndex(of: $0)!) }
+        fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path)
+    }
+
+    @Test func sharedEqualTokenMasksMatchAcceptedTokens() async throws {
+        // Several positions of the grammar, e.g. inside the keys and the string values, have
+        // equal masks and store one copy. The bitmasks are checked against the tokens that forks
+        // of the matcher accept, which does not use the stored masks.
+        let vocab = [
+            "{", "}", "\"", ":", ",", "a", "b", "1", "2", "\"a", "ab", "a\"", "12", "1}", "\"}",
+            "</s>",
+        ]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(
+            Grammar(
+                ebnf: #"""
+                    root ::= "{" pair ("," pair)* "}"
+                    pair ::= key ":" value
+                    key ::= "\"" [a-b]+ "\""
+                    value ::= "\"" [a-b]* "\"" | [0-9]+
+                    """#
+            )
+        )
+        let stats = compiled.tokenMaskCompileStats
+        #expect(stats.maskCount < stats.maskStateCount)
+        let restored = try Grammar.Compiled(jsonData: compiled.jsonData, tokenizerInfo: tokenizer)
+        #expect(restored.tokenMaskCompileStats.maskCount == stats.maskCount)
+        let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+        let path = [
+            "{", "\"a", "b", "\"", ":", "12", ",", "\"", "ab", "\"", ":", "\"a", "a\"", "}",
+        ]
+        .map { Int32(vocab.firstIndex(of: $0)!) }
+        fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path)
+    }
+
+    @Test func identicalRulesSharingMasksProduceSameBitmasks() async throws {
+        let vocab = ["(", ")", "\"", "a", "b", "\"a", "ab", "a\"", "b\")", "\")", ")(", "(\"", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        // The first and second rules are identical, so the second one shares the masks of the first.
+        let shared = Grammar(
+            ebnf: #"""
+                root ::= "(" first ")" "(" second ")"
+                first ::= "\"" [a-b]+ "\""
+                second ::= "\"" [a-b]+ "\""
+                """#
+        )
+        // The second rule matches the same strings, but is written differently and computes its own
+        // masks.
+        let separate = Grammar(
+            ebnf: #"""
+                root ::= "(" first ")" "(" second ")"
+                first ::= "\"" [a-b]+ "\""
+                second ::= "\"" [a-b] [a-b]* "\""
+                """#
+        )
+        let path = ["(", "\"a", "b", "\"", ")(", "\"", "ab", "b\")"]
+            .map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var sharedRuleStateCounts: [Int] = []
+        var bitmasks: [[[Int32]]] = []
+        for grammar in [shared, separate] {
+            let compiled = await compiler.compile(grammar)
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            sharedRuleStateCounts.append(compiled.tokenMaskCompileStats.sharedRuleStateCount)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+        }
+        #expect(sharedRuleStateCounts[0] > 0)
+        #expect(sharedRuleStateCounts[1] == 0)
+        #expect(bitmasks[0] == bitmasks[1])
+    }
+
+    @Test func restoredMaskIndexProducesSameBitmasks() async throws {
+        // The masks are looked up in a flat index that is filled while compiling, and rebuilt from
+        // the serialized mapping when the grammar is restored. The index is the only mapping from
+        // the grammar positions to the masks, so it is also what the restored grammar serializes.
+        let vocab = makeJSONVocab()
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compiledJSON
+        let restored = try Grammar.Compiled(jsonData: compiled.jsonData, tokenizerInfo: tokenizer)
+        let maskStateCount = compiled.tokenMaskCompileStats.maskStateCount
+        #expect(maskStateCount > 0)
+        #expect(restored.tokenMaskCompileStats.maskStateCount == maskStateCount)
+        #expect(restored.jsonData == compiled.jsonData)
+        let path = ["{", "\"", "a", "\"", ":", " ", "\"", "b", "\"", "}"]
+            .map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var bitmasks: [[[Int32]]] = []
+        for grammar in [compiled, restored] {
+            let matcher = try Grammar.Matcher(grammar, terminatesWithoutStopToken: true)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+        }
+        #expect(bitmasks[0] == bitmasks[1])
+    }
+
+    @Test func fsmWalkProducesSameBitmasksAsParser() async throws {
+        let vocab = [
+            "x", "y", "x1", "xy", "xy=", "x=", "=", "=4", "=x", "4", "42", "2;", "4;y", ";", "y2=", "</s>",
+        ]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        // The name and value rules only match characters, so their masks are computed by walking
+        // their FSMs.
+        let walked = Grammar(
+            ebnf: #"""
+                root ::= name "=" value (";" name "=" value)*
+                name ::= [a-z] [a-z0-9]* (= "=")
+                value ::= [0-9] [0-9]*
+                """#
+        )
+        // The name rule references another rule, so its masks are computed by the Earley parser.
+        let parsed = Grammar(
+            ebnf: #"""
+                root ::= name "=" value (";" name "=" value)*
+                name ::= [a-z] tail (= "=")
+                tail ::= "" | [a-z0-9] tail
+                value ::= [0-9] [0-9]*
+                """#
+        )
+        let path = ["xy", "=4", "2;", "y2=", "42", ";", "x1", "=", "4"]
+            .map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var fsmWalkStateCounts: [Int] = []
+        var bitmasks: [[[Int32]]] = []
+        for grammar in [walked, parsed] {
+            let compiled = await compiler.compile(grammar)
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            fsmWalkStateCounts.append(compiled.tokenMaskCompileStats.fsmWalkStateCount)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+        }
+        #expect(fsmWalkStateCounts[0] > fsmWalkStateCounts[1])
+        #expect(bitmasks[0] == bitmasks[1])
+    }
+
+    @Test func chunkedTokenMasksProduceSameBitmasks() async throws {
+        // With more threads than states and at least two chunks of 8192 tokens, the vocabulary of
+        // each state is split into ranges whose masks are computed separately and then merged.
+        let alphabet = "abcdefghijklmnopqrstuvwxyz,".map { String($0) }
+        let pairs = alphabet.flatMap { first in alphabet.map { first + $0 } }
+        let triples = pairs.flatMap { prefix in alphabet.map { prefix + $0 } }
+        let vocab = alphabet + pairs + triples + ["</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let grammar = Grammar(
+            ebnf: #"""
+                root ::= word ("," word)*
+                word ::= [a-m] [n-z]*
+                """#
+        )
+        let path = ["anz", ",", "bo,", "cz"].map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var compiledGrammars: [Grammar.Compiled] = []
+        var bitmasks: [[[Int32]]] = []
+        for maximumThreadCount in [1, 8] {
+            let compiler = Grammar.Compiler(tokenizerInfo: tokenizer, maximumThreadCount: maximumThreadCount)
+            let compiled = await compiler.compile(grammar)
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            compiledGrammars.append(compiled)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+        }
+        #expect(compiledGrammars[0].tokenMaskCompileStats.vocabChunkCount == 1)
+        #expect(compiledGrammars[1].tokenMaskCompileStats.vocabChunkCount == 2)
+        #expect(compiledGrammars[0].jsonData == compiledGrammars[1].jsonData)
+        #expect(bitmasks[0] == bitmasks[1])
+    }
+
+    @Test func multithreadedCompilationProducesSameBitmasks() async throws {
+        // The grammar has more states than threads, so each thread computes the masks of several
+        // states into their own slots.
+        let vocab = [
+            "{", "}", "[", "]", ",", ":", "\"", "\"name", "\"age", "\"tags", "name", "age", "tags",
+            "\":", "\":\"", "\",", "\"]", "\"}", "a", "b", "ab", "x", "1", "12", "0", "</s>",
+        ]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let grammar = Grammar(
+            ebnf: #"""
+                root ::= "{" pair ("," pair)* "}"
+                pair ::= "\"name\"" ":" string | "\"age\"" ":" number | "\"tags\"" ":" "[" string ("," string)* "]"
+                string ::= "\"" [a-z]* "\""
+                number ::= [1-9] [0-9]*
+                """#
+        )
+        let path = [
+            "{", "\"name", "\":\"", "ab", "\",", "\"age", "\":", "12", ",", "\"tags", "\":", "[", "\"", "x",
+            "\"]", "}",
+        ].map { Int32(vocab.firstIndex(of: $0)!) }
+
+        var compiledGrammars: [Grammar.Compiled] = []
+        var bitmasks: [[[Int32]]] = []
+        for maximumThreadCount in [1, 4] {
+            let compiler = Grammar.Compiler(tokenizerInfo: tokenizer, maximumThreadCount: maximumThreadCount)
+            let compiled = await compiler.compile(grammar)
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            compiledGrammars.append(compiled)
+            bitmasks.append(fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path))
+        }
+        let stats = compiledGrammars[1].tokenMaskCompileStats
+        #expect(stats.maskStateCount > 4)
+        #expect(stats.vocabChunkCount == 1)
+        #expect(compiledGrammars[0].jsonData == compiledGrammars[1].jsonData)
+        #expect(bitmasks[0] == bitmasks[1])
+    }
 }
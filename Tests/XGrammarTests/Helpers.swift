@@ -33,3 +33,43 @@ func makeJSONVocab() -> [String] {
 func makeSimpleTokenizer() throws -> TokenizerInfo {
     try TokenizerInfo(encodedVocab: ["a", "b", "c"])
 }
+
+/// Fills the bitmask of the matcher before each token of the path,
+/// expecting it to allow exactly the tokens that a fork of the matcher accepts,
+/// and returns the filled bitmask words of each step.
+@discardableResult
+func fillNextTokenBitmasks(
+    _ matcher: Grammar.Matcher,
+    vocabSize: Int,
+    along path: [Int32]
+) -> [[Int32]] {
+    var bitmask = Grammar.Matcher.TokenBitmask(vocabSize: vocabSize)
+    var steps: [[Int32]] = []
+    for tokenID in path {
+        matcher.fillNextTokenBitmask(&bitmask)
+        for candidate in 0 ..< vocabSize {
+            #expect(bitmask.isTokenAllowed(candidate) == matcher.fork().accept(Int32(candidate)))
+        }
+        steps.append(bitmask.storage)
+        #expect(matcher.accept(tokenID))
+    }
+    return steps
+}
+
+/// The store types of the token masks in the serialized compiled grammar,
+/// and the store types of the masks that keep their uncertain tokens as runs.
+/// The store types are 3 for accepted runs and 4 for rejected runs.
+func tokenMaskStoreTypes(_ compiled: Grammar.Compiled) throws -> (all: [Int], withUncertainRuns: [Int]) {
+    let object = try #require(JSONSerialization.jsonObject(with: compiled.jsonData) as? [String: Any])
+    let masks = try #require(object["adaptive_token_masks"] as? [[String: Any]])
+    var all: [Int] = []
+    var withUncertainRuns: [Int] = []
+    for mask in masks {
+        let storeType = try #require(mask["store_type"] as? Int)
+        all.append(storeType)
+        if let uncertainRuns = mask["uncertain_runs"] as? [Any], !uncertainRuns.isEmpty {
+            withUncertainRuns.append(storeType)
+        }
+    }
+    return (all, withUncertainRuns)
+}
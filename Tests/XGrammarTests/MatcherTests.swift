@@ -104,6 +104,153 @@ struct MatcherTests {
         #expect(acceptedAgain)
     }
 
+    @Test func checkpointRestoresState() async throws {
+        let tokenizer = try makeSimpleTokenizer()
+        let grammar = Grammar(ebnf: #"root ::= "a" ("a" | "b")"#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        #expect(matcher.accept(0))
+        let checkpoint = matcher.checkpoint()
+        #expect(matcher.accept(1))
+        #expect(matcher.isTerminated)
+        matcher.restore(checkpoint)
+        #expect(!matcher.isTerminated)
+        #expect(matcher.accept(0))
+        #expect(matcher.isTerminated)
+        matcher.restore(checkpoint)
+        matcher.rollback()
+        #expect(matcher.accept(0))
+    }
+
+    @Test func forkAcceptsIndependently() async throws {
+        let tokenizer = try makeSimpleTokenizer()
+        let grammar = Grammar(ebnf: #"root ::= "a" ("a" | "b")"#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        #expect(matcher.accept(0))
+        let forked = matcher.fork()
+        #expect(matcher.accept(0))
+        #expect(matcher.isTerminated)
+        #expect(!forked.isTerminated)
+        #expect(forked.accept(1))
+        #expect(forked.isTerminated)
+        forked.rollback(count: 2)
+        #expect(forked.accept(0))
+        #expect(!forked.isTerminated)
+    }
+
+    @Test func longestAcceptedPrefixLeavesStateUnchanged() async throws {
+        let tokenizer = try makeSimpleTokenizer()
+        let grammar = Grammar(ebnf: #"root ::= "a" "b" "c""#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        #expect(matcher.longestAcceptedPrefixLength([0, 1, 1, 2]) == 2)
+        #expect(matcher.longestAcceptedPrefixLength([0, 1, 2]) == 3)
+        #expect(matcher.longestAcceptedPrefixLength([]) == 0)
+        #expect(matcher.accept(0))
+        #expect(matcher.longestAcceptedPrefixLength([1, 2]) == 2)
+        #expect(!matcher.isTerminated)
+    }
+
+    @Test func fillNextTokenBitmaskWithoutUncertainTokens() async throws {
+        // Every token is accepted or rejected by the character classes alone, so the bitmask is
+        // combined from the stored masks without running the parser. The vocabulary is large
+        // enough for the masks to store the few rejected tokens.
+        let vocab = (0 ..< 200).map { "t\($0)" } + ["x", "y", "xy", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let grammars = [
+            #"root ::= [^x]*"#,
+            #"""
+            root ::= p | q
+            p ::= [^x]* "t1" p?
+            q ::= [^y]* "t2" q?
+            """#,
+        ]
+        for ebnf in grammars {
+            let compiled = await compiler.compile(Grammar(ebnf: ebnf))
+            let matcher = try Grammar.Matcher(compiled, stopTokens: [Int32(vocab.count - 1)])
+            var bitmask = Grammar.Matcher.TokenBitmask(vocabSize: vocab.count)
+            for _ in 0 ..< 2 {
+                matcher.fillNextTokenBitmask(&bitmask)
+                for tokenID in 0 ..< vocab.count {
+                    let accepted = matcher.fork().accept(Int32(tokenID))
+                    #expect(bitmask.isTokenAllowed(tokenID) == accepted)
+                }
+                #expect(!bitmask.isTokenAllowed(vocab.firstIndex(of: "xy")!))
+                #expect(matcher.accept(0))
+            }
+        }
+    }
+
+    @Test func fillNextTokenBitmaskAsyncMatchesSync() async throws {
+        let tokenizer = try makeSimpleTokenizer()
+        let grammar = Grammar(ebnf: #"root ::= "a" ("b" | "c")"#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        #expect(matcher.accept(0))
+        var expected = Grammar.Matcher.TokenBitmask(batchSize: 2, vocabSize: 3)
+        matcher.fillNextTokenBitmask(&expected, index: 1)
+
+        let pending = matcher.fillNextTokenBitmaskAsync(
+            Grammar.Matcher.TokenBitmask(batchSize: 2, vocabSize: 3),
+            index: 1
+        )
+        let bitmask = try pending.wait()
+        #expect(bitmask.storage == expected.storage)
+        #expect(allowedTokenIndices(bitmask, vocabSize: 3, batchIndex: 1) == [1, 2])
+    }
+
+    @Test func fillNextTokenBitmaskAsyncRethrowsErrors() async throws {
+        let tokenizer = try TokenizerInfo(encodedVocab: ["a", "b", "</s>"])
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let compiled = await compiler.compile(Grammar(ebnf: #"root ::= "a""#))
+        let matcher = try Grammar.Matcher(compiled, stopTokens: [2])
+        #expect(matcher.accept(0))
+        #expect(matcher.accept(2))
+
+        // A matcher that accepted the stop token has no next token bitmask.
+        let pending = matcher.fillNextTokenBitmaskAsync(
+            Grammar.Matcher.TokenBitmask(vocabSize: 3)
+        )
+        #expect(throws: XGrammarError.self) {
+            try pending.wait()
+        }
+    }
+
+    @Test func verifyDraftTreeAcceptsValidPaths() async throws {
+        let tokenizer = try makeSimpleTokenizer()
+        let grammar = Grammar(ebnf: #"root ::= "a" ("a" | "b") "c""#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        var bitmask = Grammar.Matcher.TokenBitmask(batchSize: 5, vocabSize: 3)
+        // root -> a -> {b -> c, c}
+        let accepted = matcher.verifyDraftTree(
+            tokens: [0, 0, 1, 2, 2],
+            parentIndices: [-1, 0, 1, 2, 1],
+            bitmask: &bitmask
+        )
+        #expect(accepted == [true, true, true, true, false])
+        #expect(bitmask.isTokenAllowed(0, batchIndex: 0))
+        #expect(!bitmask.isTokenAllowed(2, batchIndex: 1))
+        #expect(bitmask.isTokenAllowed(2, batchIndex: 2))
+        #expect(matcher.accept(0))
+    }
+
+    @Test func verifyDraftTreeContinuesPastCompletedNodes() async throws {
+        let tokenizer = try TokenizerInfo(encodedVocab: ["1", "2", "a"])
+        let grammar = Grammar(ebnf: #"root ::= [0-9]+"#)
+        let matcher = try await grammar.matcher(for: tokenizer, terminatesWithoutStopToken: true)
+        var bitmask = Grammar.Matcher.TokenBitmask(batchSize: 4, vocabSize: 3)
+        // root -> 1 -> 2 -> a. The grammar is completed after "1", but can still accept digits.
+        let accepted = matcher.verifyDraftTree(
+            tokens: [0, 0, 1, 2],
+            parentIndices: [-1, 0, 1, 2],
+            bitmask: &bitmask
+        )
+        #expect(accepted == [true, true, true, false])
+        #expect(bitmask.isTokenAllowed(1, batchIndex: 1))
+        #expect(!bitmask.isTokenAllowed(2, batchIndex: 1))
+        #expect(bitmask.isTokenAllowed(0, batchIndex: 2))
+        #expect(!matcher.isTerminated)
+        #expect(matcher.accept(0))
+    }
+
     @Test func resetRestoresInitialState() async throws {
         let tokenizer = try makeSimpleTokenizer()
         let grammar = Grammar(ebnf: #"root ::= "a""#)
@@ -166,4 +313,40 @@ struct MatcherTests {
         let rejectedAfterTermination = matcher.accept(0)
         #expect(!rejectedAfterTermination)
     }
+
+    @Test func largeClosuresAllowUnionOfAlternatives() async throws {
+        // Predicting the item rule visits more than 50 states, which the parser tracks in a hash
+        // table instead of scanning them.
+        let alternatives = Array(0 ..< 60)
+        func makeGrammar(_ alternatives: [Int]) -> Grammar {
+            let rules = [
+                #"root ::= item (";" item)*"#,
+                "item ::= " + alternatives.map { "r\($0)" }.joined(separator: " | "),
+                "word ::= [a-z]*",
+            ]
+            return Grammar(
+                ebnf: (rules + alternatives.map { #"r\#($0) ::= "\#($0)=" word"# }).joined(separator: "\n")
+            )
+        }
+        let vocab = alternatives.map { "\($0)=" } + (0 ..< 10).map { "\($0)" } + ["=", "a", "b", "ab", ";", "</s>"]
+        let tokenizer = try TokenizerInfo(encodedVocab: vocab)
+        let compiler = Grammar.Compiler(tokenizerInfo: tokenizer)
+        let stopTokens = [Int32(vocab.count - 1)]
+
+        let compiled = await compiler.compile(makeGrammar(alternatives))
+        let matcher = try Grammar.Matcher(compiled, stopTokens: stopTokens)
+        let path = ["7=", "ab", ";", "4", "2=", "a"].map { Int32(vocab.firstIndex(of: $0)!) }
+        let bitmasks = fillNextTokenBitmasks(matcher, vocabSize: vocab.count, along: path)
+
+        // The first item allows the tokens of any alternative.
+        var union = [Int32](repeating: 0, count: bitmasks[0].count)
+        for alternative in alternatives {
+            let singleCompiled = await compiler.compile(makeGrammar([alternative]))
+            let singleMatcher = try Grammar.Matcher(singleCompiled, stopTokens: stopTokens)
+            var bitmask = Grammar.Matcher.TokenBitmask(vocabSize: vocab.count)
+            singleMatcher.fillNextTokenBitmask(&bitmask)
+            union = zip(union, bitmask.storage).map { $0 | $1 }
+        }
+        #expect(bitmasks[0] == union)
+    }
 }
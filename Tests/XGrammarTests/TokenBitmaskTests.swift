@@ -33,6 +33,43 @@ struct TokenBitmaskTests {
         #expect(logits[32 ..< 64].allSatisfy { $0 == 1.0 })
     }
 
+    @Test func maskLogitsMatchesIsTokenAllowed() {
+        var bitmask = Grammar.Matcher.TokenBitmask(batchSize: 1, vocabSize: 100)
+        bitmask.storage = [-1, 0, 0x5555_5555, 0x0F0F_0001]
+        var logits = Array(repeating: Float(1.0), count: 100)
+        bitmask.maskLogits(&logits)
+        for tokenId in 0 ..< 100 {
+            let expected: Float = bitmask.isTokenAllowed(tokenId) ? 1.0 : -Float.infinity
+            #expect(logits[tokenId] == expected)
+        }
+    }
+
+    @Test func maskBatchLogitsMatchesAcrossThreadCounts() {
+        // Large enough for the rows to be split into several ranges.
+        let vocabSize = 70_000
+        let batchSize = 4
+        var bitmask = Grammar.Matcher.TokenBitmask(batchSize: batchSize, vocabSize: vocabSize)
+        for index in bitmask.storage.indices {
+            bitmask.storage[index] = Int32(truncatingIfNeeded: index &* 0x9E37_79B9)
+        }
+        let logits = (0 ..< vocabSize * batchSize).map { Float($0 % 7) }
+
+        var serial = logits
+        bitmask.maskBatchLogits(&serial, threadCount: 1)
+        var parallel = logits
+        bitmask.maskBatchLogits(&parallel, threadCount: 4)
+        #expect(serial == parallel)
+
+        for batchIndex in 0 ..< batchSize {
+            for tokenId in stride(from: 0, to: vocabSize, by: 97) {
+                let expected =
+                    bitmask.isTokenAllowed(tokenId, batchIndex: batchIndex)
+                    ? logits[batchIndex * vocabSize + tokenId] : -Float.infinity
+                #expect(parallel[batchIndex * vocabSize + tokenId] == expected)
+            }
+        }
+    }
+
     @Test func isTokenAllowedUsesBitmask() {
         var bitmask = Grammar.Matcher.TokenBitmask(batchSize: 1, vocabSize: 8)
         bitmask.storage[0] = 0